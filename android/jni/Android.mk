@@ -12,6 +12,10 @@ LOCAL_SRC_FILES := ../../src/external/js0n/js0n.c \
 	../../pslr_lens.c \
 	../../pslr_model.c \
 	../../pslr_scsi.c \
+	../../pslr_scsi_sim.c \
+	../../pslr_scsi_replay.c \
+	../../pslr_trace.c \
+	../../pslr_watch.c \
 	../../pslr.c \
 	../../pslr_utils.c \
 	../../pktriggercord-servermode.c \
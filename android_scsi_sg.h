@@ -55,6 +55,17 @@ typedef struct sg_io_hdr {
 /* synchronous SCSI command ioctl, (only in version 3 interface) */
 #define SG_IO 0x2285   /* similar effect as write() followed by read() */
 
+#define SG_GET_VERSION_NUM 0x2282 /* Example: version 2.1.34 yields 20134 */
+
+/* force read() to only return the packet with the given pack_id */
+#define SG_SET_FORCE_PACK_ID 0x227b
+
+/* Get/set the size of the reserved buffer, used by SG_FLAG_MMAP_IO */
+#define SG_GET_RESERVED_SIZE 0x2272
+#define SG_SET_RESERVED_SIZE 0x2275
+
+#define SG_FLAG_MMAP_IO 4       /* request memory mapped IO */
+
 /* The following 'info' values are "or"-ed together.  */
 #define SG_INFO_OK_MASK 0x1
 #define SG_INFO_OK      0x0 /* no sense, host nor driver "noise" */
@@ -0,0 +1,148 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#ifdef RAD10
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "pslr.h"
+#include "pslr_archive.h"
+
+#ifdef WIN32
+#define FILE_ACCESS O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
+#else
+#define FILE_ACCESS O_WRONLY | O_CREAT | O_TRUNC
+#endif
+
+void usage(char *name) {
+    printf("\nUsage: %s COMMAND ARCHIVE [FRAME]...\n\
+\n\
+Lists and extracts the capture archives written by pktriggercord-cli --archive.\n\
+\n\
+Commands:\n\
+  list       print the frames of the archive\n\
+  extract    write the frames (all of them if none is given) into ARCHIVE-NNNN.ext files\n\
+  verify     check the CRC of the frames\n\
+  reindex    rebuild ARCHIVE.idx by scanning the archive\n\
+\n", name);
+}
+
+static bool frame_selected(uint64_t frame, int argc, char **argv) {
+    int i;
+    if (argc == 0) {
+        return true;
+    }
+    for (i = 0; i < argc; ++i) {
+        if (strtoull(argv[i], NULL, 10) == frame) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *format_extension(uint32_t format) {
+    return format < USER_FILE_FORMAT_MAX ? pslr_get_user_file_format_t(format)->extension : "dat";
+}
+
+int main(int argc, char **argv) {
+    pslr_archive_entry_t *entries;
+    char *command;
+    char *filename;
+    int errors = 0;
+    int num;
+    int i;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return -1;
+    }
+    command = argv[1];
+    filename = argv[2];
+
+    if (!strcmp(command, "reindex")) {
+        num = pslr_archive_reindex(filename);
+        if (num < 0) {
+            fprintf(stderr, "%s is not a capture archive\n", filename);
+            return -1;
+        }
+        printf("%d frames indexed\n", num);
+        return 0;
+    }
+
+    num = pslr_archive_load_index(filename, &entries);
+    if (num < 0) {
+        fprintf(stderr, "%s is not a capture archive\n", filename);
+        return -1;
+    }
+    for (i = 0; i < num; ++i) {
+        pslr_archive_entry_t *e = &entries[i];
+        if (!frame_selected(e->frame, argc - 3, argv + 3)) {
+            continue;
+        }
+        if (!strcmp(command, "list")) {
+            printf("%6llu %12llu %10llu %08x %-4s ISO %u %d/%d s f/%.1f\n", (unsigned long long)e->frame,
+                   (unsigned long long)e->offset, (unsigned long long)e->length, e->crc, format_extension(e->format),
+                   e->iso, e->shutter_speed.nom, e->shutter_speed.denom,
+                   e->aperture.denom ? 1.0 * e->aperture.nom / e->aperture.denom : 0.0);
+        } else if (!strcmp(command, "verify")) {
+            if (pslr_archive_extract(filename, e, -1, NULL) != PSLR_OK) {
+                printf("%llu: bad\n", (unsigned long long)e->frame);
+                ++errors;
+            }
+        } else if (!strcmp(command, "extract")) {
+            char name[512];
+            snprintf(name, sizeof(name), "%s-%04llu.%s", filename, (unsigned long long)e->frame, format_extension(e->format));
+            int fd = open(name, FILE_ACCESS, 0664);
+            if (fd == -1) {
+                fprintf(stderr, "Could not open %s\n", name);
+                ++errors;
+                continue;
+            }
+            if (pslr_archive_extract(filename, e, fd, NULL) != PSLR_OK) {
+                fprintf(stderr, "%s: bad data\n", name);
+                ++errors;
+            }
+            close(fd);
+        } else {
+            usage(argv[0]);
+            free(entries);
+            return -1;
+        }
+    }
+    if (!strcmp(command, "verify")) {
+        printf("%d frames, %d bad\n", num, errors);
+    }
+    free(entries);
+    return errors ? -1 : 0;
+}
@@ -44,11 +44,18 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "pslr.h"
 #include "pktriggercord-servermode.h"
 #include "pslr_log.h"
 #include "pslr_utils.h"
+#include "pslr_trace.h"
+#include "pslr_scsi_replay.h"
+#include "pslr_archive.h"
+#include "pslr_watch.h"
 
 #ifdef WIN32
 #define FILE_ACCESS O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
@@ -63,6 +70,19 @@ bool bulb_timer_before=false;
 bool astrotracer_before=false;
 bool need_bulb_new_cleanup=false;
 bool need_one_push_bracketing_cleanup=false;
+bool mapped_download=false;
+// serializes the camera commands of the threads in pipelined mode, NULL otherwise
+pthread_mutex_t *camera_mutex=NULL;
+int file_num_digits=4;  // width of the frame number in the file names, grows with the run
+int shard_size=0;       // files per subdirectory, 0: all files in one directory
+pslr_archive_t *archive=NULL;   // --archive output, the pictures go into this instead of files
+uint64_t archive_frame;         // frame number of the next archive record
+uint64_t archive_first_frame;   // of this run, after the frames already in the archive
+#define ARCHIVE_FD -2           // open_file() result in archive mode
+bool checksum=false;            // --checksum, report the CRC32C of the pictures
+char output_file_name[512];     // file of the last open_file(), empty for stdout and the archive
+double status_cache_window=-1;  // --status_cache, -1: STATUS_CACHE_DEFAULT unless tracing or replaying
+#define STATUS_CACHE_DEFAULT 0.05
 
 #ifdef RAD10
 static option const longopts[] = {
@@ -114,15 +134,127 @@ static struct option const longopts[] = {
     {"settings_hex", no_argument, NULL, 28},
     {"dump_memory", required_argument, NULL, 29},
     {"file_num_start", required_argument, NULL, 30},
+    {"async_download", no_argument, NULL, 31},
+    {"stats", no_argument, NULL, 32},
+    {"mmap_download", no_argument, NULL, 33},
+    {"trace", required_argument, NULL, 34},
+    {"replay_realtime", no_argument, NULL, 35},
+    {"group_shutter", no_argument, NULL, 36},
+    {"trigger_latency", no_argument, NULL, 37},
+    {"pipeline", no_argument, NULL, 38},
+    {"schedule", required_argument, NULL, 39},
+    {"shard_size", required_argument, NULL, 40},
+    {"archive", required_argument, NULL, 41},
+    {"checksum", no_argument, NULL, 42},
+    {"status_cache", required_argument, NULL, 43},
     {"settings", no_argument, NULL, 'S'},
     { NULL, 0, NULL, 0}
 };
 
-int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status, user_file_format filefmt, int jpeg_stars) {
-    pslr_buffer_type imagetype;
-    uint8_t buf[65536];
+static void camera_lock() {
+    if (camera_mutex) {
+        pthread_mutex_lock(camera_mutex);
+    }
+}
+
+static void camera_unlock() {
+    if (camera_mutex) {
+        pthread_mutex_unlock(camera_mutex);
+    }
+}
+
+/* Reserves the space of the picture before the download, so the file is
+   allocated in one piece. Only for the newly created output files. */
+static bool preallocate_file(int fd, uint32_t length) {
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+    if (fd != 1 && length > 0) {
+        int r = posix_fallocate(fd, 0, length);
+        if (r != 0) {
+            DPRINT("posix_fallocate: %s\n", strerror(r));
+            return false;
+        }
+        return true;
+    }
+#endif
+    return false;
+}
+
+#define DOWNLOAD_RESUME_RETRY 5
+#define DOWNLOAD_READY_RETRY 1000 /* 10 ms apart, gives up on a buffer after 10 sec */
+
+/* Prints the checksum and writes it into the FILE.crc32c sidecar file,
+   in the same format as the crc32c tools. */
+static void write_checksum(int fd, uint32_t crc) {
+    if (fd == ARCHIVE_FD) {
+        // the archive records carry their checksum anyway
+        printf("frame %llu crc32c %08x\n", (unsigned long long) archive_frame, crc);
+        return;
+    }
+    if (fd == 1 || output_file_name[0] == '\0') {
+        fprintf(stderr, "crc32c %08x\n", crc);
+        return;
+    }
+    printf("%s crc32c %08x\n", output_file_name, crc);
+    char sidecar[sizeof(output_file_name) + 8];
+    snprintf(sidecar, sizeof(sidecar), "%s.crc32c", output_file_name);
+    FILE *f = fopen(sidecar, "w");
+    if (!f) {
+        perror("could not open checksum file");
+        return;
+    }
+    const char *base = strrchr(output_file_name, '/');
+    fprintf(f, "%08x  %s\n", crc, base ? base+1 : output_file_name);
+    fclose(f);
+}
+
+typedef struct {
+    pslr_handle_t camhandle;
+    int fd;
+    pslr_status *status;
+    user_file_format filefmt;
     uint32_t length;
     uint32_t current;
+    bool preallocated;
+    uint32_t crc;                   // CRC32C of the data so far, computed as the blocks arrive
+} save_sink_t;
+
+static int save_buffer_sink(const uint8_t *data, uint32_t bytes, uintptr_t user_data) {
+    save_sink_t *s = (save_sink_t *) user_data;
+    if (s->current == 0) {
+        s->length = pslr_buffer_get_size(s->camhandle);
+        DPRINT("Buffer length: %d\n", s->length);
+        if (s->fd == ARCHIVE_FD) {
+            pslr_archive_begin(archive, archive_frame, s->length, s->filefmt, s->status);
+        } else {
+            s->preallocated = preallocate_file(s->fd, s->length);
+        }
+    }
+    if (s->fd == ARCHIVE_FD) {
+        if (pslr_archive_write(archive, data, bytes) != PSLR_OK) {
+            perror("archive");
+        }
+    } else {
+        ssize_t r = write(s->fd, data, bytes);
+        if (r == 0) {
+            DPRINT("write(buf): Nothing has been written to buf.\n");
+        } else if (r == -1) {
+            perror("write(buf)");
+        } else if ((uint32_t)r < bytes) {
+            DPRINT("write(buf): only write %zu bytes, should be %d bytes.\n", r, bytes);
+        }
+    }
+    s->crc = crc32c_update(s->crc, data, bytes);
+    s->current += bytes;
+    return PSLR_OK;
+}
+
+/* Returns 0 when the picture is saved, 1 when the buffer is not ready
+   (nothing written, try again) and -1 when the download failed part-way,
+   the picture has to stay in the camera then. */
+int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status, user_file_format filefmt, int jpeg_stars) {
+    pslr_buffer_type imagetype;
+    save_sink_t sink = { camhandle, fd, status, filefmt, 0, 0, false, 0 };
+    int ret;
 
     if (filefmt == USER_FILE_FORMAT_PEF) {
         imagetype = PSLR_BUF_PEF;
@@ -134,32 +266,53 @@ int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status,
 
     DPRINT("get buffer %d type %d res %d\n", bufno, imagetype, status->jpeg_resolution);
 
-    if (pslr_buffer_open(camhandle, bufno, imagetype, status->jpeg_resolution) != PSLR_OK) {
-        return 1;
+    camera_lock();
+    ret = pslr_buffer_download(camhandle, bufno, imagetype, status->jpeg_resolution, save_buffer_sink, (uintptr_t) &sink);
+    camera_unlock();
+    if (sink.current == 0) {
+        // the buffer could not be opened (or was empty), nothing has been written
+        return ret != PSLR_OK ? 1 : 0;
     }
-
-    length = pslr_buffer_get_size(camhandle);
-    DPRINT("Buffer length: %d\n", length);
-    current = 0;
-
-    while (true) {
-        uint32_t bytes;
-        bytes = pslr_buffer_read(camhandle, buf, sizeof (buf));
-        if (bytes == 0) {
-            break;
-        }
-        ssize_t r = write(fd, buf, bytes);
-        if (r == 0) {
-            DPRINT("write(buf): Nothing has been written to buf.\n");
-        } else if (r == -1) {
-            perror("write(buf)");
-        } else if ((uint32_t)r < bytes) {
-            DPRINT("write(buf): only write %zu bytes, should be %d bytes.\n", r, bytes);
+    // continue an interrupted download where it stopped instead of starting the picture again
+    int resume = 0;
+    while (ret != PSLR_OK && sink.current < sink.length && resume < DOWNLOAD_RESUME_RETRY) {
+        uint32_t last = sink.current;
+        DPRINT("Download error %d at %u, resuming\n", ret, sink.current);
+        usleep(10000);
+        camera_lock();
+        ret = pslr_buffer_download_from(camhandle, bufno, imagetype, status->jpeg_resolution, sink.current, save_buffer_sink, (uintptr_t) &sink);
+        camera_unlock();
+        resume = sink.current > last ? 0 : resume + 1;
+    }
+    if (ret != PSLR_OK) {
+        fprintf(stderr, "Download error: %u of %u bytes saved\n", sink.current, sink.length);
+    }
+    if (fd == ARCHIVE_FD) {
+        pslr_archive_end(archive);
+    }
+    if (sink.preallocated && sink.current < sink.length) {
+        // less data than the reported size, the rest of the reserved space is not part of the picture
+        if (ftruncate(fd, sink.current) != 0) {
+            perror("ftruncate");
         }
-        current += bytes;
     }
-    pslr_buffer_close(camhandle);
-    return 0;
+    if (checksum) {
+        write_checksum(fd, sink.crc);
+    }
+    return ret != PSLR_OK ? -1 : 0;
+}
+
+/* save_buffer waiting for the buffer to become ready, but not forever. */
+static int save_buffer_wait(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status, user_file_format filefmt, int jpeg_stars) {
+    int retry = 0;
+    int ret;
+    while ((ret = save_buffer(camhandle, bufno, fd, status, filefmt, jpeg_stars)) > 0 && ++retry < DOWNLOAD_READY_RETRY) {
+        usleep(10000);
+    }
+    if (ret > 0) {
+        fprintf(stderr, "Buffer %d is not ready, giving up\n", bufno);
+    }
+    return ret;
 }
 
 void save_memory(pslr_handle_t camhandle, int fd, uint32_t length) {
@@ -190,6 +343,165 @@ void save_memory(pslr_handle_t camhandle, int fd, uint32_t length) {
 }
 
 
+void print_stats( pslr_handle_t h ) {
+    pslr_download_stats_t download_stats;
+    pslr_get_download_stats( h, &download_stats );
+    // stderr, since the image itself could go to stdout
+    fprintf(stderr, "%-32s: %llu bytes, %u blocks, %.3f sec", "download",
+            (unsigned long long)download_stats.bytes, download_stats.blocks, download_stats.seconds);
+    if ( download_stats.seconds > 0 ) {
+        fprintf(stderr, " (%.2f MB/s)", download_stats.bytes / download_stats.seconds / (1024*1024));
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%-32s: %u records, %.3f sec\n", "segment negotiation",
+            download_stats.segment_records, download_stats.segment_seconds);
+
+    pslr_status_cache_stats_t cache_stats;
+    pslr_get_status_cache_stats( h, &cache_stats );
+    fprintf(stderr, "%-32s: %u hits, %u misses, %u invalidations\n", "status cache",
+            cache_stats.hits, cache_stats.misses, cache_stats.invalidations);
+
+    pslr_command_stats_t command_stats[MAX_COMMAND_STATS];
+    int command_num = pslr_get_command_stats( h, command_stats, MAX_COMMAND_STATS );
+    int i;
+    for ( i = 0; i < command_num; ++i ) {
+        char name[32];
+        snprintf( name, sizeof(name), "command %02X %02X", command_stats[i].a, command_stats[i].b );
+        fprintf(stderr, "%-32s: %u calls, latency avg %.2f ms min %.2f ms max %.2f ms, %.1f polls/call\n", name,
+                command_stats[i].count, 1000 * command_stats[i].total / command_stats[i].count,
+                1000 * command_stats[i].min, 1000 * command_stats[i].max,
+                (double)command_stats[i].polls / command_stats[i].count);
+    }
+}
+
+/* Trigger latencies of --trigger_latency. The shots that found the camera
+   not armed (the arm is lost after every picture in pipelined mode) also
+   include the arm, they are kept apart. */
+typedef struct {
+    double *armed;
+    int armed_num;
+    double *unarmed;
+    int unarmed_num;
+} trigger_latency_t;
+
+/* Fires the armed shutter and records the time until the shutter command
+   reached the camera. Arms first if the camera is not armed, that shot
+   counts as unarmed and its time includes the arm. */
+int fire_shutter( pslr_handle_t h, trigger_latency_t *tl ) {
+    double start = get_monotonic_sec();
+    bool armed = true;
+    int ret = pslr_shutter_fire( h );
+    if ( ret == PSLR_PARAM ) {
+        armed = false;
+        pslr_shutter_arm( h, true );
+        ret = pslr_shutter_fire( h );
+    }
+    if ( ret == PSLR_OK ) {
+        double latency = pslr_get_shutter_sent_time( h ) - start;
+        if ( armed ) {
+            tl->armed[tl->armed_num++] = latency;
+        } else {
+            tl->unarmed[tl->unarmed_num++] = latency;
+        }
+    }
+    return ret;
+}
+
+static int compare_double( const void *a, const void *b ) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank percentile of the sorted values */
+static double percentile( double *sorted, int num, int p ) {
+    int rank = (num * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_latency_percentiles( const char *name, double *latencies, int num ) {
+    if ( num == 0 ) {
+        return;
+    }
+    qsort( latencies, num, sizeof(double), compare_double );
+    fprintf(stderr, "%-32s: %d shots, min %.3f ms p50 %.3f ms p90 %.3f ms p99 %.3f ms max %.3f ms\n", name, num,
+            1000 * latencies[0], 1000 * percentile(latencies, num, 50), 1000 * percentile(latencies, num, 90),
+            1000 * percentile(latencies, num, 99), 1000 * latencies[num - 1]);
+}
+
+void print_trigger_latency( trigger_latency_t *tl ) {
+    print_latency_percentiles( "trigger latency", tl->armed, tl->armed_num );
+    print_latency_percentiles( "trigger latency (not armed)", tl->unarmed, tl->unarmed_num );
+}
+
+typedef enum {
+    SCHEDULE_CATCHUP,   // missed deadlines are shot right away, one by one
+    SCHEDULE_SKIP       // missed deadlines are dropped except the last one
+} schedule_policy_t;
+
+/* Frame deadlines on the monotonic clock: frame N is due at start + N *
+   interval, so the command and download times do not add up over a long
+   run. The lateness of every frame is kept for the statistics. */
+typedef struct {
+    double start;
+    double interval;
+    schedule_policy_t policy;
+    int slot;                   // index of the next deadline
+    int skipped;                // deadlines dropped by SCHEDULE_SKIP
+    double *lateness;           // sec, one per frame
+    int num;
+} frame_schedule_t;
+
+void schedule_init( frame_schedule_t *sched, double interval, schedule_policy_t policy, int frames ) {
+    memset(sched, 0, sizeof(*sched));
+    sched->start = get_monotonic_sec();
+    sched->interval = interval;
+    sched->policy = policy;
+    sched->lateness = malloc(frames * sizeof(double));
+}
+
+/* Waits for the deadline of the next frame */
+void schedule_wait( frame_schedule_t *sched ) {
+    double deadline = sched->start + sched->slot * sched->interval;
+    double now = get_monotonic_sec();
+    if ( sched->policy == SCHEDULE_SKIP && sched->interval > 0 && now - deadline >= sched->interval ) {
+        int missed = (int) ((now - deadline) / sched->interval);
+        sched->slot += missed;
+        sched->skipped += missed;
+        deadline += missed * sched->interval;
+    }
+    if ( deadline > now ) {
+        printf("Waiting for %.2f sec\n", deadline - now);
+        sleep_until_monotonic_sec( deadline );
+        now = get_monotonic_sec();
+    }
+    sched->lateness[sched->num++] = now - deadline;
+    ++sched->slot;
+}
+
+void schedule_print_stats( frame_schedule_t *sched ) {
+    int num = sched->num;
+    double sum = 0;
+    int i;
+    if ( num == 0 || sched->interval <= 0 ) {
+        return;
+    }
+    // the end of the run compared to the plan
+    double drift = get_monotonic_sec() - (sched->start + (sched->slot - 1) * sched->interval);
+    for ( i = 0; i < num; ++i ) {
+        sum += sched->lateness[i];
+    }
+    qsort( sched->lateness, num, sizeof(double), compare_double );
+    fprintf(stderr, "%-32s: %d frames, %d skipped, lateness avg %.3f ms p50 %.3f ms p99 %.3f ms max %.3f ms, last frame done %.3f sec after its deadline\n",
+            "frame schedule", num, sched->skipped, 1000 * sum / num, 1000 * percentile(sched->lateness, num, 50),
+            1000 * percentile(sched->lateness, num, 99), 1000 * sched->lateness[num - 1], drift);
+}
+
+void schedule_free( frame_schedule_t *sched ) {
+    free(sched->lateness);
+    sched->lateness = NULL;
+}
+
 void print_status_info( pslr_handle_t h, pslr_status status ) {
     printf("\n");
     printf( "%s", pslr_get_status_info( h, status ) );
@@ -205,6 +517,7 @@ void usage(char *name) {
 \n\
       --model=CAMERA_MODEL              valid values are: K20d, K10d, GX10, GX20, K-x, K200D, K-7, K-r, K-5, K-2000, K-m, K-30, K100D, K110D, K-01, K-3, K-3II, K-500\n\
       --device=DEVICE                   valid values for Linux: sg0, sg1, ..., for Windows: C, D, E, ...\n\
+                                        sim:MODEL for a simulated camera\n\
       --timeout=SECONDS                 timeout for camera connection ( 0 means forever )\n\
   -w, --warnings                        warning mode on\n\
       --nowarnings                      warning mode off\n\
@@ -239,10 +552,23 @@ void usage(char *name) {
       --dump_memory SIZE                dumps the internal memory of the camera to pentax_dump.dat file. Size is in bytes, but can be specified using K, M, and G modifiers.\n\
       --dust_removal                    dust removal\n\
   -F, --frames=NUMBER                   number of frames\n\
-  -d, --delay=SECONDS                   delay between the frames (seconds)\n\
+  -d, --delay=SECONDS                   delay between the frames (seconds), fractions are allowed\n\
+      --schedule=POLICY                 frames behind the --delay schedule: catchup (default) takes them right away, skip drops them\n\
       --file_format=FORMAT              valid values: PEF, DNG, JPEG\n\
   -o, --output_file=FILE                send output to FILE\n\
       --file_num_start=NUMBER           number to start the filename frame counter at\n\
+      --shard_size=NUMBER               put every NUMBER files into a new subdirectory\n\
+      --archive=FILE                    append the pictures to the FILE capture archive instead of separate files\n\
+      --checksum                        print the CRC32C of the downloaded pictures and write it into FILE.crc32c\n\
+      --status_cache=SECONDS            reuse the camera status read within SECONDS (default 0.05), 0 disables it\n\
+      --async_download                  queue the download commands to the device (Linux sg devices only)\n\
+      --mmap_download                   download into the memory mapped buffer of the driver (Linux sg devices only)\n\
+      --stats                           print transfer and command latency statistics at the end\n\
+      --trace=FILE                      record the SCSI traffic into FILE, replay it with --device=replay:FILE\n\
+      --replay_realtime                 replay a trace with the recorded timing\n\
+      --group_shutter                   fire every connected camera at the same time and print the skew between them\n\
+      --trigger_latency                 arm the shutter before the frames and print the trigger latency percentiles at the end\n\
+      --pipeline                        download the pictures in the background while taking the next frames\n\
       --debug                           turn on debug messages\n\
       --noshutter                       do not send shutter command, just wait for new photo, download and delete from camera\n\
   -v, --version                         display version information and exit\n\
@@ -251,11 +577,32 @@ void usage(char *name) {
 \n", name);
 }
 
+/* Directory of the frame when sharding, named after its first frame number */
+static int make_shard_dir(char *dirName, size_t size, char* output_file, int frameNo) {
+    char *slash = strrchr(output_file, '/');
+    int dir_length = slash ? slash - output_file + 1 : 0;
+    snprintf(dirName, size, "%.*s%0*d", dir_length, output_file, file_num_digits, frameNo - frameNo % shard_size);
+#ifdef WIN32
+    int r = mkdir(dirName);
+#else
+    int r = mkdir(dirName, 0775);
+#endif
+    if (r != 0 && errno != EEXIST) {
+        pslr_write_log(PSLR_ERROR, "Could not create directory %s\n", dirName);
+        return -1;
+    }
+    return dir_length;
+}
+
 int open_file(char* output_file, int frameNo, user_file_format_t ufft) {
     int ofd;
-    char fileName[256];
+    char fileName[512];
 
-    if (!output_file) {
+    output_file_name[0] = '\0';
+    if (archive) {
+        archive_frame = archive_first_frame + frameNo;
+        ofd = ARCHIVE_FD;
+    } else if (!output_file) {
         ofd = 1;
     } else {
         char *dot = strrchr(output_file, '.');
@@ -265,16 +612,289 @@ int open_file(char* output_file, int frameNo, user_file_format_t ufft) {
         } else {
             prefix_length = strlen(output_file);
         }
-        snprintf(fileName, 256, "%.*s-%04d.%s", prefix_length, output_file, frameNo, ufft.extension);
+        if (shard_size > 0) {
+            char dirName[256];
+            int dir_length = make_shard_dir(dirName, sizeof(dirName), output_file, frameNo);
+            if (dir_length < 0) {
+                return -1;
+            }
+            snprintf(fileName, sizeof(fileName), "%s/%.*s-%0*d.%s", dirName, prefix_length - dir_length, output_file + dir_length,
+                     file_num_digits, frameNo, ufft.extension);
+        } else {
+            snprintf(fileName, sizeof(fileName), "%.*s-%0*d.%s", prefix_length, output_file, file_num_digits, frameNo, ufft.extension);
+        }
         ofd = open(fileName, FILE_ACCESS, 0664);
         if (ofd == -1) {
             pslr_write_log(PSLR_ERROR, "Could not open %s\n", output_file);
             return -1;
         }
+        snprintf(output_file_name, sizeof(output_file_name), "%s", fileName);
     }
     return ofd;
 }
 
+void close_file(int fd) {
+    if (fd != 1 && fd != ARCHIVE_FD) {
+        close(fd);
+    }
+}
+
+#define MAX_BUFFERS 16
+#define PIPELINE_IDLE_TIMEOUT 30 /* sec to wait for the pictures of the last frames */
+
+/* State of the pipelined frames. The worker thread watches bufmask and
+   queues the new buffers in the order they appeared, so the pictures
+   are saved in shooting order even if the camera reuses a lower buffer. */
+typedef struct {
+    pslr_handle_t camhandle;
+    pthread_mutex_t mutex;          // guards the fields below
+    pthread_cond_t downloaded_cond;
+    int shots;                      // shutter presses so far
+    int downloaded;                 // pictures saved and deleted from the camera
+    bool done;                      // no more shutter presses
+    char *output_file;
+    int counter;
+    pslr_status *status;
+    user_file_format uff;
+    int quality;
+} pipeline_t;
+
+static void *pipeline_download_thread(void *arg) {
+    pipeline_t *pl = arg;
+    user_file_format_t ufft = *pslr_get_user_file_format_t(pl->uff);
+    int queue[MAX_BUFFERS];
+    int queue_num = 0;
+    uint16_t queued = 0;
+    double idle_since = get_monotonic_sec();
+
+    while (true) {
+        pslr_status status;
+        int i;
+
+        camera_lock();
+        int ret = pslr_get_status_fields(pl->camhandle, PSLR_STATUS_BIT(PSLR_STATUS_BUFMASK), &status);
+        camera_unlock();
+        if (ret == PSLR_OK) {
+            // the new pictures join the end of the queue
+            for (i = 0; i < MAX_BUFFERS; ++i) {
+                if ((status.bufmask & ~queued) & (1 << i)) {
+                    queue[queue_num++] = i;
+                    queued |= 1 << i;
+                }
+            }
+        }
+        if (queue_num == 0) {
+            pthread_mutex_lock(&pl->mutex);
+            bool finished = pl->done && (pl->downloaded >= pl->shots || get_monotonic_sec() - idle_since > PIPELINE_IDLE_TIMEOUT);
+            pthread_mutex_unlock(&pl->mutex);
+            if (finished) {
+                break;
+            }
+            usleep(50000); /* 50 ms */
+            continue;
+        }
+
+        int bufno = queue[0];
+        int fd = open_file(pl->output_file, pl->counter + pl->downloaded, ufft);
+        if (fd == -1) {
+            break;
+        }
+        int saved = save_buffer_wait(pl->camhandle, bufno, fd, pl->status, pl->uff, pl->quality);
+        close_file(fd);
+        memmove(queue, queue + 1, --queue_num * sizeof(int));
+        if (saved == 0) {
+            camera_lock();
+            pslr_delete_buffer(pl->camhandle, bufno);
+            camera_unlock();
+            queued &= ~(1 << bufno);
+        } else {
+            // stays queued, so the picture is neither downloaded again nor deleted
+            fprintf(stderr, "Buffer %d is kept in the camera\n", bufno);
+        }
+        idle_since = get_monotonic_sec();
+
+        pthread_mutex_lock(&pl->mutex);
+        ++pl->downloaded;
+        pthread_cond_broadcast(&pl->downloaded_cond);
+        pthread_mutex_unlock(&pl->mutex);
+    }
+    pthread_mutex_lock(&pl->mutex);
+    // wakes the main thread if the worker gave up
+    pl->done = true;
+    pl->downloaded = pl->shots;
+    pthread_cond_broadcast(&pl->downloaded_cond);
+    pthread_mutex_unlock(&pl->mutex);
+    return NULL;
+}
+
+/* Takes the frames on schedule while a worker thread downloads the
+   pictures. The camera buffers limit how far the shooting can get ahead,
+   bufmask_single cameras wait for each download. */
+void pipelined_frames( pslr_handle_t camhandle, int frames, frame_schedule_t *sched, int counter, char *output_file, pslr_status *status,
+                       user_file_format uff, int quality, trigger_latency_t *trigger_latencies ) {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t worker;
+    pipeline_t pl;
+    int max_ahead = pslr_get_model_bufmask_single(camhandle) ? 1 : MAX_BUFFERS;
+    int frameNo;
+
+    memset(&pl, 0, sizeof(pl));
+    pl.camhandle = camhandle;
+    pthread_mutex_init(&pl.mutex, NULL);
+    pthread_cond_init(&pl.downloaded_cond, NULL);
+    pl.output_file = output_file;
+    pl.counter = counter;
+    pl.status = status;
+    pl.uff = uff;
+    pl.quality = quality;
+    camera_mutex = &mutex;
+    if (pthread_create(&worker, NULL, pipeline_download_thread, &pl) != 0) {
+        pslr_write_log(PSLR_ERROR, "Cannot create download thread\n");
+        exit(-1);
+    }
+
+    for (frameNo = 0; frameNo < frames; ++frameNo) {
+        schedule_wait(sched);
+        pthread_mutex_lock(&pl.mutex);
+        while (pl.shots - pl.downloaded >= max_ahead && !pl.done) {
+            pthread_cond_wait(&pl.downloaded_cond, &pl.mutex);
+        }
+        pthread_mutex_unlock(&pl.mutex);
+        if ( frames > 1 ) {
+            printf("Taking picture %d/%d\n", frameNo+1, frames);
+            fflush(stdout);
+        }
+        camera_lock();
+        int ret;
+        if ( trigger_latencies ) {
+            ret = fire_shutter(camhandle, trigger_latencies);
+        } else {
+            ret = pslr_shutter(camhandle);
+        }
+        camera_unlock();
+        pthread_mutex_lock(&pl.mutex);
+        if ( ret == PSLR_OK ) {
+            ++pl.shots;
+        }
+        pthread_mutex_unlock(&pl.mutex);
+    }
+
+    pthread_mutex_lock(&pl.mutex);
+    pl.done = true;
+    pthread_mutex_unlock(&pl.mutex);
+    pthread_join(worker, NULL);
+    camera_mutex = NULL;
+    pthread_cond_destroy(&pl.downloaded_cond);
+    pthread_mutex_destroy(&pl.mutex);
+    pthread_mutex_destroy(&mutex);
+}
+
+#define MAX_GROUP_CAMERAS 16
+
+/* Fires all the connected cameras together and saves the pictures into
+   FILE-camN-NNNN.ext, one series per camera */
+int group_shutter( char *model, char *device, int frames, double delay, schedule_policy_t policy, char *output_file, user_file_format uff, int quality, bool print_statistics ) {
+    pslr_handle_t handles[MAX_GROUP_CAMERAS];
+    double trigger_times[MAX_GROUP_CAMERAS];
+    double skew, skew_min = 0, skew_max = 0, skew_sum = 0;
+    int skew_num = 0;
+    int num, i, frameNo;
+    frame_schedule_t sched;
+
+    num = pslr_init_all( model, device, handles, MAX_GROUP_CAMERAS );
+    if ( num == 0 ) {
+        pslr_write_log(PSLR_ERROR, "No camera found\n");
+        return -1;
+    }
+    for ( i = 0; i < num; ++i ) {
+        pslr_connect( handles[i] );
+        printf("Camera %d: %s Connected...\n", i+1, pslr_get_camera_name( handles[i] ));
+        if ( uff != USER_FILE_FORMAT_MAX ) {
+            pslr_set_user_file_format( handles[i], uff );
+        }
+        pslr_set_status_cache( handles[i], status_cache_window );
+    }
+
+    schedule_init( &sched, delay, policy, frames );
+    for ( frameNo = 0; frameNo < frames; ++frameNo ) {
+        schedule_wait( &sched );
+        int ret = pslr_group_shutter( handles, num, trigger_times, &skew );
+        printf("Frame %d/%d: skew %.3f ms", frameNo+1, frames, 1000 * skew);
+        if ( ret != PSLR_OK ) {
+            printf(" (some cameras failed)");
+        }
+        printf("\n");
+        double first = 0;
+        for ( i = 0; i < num; ++i ) {
+            if ( trigger_times[i] > 0 && (first == 0 || trigger_times[i] < first) ) {
+                first = trigger_times[i];
+            }
+        }
+        for ( i = 0; i < num; ++i ) {
+            if ( trigger_times[i] > 0 ) {
+                printf("  camera %d: +%.3f ms\n", i+1, 1000 * (trigger_times[i] - first));
+            } else {
+                printf("  camera %d: failed\n", i+1);
+            }
+        }
+        // the statistics only count the frames taken by all the cameras
+        if ( ret == PSLR_OK ) {
+            if ( skew_num == 0 || skew < skew_min ) {
+                skew_min = skew;
+            }
+            if ( skew > skew_max ) {
+                skew_max = skew;
+            }
+            skew_sum += skew;
+            ++skew_num;
+        }
+
+        for ( i = 0; i < num; ++i ) {
+            pslr_status status;
+            char camera_file[256];
+            if ( trigger_times[i] == 0 ) {
+                continue;
+            }
+            pslr_get_status( handles[i], &status );
+            user_file_format camera_uff = uff;
+            if ( camera_uff == USER_FILE_FORMAT_MAX ) {
+                camera_uff = pslr_get_model_only_limited( handles[i] ) ? USER_FILE_FORMAT_PEF : pslr_get_user_file_format( &status );
+            }
+            user_file_format_t ufft = *pslr_get_user_file_format_t(camera_uff);
+            char *dot = strrchr(output_file, '.');
+            int prefix_length = dot && !strcmp(dot+1, ufft.extension) ? dot - output_file : (int) strlen(output_file);
+            snprintf(camera_file, sizeof(camera_file), "%.*s-cam%d", prefix_length, output_file, i+1);
+            int fd = open_file( camera_file, frameNo+1, ufft );
+            if ( fd == -1 ) {
+                continue;
+            }
+            int saved = save_buffer_wait( handles[i], 0, fd, &status, camera_uff, quality == -1 ? status.jpeg_quality : quality );
+            if ( saved == 0 ) {
+                pslr_delete_buffer( handles[i], 0 );
+            } else {
+                fprintf(stderr, "Camera %d: buffer 0 is kept in the camera\n", i+1);
+            }
+            close(fd);
+        }
+    }
+    if ( skew_num > 0 ) {
+        printf("Skew over %d frames: min %.3f ms avg %.3f ms max %.3f ms\n", skew_num,
+               1000 * skew_min, 1000 * skew_sum / skew_num, 1000 * skew_max);
+    } else {
+        printf("No frame was taken by all cameras, no skew\n");
+    }
+    schedule_print_stats( &sched );
+    schedule_free( &sched );
+
+    for ( i = 0; i < num; ++i ) {
+        if ( print_statistics ) {
+            print_stats( handles[i] );
+        }
+        pslr_camera_close( handles[i] );
+    }
+    return 0;
+}
+
 void process_wbadj( const char* argv0, const char chr, uint32_t adj, uint32_t *wbadj_mg, uint32_t *wbadj_ba ) {
     if ( chr == 'M' ) {
         *wbadj_mg = 7 - adj;
@@ -365,6 +985,7 @@ int main(int argc, char **argv) {
     char c2;
     char *output_file = NULL;
     bool output_file_stdout = false;
+    char *archive_file = NULL;
     char *model = NULL;
     char *device = NULL;
     const char *camera_name;
@@ -385,7 +1006,9 @@ int main(int argc, char **argv) {
     uint32_t auto_iso_max = 0;
     int frames = 0;
     int counter = 0;
-    int delay = 0;
+    double delay = 0;
+    schedule_policy_t schedule_policy = SCHEDULE_CATCHUP;
+    frame_schedule_t sched;
     int timeout = 0;
     bool auto_focus = false;
     bool green = false;
@@ -420,9 +1043,15 @@ int main(int argc, char **argv) {
     bool read_firmware_version=false;
     bool settings_info = false;
     bool settings_hex=false;
+    bool group_shutter_mode = false;
+    bool trigger_latency = false;
+    bool pipeline = false;
+    trigger_latency_t trigger_latencies = { NULL, 0, NULL, 0 };
     char multc;
     int mult=1;
     uint32_t dump_memory_size=0;
+    bool async_download = false;
+    bool print_statistics = false;
     static const char DUMP_FILE_NAME[] = "pentax_dump.dat";
 
     // just parse warning, debug flags
@@ -653,15 +1282,15 @@ int main(int argc, char **argv) {
 
             case 'F':
                 frames = atoi(optarg);
-                if (frames > 9999) {
+                if (frames < 0) {
                     pslr_write_log(PSLR_WARNING, "%s: Invalid frame number.\n", argv[0]);
-                    frames = 9999;
+                    frames = 0;
                 }
                 break;
 
             case 'd':
-                delay = atoi(optarg);
-                if (!delay) {
+                delay = atof(optarg);
+                if (delay <= 0) {
                     pslr_write_log(PSLR_WARNING, "%s: Invalid delay value\n", argv[0]);
                 }
                 break;
@@ -753,17 +1382,87 @@ int main(int argc, char **argv) {
 
             case 30:
                 counter = atoi(optarg);
-                if (counter > 9999) {
-                    pslr_write_log(PSLR_WARNING, "%s: file_num_start is too high.\n", argv[0]);
+                if (counter < 0) {
+                    pslr_write_log(PSLR_WARNING, "%s: Invalid file_num_start.\n", argv[0]);
                     counter = 0;
-                } else if (counter + frames > 9999) {
-                    pslr_write_log(PSLR_WARNING, "%s: Taking too many frames, file_num_start is too high.\n", argv[0]);
-                    frames = 10000 - counter;
+                }
+                break;
+
+            case 31:
+                async_download = true;
+                break;
+
+            case 32:
+                print_statistics = true;
+                break;
+
+            case 33:
+                mapped_download = true;
+                break;
+
+            case 34:
+                pslr_set_trace_file(optarg);
+                break;
+
+            case 35:
+                pslr_replay_set_realtime(true);
+                break;
+
+            case 36:
+                group_shutter_mode = true;
+                break;
+
+            case 37:
+                trigger_latency = true;
+                break;
+
+            case 38:
+                pipeline = true;
+                break;
+
+            case 41:
+                archive_file = optarg;
+                break;
+
+            case 42:
+                checksum = true;
+                break;
+
+            case 43:
+                status_cache_window = atof(optarg);
+                if (status_cache_window < 0) {
+                    pslr_write_log(PSLR_WARNING, "%s: Invalid status cache window.\n", argv[0]);
+                    status_cache_window = -1;
+                }
+                break;
+
+            case 40:
+                shard_size = atoi(optarg);
+                if (shard_size <= 0) {
+                    pslr_write_log(PSLR_WARNING, "%s: Invalid shard size.\n", argv[0]);
+                    shard_size = 0;
+                }
+                break;
+
+            case 39:
+                if (!strcmp(optarg, "catchup")) {
+                    schedule_policy = SCHEDULE_CATCHUP;
+                } else if (!strcmp(optarg, "skip")) {
+                    schedule_policy = SCHEDULE_SKIP;
+                } else {
+                    pslr_write_log(PSLR_WARNING, "%s: Invalid schedule policy: %s\n", argv[0], optarg);
                 }
                 break;
         }
     }
 
+    if ( status_cache_window < 0 ) {
+        // the cache hits depend on the timing, but a replay has to issue the
+        // same commands as the recording, whatever its speed is
+        bool replay = device && !strncmp(device, "replay:", 7);
+        status_cache_window = pslr_get_trace_file() || replay ? 0 : STATUS_CACHE_DEFAULT;
+    }
+
     if ( servermode ) {
 #ifndef WIN32
         // ignore all the other argument and go to server mode
@@ -775,15 +1474,36 @@ int main(int argc, char **argv) {
 #endif
     }
 
-    if (!output_file && !output_file_stdout && frames > 0) {
+    if (!output_file && !output_file_stdout && !archive_file && frames > 0) {
         pslr_write_log(PSLR_ERROR, "Should specify output filename (use '-o -' if you really want to output to stdout)\n");
         exit(-1);
     }
 
-    if (frames == 0 && (output_file || output_file_stdout)) {
+    if (frames == 0 && (output_file || output_file_stdout || archive_file)) {
         frames = 1;
     }
 
+    // all the file names of the run have the same width, so they sort by name
+    long long last_file_num = counter > 0 ? (long long)counter + frames - 1 : frames;
+    for (; last_file_num >= 10000; last_file_num /= 10) {
+        ++file_num_digits;
+    }
+
+    if ( group_shutter_mode ) {
+        if ( !output_file || archive_file ) {
+            pslr_write_log(PSLR_ERROR, "Should specify output filename, one file is written per camera\n");
+            exit(-1);
+        }
+        exit( group_shutter( model, device, frames, delay, schedule_policy, output_file, uff, quality, print_statistics ) );
+    }
+
+    if ( archive_file ) {
+        if ( !(archive = pslr_archive_open(archive_file)) ) {
+            exit(-1);
+        }
+        archive_first_frame = pslr_archive_next_frame(archive);
+    }
+
     DPRINT("%s %s \n", argv[0], VERSION);
     DPRINT("model %s\n", model );
     DPRINT("device %s\n", device );
@@ -798,6 +1518,17 @@ int main(int argc, char **argv) {
     camera_name = pslr_get_camera_name(camhandle);
     printf("%s: %s Connected...\n", argv[0], camera_name);
 
+    if ( async_download && pslr_set_async_download(camhandle, true) != PSLR_OK ) {
+        pslr_write_log(PSLR_WARNING, "%s: Queued download is not supported for %s, using the default method.\n", argv[0], device ? device : "this device");
+    }
+
+    pslr_set_status_cache(camhandle, status_cache_window);
+
+    if ( mapped_download && pslr_set_mapped_download(camhandle, true) != PSLR_OK ) {
+        pslr_write_log(PSLR_WARNING, "%s: Memory mapped download is not supported for %s, using the default method.\n", argv[0], device ? device : "this device");
+        mapped_download = false;
+    }
+
     if ( dump_memory_size > 0 ) {
         int dfd = open(DUMP_FILE_NAME, FILE_ACCESS, 0664);
         if (dfd == -1) {
@@ -807,6 +1538,9 @@ int main(int argc, char **argv) {
             printf("Dumping system memory to %s\n", DUMP_FILE_NAME);
             save_memory(camhandle, dfd, dump_memory_size);
             close(dfd);
+            if ( print_statistics ) {
+                print_stats(camhandle);
+            }
             pslr_camera_close(camhandle);
             exit(0);
         }
@@ -1002,6 +1736,8 @@ int main(int argc, char **argv) {
         if ( settings_info || settings_hex ) {
             if (settings_hex) {
                 uint8_t settings_buf[SETTINGS_BUFFER_SIZE];
+                // the parser only reads the addresses it needs, dump everything
+                pslr_get_settings(camhandle);
                 pslr_get_settings_buffer(camhandle, settings_buf);
                 hexdump(settings_buf, SETTINGS_BUFFER_SIZE);
             }
@@ -1034,7 +1770,6 @@ int main(int argc, char **argv) {
         astrotracer_before = settings.astrotracer.value;
     }
 
-    double waitsec=0;
     user_file_format_t ufft = *pslr_get_user_file_format_t(uff);
     int bracket_count = status.auto_bracket_picture_count;
     if ( bracket_count < 1 || status.auto_bracket_mode == 0 ) {
@@ -1054,8 +1789,37 @@ int main(int argc, char **argv) {
         need_one_push_bracketing_cleanup = true;
     }
 
+    if ( trigger_latency ) {
+        trigger_latencies.armed = malloc(frames * sizeof(double));
+        trigger_latencies.unarmed = malloc(frames * sizeof(double));
+    }
+
+    if ( pipeline ) {
+        if ( noshutter || reconnect || bracket_count > 1 || status.exposure_mode == PSLR_GUI_EXPOSURE_MODE_B ) {
+            pslr_write_log(PSLR_WARNING, "%s: Pipelined download is not supported with bulb, bracketing, --noshutter and --reconnect, taking the frames one by one.\n", argv[0]);
+        } else {
+            schedule_init(&sched, delay, schedule_policy, frames);
+            pipelined_frames(camhandle, frames, &sched, counter, output_file, &status, uff, quality, trigger_latency ? &trigger_latencies : NULL);
+            schedule_print_stats(&sched);
+            schedule_free(&sched);
+            if ( print_statistics ) {
+                print_stats(camhandle);
+            }
+            if ( trigger_latency ) {
+                print_trigger_latency(&trigger_latencies);
+                free(trigger_latencies.armed);
+                free(trigger_latencies.unarmed);
+            }
+            pslr_archive_close(archive);
+            pslr_camera_close(camhandle);
+            exit(0);
+        }
+    }
+
+    schedule_init(&sched, delay, schedule_policy, frames);
+    // the first frame is due right away
+    ++sched.slot;
     for (frameNo = 0; frameNo < frames; ++frameNo) {
-        gettimeofday(&current_time, NULL);
         if ( bracket_count <= bracket_index ) {
             if ( reconnect ) {
                 pslr_camera_close( camhandle );
@@ -1063,33 +1827,39 @@ int main(int argc, char **argv) {
                     sleep_sec(1);
                 }
                 pslr_connect(camhandle);
+                // the new handle starts with the defaults
+                if ( async_download ) {
+                    pslr_set_async_download(camhandle, true);
+                }
+                if ( mapped_download ) {
+                    pslr_set_mapped_download(camhandle, true);
+                }
+                pslr_set_status_cache(camhandle, status_cache_window);
             }
-            waitsec = 1.0 * delay - timeval_diff_sec(&current_time, &prev_time);
-            if ( waitsec > 0 ) {
-                printf("Waiting for %.2f sec\n", waitsec);
-                sleep_sec( waitsec );
+            if ( trigger_latency && !noshutter ) {
+                // the status checks are done while waiting for the frame
+                pslr_shutter_arm(camhandle, true);
             }
+            schedule_wait(&sched);
             bracket_index = 0;
             gettimeofday(&prev_time, NULL);
         }
         if ( noshutter ) {
-            while (1) {
-                if ( PSLR_OK != pslr_get_status (camhandle, &status) ) {
-                    break;
-                }
-
-                if ( status.bufmask != 0 ) {
-                    break; //new image ?
-                }
-
-                gettimeofday (&current_time, NULL);
-                if ( timeout != 0 && ( timeval_diff_sec(&current_time, &prev_time) >= timeout) ) {
-                    printf("Timeout %d sec passed!\n", timeout);
-                    break;
-                }
-
-                usleep(100000); /* 100 ms */
+            // a new watcher reports the buffers already taken as new
+            pslr_watch_t *watch = pslr_watch_new(camhandle);
+            pslr_event_t event;
+            if ( watch ) {
+                // no slower than the fixed 100 ms polling of the past, even while idle
+                pslr_watch_set_interval(watch, PSLR_WATCH_MIN_INTERVAL, 0.1);
+            }
+            gettimeofday (&current_time, NULL);
+            double left = timeout - timeval_diff_sec(&current_time, &prev_time);
+            if ( timeout != 0 && left <= 0 ) {
+                printf("Timeout %d sec passed!\n", timeout);
+            } else if ( watch && pslr_watch_wait(watch, PSLR_EVENT_BIT(PSLR_EVENT_BUFFER_NEW), timeout != 0 ? left : 0, &event) == PSLR_READ_ERROR ) {
+                printf("Timeout %d sec passed!\n", timeout);
             }
+            pslr_watch_free(watch);
         } else {
             if ( frames > 1 ) {
                 printf("Taking picture %d/%d\n", frameNo+1, frames);
@@ -1105,7 +1875,11 @@ int main(int argc, char **argv) {
             } else {
                 DPRINT("not bulb\n");
                 if (!settings.one_push_bracketing.value || bracket_index == 0) {
-                    pslr_shutter(camhandle);
+                    if ( trigger_latency ) {
+                        fire_shutter(camhandle, &trigger_latencies);
+                    } else {
+                        pslr_shutter(camhandle);
+                    }
                 } else {
                     // TODO: fix waiting time
                     sleep_sec(1);
@@ -1118,13 +1892,16 @@ int main(int argc, char **argv) {
             int buffer_index;
             for ( buffer_index = 0; buffer_index < bracket_download; ++buffer_index ) {
                 fd = open_file(output_file, counter+frameNo-bracket_download+buffer_index+1, ufft);
-                while ( save_buffer(camhandle, buffer_index, fd, &status, uff, quality) ) {
+                int saved;
+                while ( (saved = save_buffer(camhandle, buffer_index, fd, &status, uff, quality)) > 0 ) {
                     usleep(10000);
                 }
-                pslr_delete_buffer(camhandle, buffer_index);
-                if (fd != 1) {
-                    close(fd);
+                if ( saved == 0 ) {
+                    pslr_delete_buffer(camhandle, buffer_index);
+                } else {
+                    fprintf(stderr, "Buffer %d is kept in the camera\n", buffer_index);
                 }
+                close_file(fd);
             }
         }
         ++bracket_index;
@@ -1135,6 +1912,17 @@ int main(int argc, char **argv) {
     if (need_one_push_bracketing_cleanup) {
         pslr_set_setting_by_name(camhandle, "one_push_bracketing", 1);
     }
+    if ( print_statistics ) {
+        print_stats(camhandle);
+    }
+    if ( trigger_latency ) {
+        print_trigger_latency(&trigger_latencies);
+        free(trigger_latencies.armed);
+        free(trigger_latencies.unarmed);
+    }
+    schedule_print_stats(&sched);
+    schedule_free(&sched);
+    pslr_archive_close(archive);
     pslr_camera_close(camhandle);
 
     exit(0);
@@ -47,6 +47,7 @@
 #include "pslr.h"
 #include "pslr_lens.h"
 #include "pslr_utils.h"
+#include "pslr_watch.h"
 #include "pktriggercord-servermode.h"
 
 void pslr_camera_close(pslr_handle_t camhandle) {
@@ -81,6 +82,7 @@ pslr_handle_t pslr_camera_connect( char *model, char *device, int timeout, char
             } else {
                 snprintf(error_message, 1000, "%d Unknown Pentax camera found.\n",1);
             }
+            pslr_shutdown(camhandle);
             return NULL;
         }
     }
@@ -88,6 +90,9 @@ pslr_handle_t pslr_camera_connect( char *model, char *device, int timeout, char
 }
 
 #ifndef WIN32
+#define BUFFER_RESUME_RETRY 3
+#define WAIT_EVENT_TIMEOUT 30 /* default and longest wait_event in sec, the server serves nothing else meanwhile */
+
 int client_sock;
 
 void write_socket_answer( char *answer ) {
@@ -105,6 +110,24 @@ void write_socket_answer_bin( uint8_t *answer, uint32_t length ) {
 
 }
 
+typedef struct {
+    pslr_handle_t camhandle;
+    bool started;
+} preview_sink_t;
+
+/* Streams the preview to the client, the answer line is sent before the first block */
+static int preview_sink(const uint8_t *data, uint32_t len, uintptr_t user_data) {
+    preview_sink_t *ps = (preview_sink_t *) user_data;
+    if (!ps->started) {
+        char buf[32];
+        sprintf(buf, "%d %d\n", 0, pslr_buffer_get_size(ps->camhandle));
+        write_socket_answer(buf);
+        ps->started = true;
+    }
+    write_socket_answer_bin((uint8_t *) data, len);
+    return PSLR_OK;
+}
+
 char *is_string_prefix(char *str, char *prefix) {
     if ( !strncmp(str, prefix, strlen(prefix) ) ) {
         if ( strlen(str) <= strlen(prefix)+1 ) {
@@ -145,8 +168,10 @@ int servermode_socket(int servermode_timeout) {
     char *arg;
     char buf[2100];
     pslr_handle_t camhandle=NULL;
+    pslr_watch_t *watch=NULL;   // event stream of wait_event, created on the first use
     pslr_status status;
     pslr_buffer_type buffer_type=PSLR_BUF_DNG;
+    uint32_t buffer_crc = 0;    // CRC32C of the data sent by the last get_buffer
     char C;
     pslr_rational_t shutter_speed = {0, 0};
     pslr_rational_t aperture = {0, 0};
@@ -216,15 +241,29 @@ int servermode_socket(int servermode_timeout) {
             client_message[read_size]='\0';
             strip( client_message );
             DPRINT(":%s:\n",client_message);
+            // the watcher thread only polls the camera between the commands
+            if ( watch ) {
+                pslr_watch_lock(watch);
+            }
             if ( !strcmp(client_message, "stopserver" ) ) {
+                if ( watch ) {
+                    pslr_watch_unlock(watch);
+                    pslr_watch_free(watch);
+                }
                 if ( camhandle ) {
                     pslr_camera_close(camhandle);
                 }
                 write_socket_answer("0\n");
                 exit(0);
             } else if ( !strcmp(client_message, "disconnect" ) ) {
+                if ( watch ) {
+                    pslr_watch_unlock(watch);
+                    pslr_watch_free(watch);
+                    watch = NULL;
+                }
                 if ( camhandle ) {
                     pslr_camera_close(camhandle);
+                    camhandle = NULL;
                 }
                 write_socket_answer("0\n");
             } else if ( (arg = is_string_prefix( client_message, "echo")) != NULL ) {
@@ -251,6 +290,49 @@ int servermode_socket(int servermode_timeout) {
                     }
                     write_socket_answer(buf);
                 }
+            } else if ( !strcmp(client_message, "update_status_delta") ) {
+                if ( check_camera(camhandle) ) {
+                    uint64_t changed;
+                    if ( !pslr_get_status_delta(camhandle, &status, &changed) ) {
+                        sprintf( buf, "%d %llx\n", 0, (unsigned long long) changed);
+                    } else {
+                        sprintf( buf, "%d\n", 1);
+                    }
+                    write_socket_answer(buf);
+                }
+            } else if ( (arg = is_string_prefix( client_message, "wait_event")) != NULL ) {
+                if ( check_camera(camhandle) ) {
+                    pslr_event_t event;
+                    double timeout = arg != client_message ? atof(arg) : WAIT_EVENT_TIMEOUT;
+                    if ( timeout <= 0 || timeout > WAIT_EVENT_TIMEOUT ) {
+                        timeout = WAIT_EVENT_TIMEOUT;
+                    }
+                    if ( !watch && (watch = pslr_watch_new(camhandle)) ) {
+                        pslr_watch_set_fields(watch, PSLR_STATUS_ALL);
+                        pslr_watch_lock(watch);
+                        pslr_watch_start(watch);
+                    }
+                    // the first wait reports the current state, the later ones the events queued since
+                    int ret = PSLR_DEVICE_ERROR;
+                    if ( watch ) {
+                        pslr_watch_unlock(watch);
+                        ret = pslr_watch_wait(watch, PSLR_EVENT_ALL, timeout, &event);
+                        pslr_watch_lock(watch);
+                    }
+                    if ( !ret ) {
+                        pslr_watch_get_status(watch, &status);
+                        sprintf( buf, "%d %d %d %llx\n", 0, event.type, event.buffer, (unsigned long long) event.changed);
+                    } else {
+                        sprintf( buf, "%d\n", 1);
+                    }
+                    if ( watch && (ret == PSLR_DEVICE_ERROR || (!ret && event.type == PSLR_EVENT_DISCONNECT)) ) {
+                        // the watcher has stopped, the next wait starts a new one
+                        pslr_watch_unlock(watch);
+                        pslr_watch_free(watch);
+                        watch = NULL;
+                    }
+                    write_socket_answer(buf);
+                }
             } else if ( !strcmp(client_message, "get_camera_name") ) {
                 if ( check_camera(camhandle) ) {
                     sprintf(buf, "%d %s\n", 0, pslr_get_camera_name(camhandle));
@@ -300,6 +382,9 @@ int servermode_socket(int servermode_timeout) {
             } else if ( !strcmp(client_message, "shutter") ) {
                 if ( check_camera(camhandle) ) {
                     pslr_shutter(camhandle);
+                    if ( watch ) {
+                        pslr_watch_wake(watch);
+                    }
                     sprintf(buf, "%d\n", 0);
                     write_socket_answer(buf);
                 }
@@ -313,17 +398,15 @@ int servermode_socket(int servermode_timeout) {
             } else if (  (arg = is_string_prefix( client_message, "get_preview_buffer")) != NULL ) {
                 int bufno = atoi(arg);
                 if ( check_camera(camhandle) ) {
-                    uint8_t *pImage;
-                    uint32_t imageSize;
-                    if ( pslr_get_buffer(camhandle, bufno, PSLR_BUF_PREVIEW, 4, &pImage, &imageSize) ) {
-                        sprintf(buf, "%d %d\n", 1, imageSize);
-                        write_socket_answer(buf);
-                    } else {
-                        sprintf(buf, "%d %d\n", 0, imageSize);
+                    preview_sink_t ps = { camhandle, false };
+                    if ( pslr_buffer_download(camhandle, bufno, PSLR_BUF_PREVIEW, 4, preview_sink, (uintptr_t) &ps) && !ps.started ) {
+                        sprintf(buf, "%d %d\n", 1, 0);
                         write_socket_answer(buf);
-                        write_socket_answer_bin(pImage, imageSize);
                     }
                 }
+            } else if ( !strcmp(client_message, "get_buffer_crc") ) {
+                sprintf(buf, "0 %08x\n", buffer_crc);
+                write_socket_answer(buf);
             } else if (  (arg = is_string_prefix( client_message, "get_buffer_type")) != NULL ) {
                 if ( buffer_type == PSLR_BUF_PEF ) {
                     sprintf(buf,"0 PEF\n");
@@ -334,26 +417,42 @@ int servermode_socket(int servermode_timeout) {
                 }
                 write_socket_answer(buf);
             } else if (  (arg = is_string_prefix( client_message, "get_buffer")) != NULL ) {
+                // get_buffer BUFNO [OFFSET], the data is sent from OFFSET to resume a download
                 int bufno = atoi(arg);
+                char *offset_arg = strchr(arg, ' ');
+                uint32_t offset = offset_arg ? strtoul(offset_arg+1, NULL, 10) : 0;
                 if ( check_camera(camhandle) ) {
                     uint32_t imageSize;
-                    if ( pslr_buffer_open(camhandle, bufno, buffer_type, 0) ) {
+                    if ( pslr_buffer_open(camhandle, bufno, buffer_type, 0) || pslr_buffer_seek(camhandle, offset) ) {
+                        pslr_buffer_close(camhandle);
                         sprintf(buf, "%d\n", 1);
                         write_socket_answer(buf);
                     } else {
                         imageSize = pslr_buffer_get_size(camhandle);
-                        sprintf(buf, "%d %d\n", 0, imageSize);
+                        // the answer tells the bytes that follow, the rest of the image from OFFSET
+                        sprintf(buf, "%d %d\n", 0, offset < imageSize ? imageSize - offset : 0);
                         write_socket_answer(buf);
-                        uint32_t current = 0;
-                        while (1) {
+                        int resume = 0;
+                        buffer_crc = 0;
+                        while (pslr_buffer_tell(camhandle) < imageSize) {
                             uint32_t bytes;
                             uint8_t buf[65536];
                             bytes = pslr_buffer_read(camhandle, buf, sizeof (buf));
                             if (bytes == 0) {
-                                break;
+                                // open the buffer again and continue with the failed block
+                                uint32_t current = pslr_buffer_tell(camhandle);
+                                if (resume++ == BUFFER_RESUME_RETRY) {
+                                    break;
+                                }
+                                pslr_buffer_close(camhandle);
+                                if ( pslr_buffer_open(camhandle, bufno, buffer_type, 0) || pslr_buffer_seek(camhandle, current) ) {
+                                    break;
+                                }
+                                continue;
                             }
+                            resume = 0;
+                            buffer_crc = crc32c_update(buffer_crc, buf, bytes);
                             write_socket_answer_bin( buf, bytes);
-                            current += bytes;
                         }
                         pslr_buffer_close(camhandle);
                     }
@@ -412,6 +511,9 @@ int servermode_socket(int servermode_timeout) {
             } else {
                 write_socket_answer("1 Invalid servermode command\n");
             }
+            if ( watch ) {
+                pslr_watch_unlock(watch);
+            }
         }
 
         if (read_size == 0) {
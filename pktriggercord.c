@@ -41,6 +41,7 @@
 #include "pslr_log.h"
 #include "pktriggercord-servermode.h"
 #include "pslr_utils.h"
+#include "pslr_watch.h"
 
 #ifdef WIN32
 #define FILE_ACCESS O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
@@ -53,6 +54,7 @@
 
 // status.bufmask
 #define MAX_BUFFERS 8*sizeof(uint16_t)
+#define STATUS_POLL_CONNECT_INTERVAL 1000 /* ms, looking for a camera */
 
 static struct {
     char *autosave_path;
@@ -68,6 +70,7 @@ void set_preview_icon(int n, GdkPixbuf *pBuf);
 void error_message(const gchar *message);
 
 static gboolean status_poll(gpointer data);
+static gint watch_poll_func(GPollFD *ufds, guint nfds, gint timeout);
 static void update_image_areas(int buffer, bool main);
 
 static void init_controls(pslr_status *st_new, pslr_status *st_old);
@@ -183,6 +186,7 @@ static const int ec_tbl_1_2[]= {
     };
 
 static pslr_handle_t camhandle;
+static pslr_watch_t *watch;
 static bool handle_af_points;
 static double af_width_multiplier;
 static double af_height_multiplier;
@@ -296,7 +300,9 @@ int common_init(void) {
 
     init_controls(NULL, NULL);
 
-    g_timeout_add(1000, status_poll, 0);
+    g_timeout_add(STATUS_POLL_CONNECT_INTERVAL, status_poll, 0);
+    default_poll_func = g_main_context_get_poll_func(NULL);
+    g_main_context_set_poll_func(NULL, watch_poll_func);
 
     gtk_widget_show(widget);
 
@@ -684,10 +690,12 @@ static void connect_camera(void) {
     if ( ret == -1 ) {
         gtk_statusbar_pop(statusbar, sbar_connect_ctx);
         gtk_statusbar_push(statusbar, sbar_connect_ctx, "Unknown Pentax camera found.");
+        pslr_shutdown(camhandle);
         camhandle = NULL;
     } else if ( ret != 0 ) {
         gtk_statusbar_pop(statusbar, sbar_connect_ctx);
         gtk_statusbar_push(statusbar, sbar_connect_ctx, "Cannot connect to Pentax camera.");
+        pslr_shutdown(camhandle);
         camhandle = NULL;
     }
 }
@@ -823,13 +831,44 @@ static void update_af_points(void) {
     }
 }
 
-static gboolean status_poll(gpointer data) {
-    int ret;
+/* Status fields changed by the events since the last status_poll_run, set
+ * by the watcher thread while it holds the watch lock */
+static uint64_t status_changed;
+static bool status_disconnected;
+
+static void status_event(const pslr_event_t *event, uintptr_t user_data) {
+    if (event->type == PSLR_EVENT_DISCONNECT) {
+        status_disconnected = true;
+    }
+    status_changed |= event->type == PSLR_EVENT_DISCONNECT ? PSLR_STATUS_ALL : event->changed;
+}
+
+/* The main thread holds the watch lock all the time, except while the main
+ * loop sleeps: the watcher thread reads the status only then, never between
+ * the camera commands of a GTK callback. */
+static GPollFunc default_poll_func;
+
+static gint watch_poll_func(GPollFD *ufds, guint nfds, gint timeout) {
+    pslr_watch_t *w = timeout != 0 ? watch : NULL;
+    gint ret;
+    if (w) {
+        pslr_watch_unlock(w);
+    }
+    ret = default_poll_func(ufds, nfds, timeout);
+    if (w) {
+        pslr_watch_lock(w);
+    }
+    return ret;
+}
+
+/* Returns the delay of the next poll in ms, 0 if it is already scheduled */
+static guint status_poll_run(void) {
+    int ret = PSLR_OK;
     static bool status_poll_inhibit = false;
 
     DPRINT("start status_poll\n");
     if (status_poll_inhibit) {
-        return TRUE;
+        return 0;
     }
 
     /* Do not recursively status poll */
@@ -839,7 +878,7 @@ static gboolean status_poll(gpointer data) {
         if ( dangerous_camera_connected ) {
             DPRINT("dangerous camera connected\n");
             status_poll_inhibit = false;
-            return TRUE;
+            return STATUS_POLL_CONNECT_INTERVAL;
         }
         camhandle = pslr_init( NULL, NULL );
         if (camhandle) {
@@ -849,19 +888,43 @@ static gboolean status_poll(gpointer data) {
         update_widgets_after_connect();
         status_poll_inhibit = false;
         DPRINT("end status_poll\n");
-        return TRUE;
+        return STATUS_POLL_CONNECT_INTERVAL;
     }
 
-    update_status_pointers();
+    if (!watch && (watch = pslr_watch_new(camhandle))) {
+        /* The watcher thread polls at the pace of the camera activity */
+        pslr_watch_set_fields(watch, PSLR_STATUS_ALL);
+        pslr_watch_add_callback(watch, PSLR_EVENT_ALL, status_event, 0);
+        status_changed = 0;
+        status_disconnected = false;
+        pslr_watch_lock(watch);
+        pslr_watch_start(watch);
+    }
 
-    ret = pslr_get_status(camhandle, status_new);
+    if (!watch || status_disconnected) {
+        ret = PSLR_DEVICE_ERROR;
+    } else if (status_changed == 0) {
+        /* Not polled yet, or the widgets show this status already */
+        DPRINT("end status_poll, no change\n");
+        status_poll_inhibit = false;
+        return PSLR_WATCH_MIN_INTERVAL * 1000;
+    }
+    status_changed = 0;
+    update_status_pointers();
+    if (ret == PSLR_OK) {
+        pslr_watch_get_status(watch, status_new);
+    }
     shutter_speed_table_init( status_new );
     iso_speed_table_init( status_new );
     if (ret != PSLR_OK) {
-        if (ret == PSLR_DEVICE_ERROR) {
-            /* Camera disconnected */
-            camhandle = NULL;
+        /* Camera disconnected */
+        if (watch) {
+            pslr_watch_unlock(watch);
+            pslr_watch_free(watch);
+            watch = NULL;
         }
+        pslr_shutdown(camhandle);
+        camhandle = NULL;
         DPRINT("pslr_get_status: %d\n", ret);
         status_new = NULL;
     }
@@ -884,7 +947,15 @@ static gboolean status_poll(gpointer data) {
     DPRINT("end status_poll\n");
 
     status_poll_inhibit = false;
-    return TRUE;
+    return camhandle ? PSLR_WATCH_MIN_INTERVAL * 1000 : STATUS_POLL_CONNECT_INTERVAL;
+}
+
+static gboolean status_poll(gpointer data) {
+    guint delay = status_poll_run();
+    if (delay > 0) {
+        g_timeout_add(delay, status_poll, 0);
+    }
+    return FALSE;
 }
 
 static void clear_preview_icons() {
@@ -1119,6 +1190,36 @@ static GdkPixbuf *pMainPixbuf = NULL;
 uint8_t *pLastPreviewImage;
 uint32_t lastPreviewImageSize;
 
+typedef struct {
+    GdkPixbufLoader *loader;
+    bool keep;                  // the image is also kept for save_buffer_single
+    uint32_t size;
+    GError *error;
+} preview_sink_t;
+
+// feeds the downloaded blocks directly to the pixbuf loader
+static int preview_sink(const uint8_t *data, uint32_t len, uintptr_t user_data) {
+    preview_sink_t *ps = (preview_sink_t *) user_data;
+    if (ps->keep) {
+        if (!pLastPreviewImage) {
+            ps->size = pslr_buffer_get_size(camhandle);
+            pLastPreviewImage = pslr_buffer_pool_get(camhandle, ps->size);
+            if (!pLastPreviewImage) {
+                return PSLR_NO_MEMORY;
+            }
+        }
+        if (len > ps->size - lastPreviewImageSize) {
+            return PSLR_READ_ERROR;
+        }
+        memcpy(pLastPreviewImage + lastPreviewImageSize, data, len);
+        lastPreviewImageSize += len;
+    }
+    if (!gdk_pixbuf_loader_write(ps->loader, data, len, &ps->error)) {
+        return PSLR_READ_ERROR;
+    }
+    return PSLR_OK;
+}
+
 //static GdkPixbuf *pThumbPixbuf[MAX_BUFFERS];
 
 // updates the thumbnails and optionally the main preview
@@ -1148,23 +1249,39 @@ static void update_image_areas(int buffer, bool main) {
 
     pError = NULL;
     DPRINT("Trying to read buffer %d %d\n", buffer, main);
+    preview_sink_t ps;
+    ps.loader = gdk_pixbuf_loader_new();
+    ps.keep = pslr_get_model_bufmask_single(camhandle);
+    ps.error = NULL;
+    ps.size = 0;
+    // the previous image goes back to the pool of the handle
+    pslr_buffer_pool_release(camhandle, pLastPreviewImage);
+    pLastPreviewImage = NULL;
+    lastPreviewImageSize = 0;
     if (fullsize_preview || pslr_get_model_bufmask_single(camhandle)) {
-        r = pslr_get_buffer(camhandle, buffer, PSLR_BUF_JPEG_MAX, 0, &pLastPreviewImage, &lastPreviewImageSize);
+        r = pslr_buffer_download(camhandle, buffer, PSLR_BUF_JPEG_MAX, 0, preview_sink, (uintptr_t) &ps);
     } else {
-        r = pslr_get_buffer(camhandle, buffer, PSLR_BUF_PREVIEW, 4, &pLastPreviewImage, &lastPreviewImageSize);
+        r = pslr_buffer_download(camhandle, buffer, PSLR_BUF_PREVIEW, 4, preview_sink, (uintptr_t) &ps);
     }
-    if (r != PSLR_OK) {
+    if (!gdk_pixbuf_loader_close(ps.loader, r == PSLR_OK ? &pError : NULL) || r != PSLR_OK) {
         printf("Could not get buffer data\n");
+        g_object_unref(ps.loader);
         goto the_end;
     }
 
-    GInputStream *ginput = g_memory_input_stream_new_from_data (pLastPreviewImage, lastPreviewImageSize, NULL);
-    pixBuf = gdk_pixbuf_new_from_stream( ginput, NULL, &pError);
+    pixBuf = gdk_pixbuf_loader_get_pixbuf(ps.loader);
     if (!pixBuf) {
         printf("No pixbuf from loader.\n");
+        g_object_unref(ps.loader);
         goto the_end;
     }
     g_object_ref(pixBuf);
+    g_object_unref(ps.loader);
+    if (debug) {
+        pslr_buffer_pool_stats_t pool_stats;
+        pslr_get_buffer_pool_stats(camhandle, &pool_stats);
+        DPRINT("Buffer pool: %u in use, %u idle, %llu bytes\n", pool_stats.in_use, pool_stats.idle, (unsigned long long) pool_stats.bytes);
+    }
     pError = NULL;
     if (main) {
         DPRINT("Setting pMainPixbuf\n");
@@ -1540,6 +1657,10 @@ G_MODULE_EXPORT void shutter_press(GtkAction *action) {
             return;
         }
     }
+    if (watch) {
+        /* The picture is expected soon */
+        pslr_watch_wake(watch);
+    }
 
     if (pslr_get_model_only_limited(camhandle)) {
         manage_camera_buffers_limited();
@@ -1653,6 +1774,11 @@ static gboolean added_quit(gpointer data) {
             pslr_set_setting_by_name(camhandle, "one_push_bracketing", 1);
         }
 
+        if (watch) {
+            pslr_watch_unlock(watch);
+            pslr_watch_free(watch);
+            watch = NULL;
+        }
         pslr_disconnect(camhandle);
         pslr_shutdown(camhandle);
         camhandle = 0;
@@ -51,20 +51,26 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "pslr.h"
 #include "pslr_log.h"
 #include "pslr_scsi.h"
+#include "pslr_scsi_sim.h"
+#include "pslr_scsi_replay.h"
+#include "pslr_trace.h"
 #include "pslr_lens.h"
 #include "pslr_utils.h"
 
-#define POLL_INTERVAL 50000 /* Number of us to wait when polling */
+#define POLL_INTERVAL 50000 /* Longest wait in us when polling */
 #define BLKSZ 65536 /* Block size for downloads; if too big, we get
                      * memory allocation error from sg driver */
 #define BLOCK_RETRY 3 /* Number of retries, since we can occasionally
                        * get SCSI errors when downloading data */
-
-ipslr_handle_t pslr;
+#define SEGMENT_TIMEOUT 2.0 /* Longest wait in sec for a valid segment info */
+#define SEGMENT_MAX_WAIT 0.1 /* Longest wait in sec between segment info reads */
+#define SEGMENT_DEFAULT_DELAY 0.1 /* Shortest wait in sec after advancing the segment info,
+                                   * reading it sooner is not reliable (PEF) */
 
 static int ipslr_set_mode(ipslr_handle_t *p, uint32_t mode);
 static int ipslr_cmd_00_09(ipslr_handle_t *p, uint32_t mode);
@@ -72,7 +78,11 @@ static int ipslr_cmd_10_0a(ipslr_handle_t *p, uint32_t mode);
 static int ipslr_cmd_00_05(ipslr_handle_t *p);
 static int ipslr_status(ipslr_handle_t *p, uint8_t *buf);
 static int ipslr_status_full(ipslr_handle_t *p, pslr_status *status);
+static int ipslr_status_read(ipslr_handle_t *p, uint8_t *buf, int *n);
 static int ipslr_press_shutter(ipslr_handle_t *p, bool fullpress);
+static int ipslr_shutter_arm(ipslr_handle_t *p, bool fullpress);
+static int ipslr_shutter_fire(ipslr_handle_t *p);
+static void ipslr_pool_free(ipslr_handle_t *p);
 static int ipslr_select_buffer(ipslr_handle_t *p, int bufno, pslr_buffer_type buftype, int bufres);
 static int ipslr_buffer_segment_info(ipslr_handle_t *p, pslr_buffer_segment_info *pInfo);
 static int ipslr_next_segment(ipslr_handle_t *p);
@@ -82,15 +92,17 @@ static int _ipslr_write_args(uint8_t cmd_2, ipslr_handle_t *p, int n, ...);
 #define ipslr_write_args(p,n,...) _ipslr_write_args(0,(p),(n),__VA_ARGS__)
 #define ipslr_write_args_special(p,n,...) _ipslr_write_args(4,(p),(n),__VA_ARGS__)
 
-static int command(FDTYPE fd, int a, int b, int c);
-static int get_status(FDTYPE fd);
-static int get_result(FDTYPE fd);
-static int read_result(FDTYPE fd, uint8_t *buf, uint32_t n);
+static void ipslr_trace(ipslr_handle_t *p, double start, bool to_device, uint8_t *cmd, uint32_t cmdLen,
+                        uint8_t *buf, uint32_t bufLen, int result, uint8_t *sense, uint32_t senseLen);
+static int ipslr_scsi_read(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen);
+static int ipslr_scsi_write(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen);
+static int command(ipslr_handle_t *p, int a, int b, int c);
+static int get_status(ipslr_handle_t *p);
+static int get_result(ipslr_handle_t *p);
+static int read_result(ipslr_handle_t *p, uint8_t *buf, uint32_t n);
 
 void hexdump(uint8_t *buf, uint32_t bufLen);
 
-static pslr_progress_callback_t progress_callback = NULL;
-
 user_file_format_t pslr_user_file_formats[3] = {
     { USER_FILE_FORMAT_PEF, "PEF", "pef"},
     { USER_FILE_FORMAT_DNG, "DNG", "dng"},
@@ -101,6 +113,12 @@ user_file_format_t pslr_user_file_formats[3] = {
 const char* valid_vendors[3] = {"PENTAX", "SAMSUNG", "RICOHIMG"};
 const char* valid_models[3] = {"DIGITAL_CAMERA", "DSC", "Digital Camera"};
 
+/* Backends selected by a device name prefix, the platform backend is used otherwise */
+static pslr_transport_t *device_transports[] = {
+    &pslr_sim_transport,
+    &pslr_replay_transport
+};
+
 // x18 subcommands to change camera properties
 // X18_n: unknown effect
 typedef enum {
@@ -186,13 +204,13 @@ int pslr_get_buffer_status(ipslr_handle_t *p, uint32_t *x, uint32_t *y) {
     uint8_t buf[8];
     int n;
 
-    CHECK(command(p->fd, 0x02, 0x00, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0x02, 0x00, 0));
+    n = get_result(p);
     DPRINT("[C]\t\tipslr_get_buffer_status() bytes: %d\n",n);
     if (n!= 8) {
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, buf, n));
+    CHECK(read_result(p, buf, n));
     int i;
     for (i=0; i<n; ++i) {
         DPRINT("[C]\t\tbuf[%d]=%02x\n",i,buf[i]);
@@ -213,8 +231,8 @@ int pslr_get_buffer_status(ipslr_handle_t *p, uint32_t *x, uint32_t *y) {
 static int ipslr_cmd_23_XX(ipslr_handle_t *p, char XX, char YY, uint32_t mode) {
     DPRINT("[C]\t\tipslr_cmd_23_XX(%x, %x, mode=%x)\n", XX, YY, mode);
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0x23, XX, YY));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x23, XX, YY));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -228,8 +246,8 @@ static int ipslr_cmd_23_06(ipslr_handle_t *p, char debug_on_off) {
     } else {
         CHECK(ipslr_write_args_special(p, 4,1,1,0,0));
     }
-    CHECK(command(p->fd, 0x23, 0x06, 0x14));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x23, 0x06, 0x14));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -239,8 +257,8 @@ static int ipslr_cmd_23_04(ipslr_handle_t *p) {
     DPRINT("[C]\t\tipslr_cmd_23_04()\n");
     CHECK(ipslr_write_args(p, 1, 3)); // posebni ARGS-i
     CHECK(ipslr_write_args_special(p, 1, 1)); // posebni ARGS-i
-    CHECK(command(p->fd, 0x23, 0x04, 0x08));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x23, 0x04, 0x08));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -253,10 +271,10 @@ int pslr_set_debugmode(ipslr_handle_t *p, char debug_mode) {
     ipslr_cmd_00_09(p,1);
 
     ipslr_cmd_23_XX(p,0x07,0x04,3);
-    read_result(p->fd,buf,0x10);
+    read_result(p,buf,0x10);
 
     ipslr_cmd_23_XX(p,0x05,0x04,3);
-    read_result(p->fd,buf,0x04);
+    read_result(p,buf,0x04);
     ipslr_status(p,buf);
 
     if (debug_mode==0) {
@@ -353,62 +371,137 @@ pslr_gui_exposure_mode_t exposure_mode_conversion( pslr_exposure_mode_t exp ) {
     return 0;
 }
 
-pslr_handle_t pslr_init( char *model, char *device ) {
+/* Picks the backend by the prefix of the device name and strips the
+ * prefix. An empty name after the prefix means enumerating the drives
+ * of the backend. */
+static pslr_transport_t *ipslr_find_transport( char **device ) {
+    unsigned int i;
+    if ( *device == NULL ) {
+        return &pslr_scsi_transport;
+    }
+    for ( i=0; i<sizeof(device_transports)/sizeof(device_transports[0]); ++i ) {
+        const char *prefix = device_transports[i]->prefix;
+        if ( strncmp( *device, prefix, strlen(prefix) ) == 0 ) {
+            *device += strlen(prefix);
+            if ( **device == '\0' ) {
+                *device = NULL;
+            }
+            return device_transports[i];
+        }
+    }
+    return &pslr_scsi_transport;
+}
+
+static bool ipslr_async_supported( ipslr_handle_t *p ) {
+    return p->transport->async_supported != NULL && p->transport->async_supported( p->fd );
+}
+
+static uint8_t *ipslr_map_buffer( ipslr_handle_t *p ) {
+    if ( p->transport->map_buffer == NULL || p->transport->read_mapped == NULL ) {
+        return NULL;
+    }
+    return p->transport->map_buffer( p->fd, BLKSZ );
+}
+
+/* Opens the drive if it is a Pentax camera, optionally of the given
+ * model. Returns a new handle or NULL. */
+static ipslr_handle_t *ipslr_open_drive( pslr_transport_t *transport, char *drive, char *model, int index ) {
     FDTYPE fd;
     char vendorId[20];
     char productId[20];
+    char trace_name[1024];
+    const char *camera_name;
+    ipslr_handle_t *p;
+
+    pslr_result result = transport->get_drive_info( drive, &fd, vendorId, sizeof(vendorId), productId, sizeof(productId));
+
+    DPRINT("\tChecking drive:  %s %s %s\n", drive, vendorId, productId);
+    if ( find_in_array( valid_vendors, sizeof(valid_vendors)/sizeof(valid_vendors[0]),vendorId) == -1
+            || find_in_array( valid_models, sizeof(valid_models)/sizeof(valid_models[0]), productId) == -1 ) {
+        transport->close_drive( &fd );
+        return NULL;
+    }
+    if ( result != PSLR_OK ) {
+        DPRINT("\tCannot get drive info of Pentax camera. Please do not forget to install the program using 'make install'\n");
+        // found the camera but communication is not possible
+        transport->close_drive( &fd );
+        return NULL;
+    }
+    DPRINT("\tFound camera %s %s\n", vendorId, productId);
+    p = calloc( 1, sizeof(ipslr_handle_t) );
+    if ( p == NULL ) {
+        pslr_write_log(PSLR_ERROR, "Cannot allocate the camera handle\n");
+        transport->close_drive( &fd );
+        return NULL;
+    }
+    p->transport = transport;
+    p->fd = fd;
+    p->status_changed = PSLR_STATUS_ALL;
+    if ( pslr_get_trace_file() ) {
+        if ( index == 0 ) {
+            snprintf( trace_name, sizeof(trace_name), "%s", pslr_get_trace_file() );
+        } else {
+            // every camera has its own trace
+            snprintf( trace_name, sizeof(trace_name), "%s.%d", pslr_get_trace_file(), index );
+        }
+        p->trace = pslr_trace_open( trace_name );
+    }
+    if ( model != NULL ) {
+        // user specified the camera model
+        camera_name = pslr_get_camera_name( p );
+        DPRINT("\tName of the camera: %s\n", camera_name);
+        if ( camera_name == NULL || str_comparison_i( camera_name, model, strlen( camera_name) ) != 0 ) {
+            DPRINT("\tIgnoring camera %s %s\n", vendorId, productId);
+            pslr_shutdown( p );
+            return NULL;
+        }
+    }
+    return p;
+}
+
+static void ipslr_free_drives( char **drives, int driveNum ) {
+    int i;
+    for ( i=0; i<driveNum; ++i ) {
+        free( drives[i] );
+    }
+    free( drives );
+}
+
+int pslr_init_all( char *model, char *device, pslr_handle_t *handles, int max_num ) {
+    pslr_transport_t *transport;
     int driveNum;
     char **drives;
-    const char *camera_name;
+    int handle_num = 0;
+    int i;
 
-    DPRINT("[C]\tpslr_init()\n");
+    DPRINT("[C]\tpslr_init_all()\n");
 
+    transport = ipslr_find_transport( &device );
+    DPRINT("\ttransport: %s\n", transport->name);
     if ( device == NULL ) {
-        drives = get_drives(&driveNum);
+        drives = transport->get_drives(&driveNum);
     } else {
         driveNum = 1;
         drives = malloc( driveNum * sizeof(char*) );
         drives[0] = strdup( device );
     }
     DPRINT("driveNum:%d\n",driveNum);
-    int i;
-    for ( i=0; i<driveNum; ++i ) {
-        pslr_result result = get_drive_info( drives[i], &fd, vendorId, sizeof(vendorId), productId, sizeof(productId));
-
-        DPRINT("\tChecking drive:  %s %s %s\n", drives[i], vendorId, productId);
-        if ( find_in_array( valid_vendors, sizeof(valid_vendors)/sizeof(valid_vendors[0]),vendorId) != -1
-                && find_in_array( valid_models, sizeof(valid_models)/sizeof(valid_models[0]), productId) != -1 ) {
-            if ( result == PSLR_OK ) {
-                DPRINT("\tFound camera %s %s\n", vendorId, productId);
-                pslr.fd = fd;
-                if ( model != NULL ) {
-                    // user specified the camera model
-                    camera_name = pslr_get_camera_name( &pslr );
-                    DPRINT("\tName of the camera: %s\n", camera_name);
-                    if ( str_comparison_i( camera_name, model, strlen( camera_name) ) == 0 ) {
-                        return &pslr;
-                    } else {
-                        DPRINT("\tIgnoring camera %s %s\n", vendorId, productId);
-                        pslr_shutdown ( &pslr );
-                        pslr.id = 0;
-                        pslr.model = NULL;
-                    }
-                } else {
-                    return &pslr;
-                }
-            } else {
-                DPRINT("\tCannot get drive info of Pentax camera. Please do not forget to install the program using 'make install'\n");
-                // found the camera but communication is not possible
-                close_drive( &fd );
-                continue;
-            }
-        } else {
-            close_drive( &fd );
-            continue;
+    for ( i=0; i<driveNum && handle_num<max_num; ++i ) {
+        ipslr_handle_t *p = ipslr_open_drive( transport, drives[i], model, handle_num );
+        if ( p != NULL ) {
+            handles[handle_num++] = p;
         }
     }
-    DPRINT("\tcamera not found\n");
-    return NULL;
+    ipslr_free_drives( drives, driveNum );
+    if ( handle_num == 0 ) {
+        DPRINT("\tcamera not found\n");
+    }
+    return handle_num;
+}
+
+pslr_handle_t pslr_init( char *model, char *device ) {
+    pslr_handle_t h;
+    return pslr_init_all( model, device, &h, 1 ) == 1 ? h : NULL;
 }
 
 int pslr_connect(pslr_handle_t h) {
@@ -450,7 +543,16 @@ int pslr_disconnect(pslr_handle_t h) {
 int pslr_shutdown(pslr_handle_t h) {
     DPRINT("[C]\tpslr_shutdown()\n");
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    close_drive(&p->fd);
+    if (p->mapped_buffer) {
+        p->transport->unmap_buffer(p->fd, p->mapped_buffer, BLKSZ);
+        p->mapped_buffer = NULL;
+    }
+    p->transport->close_drive(&p->fd);
+    pslr_trace_close(p->trace);
+    p->trace = NULL;
+    pslr_setting_map_free(p->setting_map);
+    ipslr_pool_free(p);
+    free(p);
     return PSLR_OK;
 }
 
@@ -460,12 +562,178 @@ int pslr_shutter(pslr_handle_t h) {
     return ipslr_press_shutter(p, true);
 }
 
+typedef struct {
+    ipslr_handle_t *p;
+    pthread_mutex_t *start;
+    pthread_barrier_t *barrier;
+    int result;
+} ipslr_group_shutter_t;
+
+static void *ipslr_group_shutter_thread(void *arg) {
+    ipslr_group_shutter_t *g = arg;
+    // the barrier is ready when the start lock is released
+    pthread_mutex_lock(g->start);
+    pthread_mutex_unlock(g->start);
+    g->result = ipslr_shutter_arm(g->p, true);
+    // wait for the others even if arming failed, they count on us
+    pthread_barrier_wait(g->barrier);
+    if (g->result == PSLR_OK) {
+        g->result = ipslr_shutter_fire(g->p);
+    }
+    return NULL;
+}
+
+int pslr_group_shutter(pslr_handle_t *handles, int num, double *trigger_times, double *skew) {
+    DPRINT("[C]\tpslr_group_shutter(%d)\n", num);
+    pthread_mutex_t start = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t barrier;
+    double first = 0, last = 0;
+    int thread_num = 0;
+    int ret = PSLR_OK;
+    int i;
+
+    *skew = 0;
+    if (num <= 0) {
+        return PSLR_PARAM;
+    }
+    ipslr_group_shutter_t group[num];
+    pthread_t threads[num];
+    bool started[num];
+    pthread_mutex_lock(&start);
+    for (i = 0; i < num; ++i) {
+        group[i].p = (ipslr_handle_t *) handles[i];
+        group[i].start = &start;
+        group[i].barrier = &barrier;
+        group[i].result = PSLR_OK;
+        started[i] = pthread_create(&threads[i], NULL, ipslr_group_shutter_thread, &group[i]) == 0;
+        if (started[i]) {
+            ++thread_num;
+        } else {
+            pslr_write_log(PSLR_ERROR, "Cannot create trigger thread\n");
+            group[i].result = PSLR_DEVICE_ERROR;
+        }
+    }
+    if (thread_num > 0) {
+        pthread_barrier_init(&barrier, NULL, thread_num);
+    }
+    pthread_mutex_unlock(&start);
+    for (i = 0; i < num; ++i) {
+        trigger_times[i] = 0;
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        if (group[i].result != PSLR_OK) {
+            ret = group[i].result;
+            continue;
+        }
+        // the same trigger time as pslr_get_shutter_sent_time()
+        trigger_times[i] = group[i].p->shutter_sent_time;
+        if (first == 0 || trigger_times[i] < first) {
+            first = trigger_times[i];
+        }
+        if (trigger_times[i] > last) {
+            last = trigger_times[i];
+        }
+    }
+    if (thread_num > 0) {
+        pthread_barrier_destroy(&barrier);
+    }
+    *skew = last - first;
+    return ret;
+}
+
+int pslr_shutter_arm(pslr_handle_t h, bool fullpress) {
+    DPRINT("[C]\tpslr_shutter_arm()\n");
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return ipslr_shutter_arm(p, fullpress);
+}
+
+int pslr_shutter_fire(pslr_handle_t h) {
+    DPRINT("[C]\tpslr_shutter_fire()\n");
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return ipslr_shutter_fire(p);
+}
+
+double pslr_get_shutter_sent_time(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return p->shutter_sent_time;
+}
+
 int pslr_focus(pslr_handle_t h) {
     DPRINT("[C]\tpslr_focus()\n");
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     return ipslr_press_shutter(p, false);
 }
 
+int pslr_get_status_delta(pslr_handle_t h, pslr_status *ps, uint64_t *changed) {
+    DPRINT("[C]\tpslr_get_status_delta()\n");
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    CHECK(ipslr_status_full(p, &p->status));
+    memcpy(ps, &p->status, sizeof (pslr_status));
+    *changed = p->status_changed;
+    p->status_changed = 0;
+    return PSLR_OK;
+}
+
+int pslr_get_status_fields(pslr_handle_t h, uint64_t fields, pslr_status *ps) {
+    DPRINT("[C]\tpslr_get_status_fields(0x%llx)\n", (unsigned long long) fields);
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    int n;
+    fields &= PSLR_STATUS_ALL;
+    if ( p->status_valid && get_monotonic_sec() - p->status_time < p->status_cache_window ) {
+        DPRINT("\tcached\n");
+        p->status_cache_stats.hits++;
+        ipslr_status_copy_fields(ps, &p->status, fields);
+        return PSLR_OK;
+    }
+    if ( !p->model || p->model->status_buffer_size == 0 || !p->model->status_parser_function ) {
+        // limited support only, the fields are not known
+        return PSLR_OK;
+    }
+    p->status_cache_stats.misses++;
+    p->status_valid = false;
+    uint8_t buf[MAX_STATUS_BUF_SIZE];
+    CHECK(ipslr_status_read(p, buf, &n));
+    if ( n != p->model->status_buffer_size ) {
+        DPRINT("\tWaiting for %d bytes but got %d\n", p->model->status_buffer_size, n);
+        return PSLR_READ_ERROR;
+    }
+    if ( p->status_parsed_len == (uint32_t) n && memcmp(p->status_buffer, buf, n) == 0 ) {
+        // the status of the handle has been parsed from the same buffer
+        ipslr_status_copy_fields(ps, &p->status, fields);
+    } else {
+        memcpy(p->status_buffer, buf, n);
+        p->status_parsed_len = 0;
+        (*p->model->status_parser_function)(p, ps, fields);
+        if ( p->model->need_exposure_mode_conversion && (fields & PSLR_STATUS_BIT(PSLR_STATUS_EXPOSURE_MODE)) ) {
+            ps->exposure_mode = exposure_mode_conversion( ps->exposure_mode );
+        }
+    }
+    if ( p->model->bufmask_command && (fields & PSLR_STATUS_BIT(PSLR_STATUS_BUFMASK)) ) {
+        uint32_t x, y;
+        CHECK(pslr_get_buffer_status(p, &x, &y));
+        ps->bufmask = x;
+    }
+    return PSLR_OK;
+}
+
+int pslr_set_status_cache(pslr_handle_t h, double window_sec) {
+    DPRINT("[C]\tpslr_set_status_cache(%.3f)\n", window_sec);
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (window_sec < 0) {
+        return PSLR_PARAM;
+    }
+    p->status_cache_window = window_sec;
+    p->status_valid = false;
+    return PSLR_OK;
+}
+
+int pslr_get_status_cache_stats(pslr_handle_t h, pslr_status_cache_stats_t *stats) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    memcpy(stats, &p->status_cache_stats, sizeof (pslr_status_cache_stats_t));
+    return PSLR_OK;
+}
+
 int pslr_get_status(pslr_handle_t h, pslr_status *ps) {
     DPRINT("[C]\tpslr_get_status()\n");
     ipslr_handle_t *p = (ipslr_handle_t *) h;
@@ -522,6 +790,7 @@ char *pslr_get_af_name(pslr_handle_t h, uint32_t af_point) {
 
 char *pslr_get_status_info( pslr_handle_t h, pslr_status status ) {
     char *strbuffer = malloc(8192);
+    char bufmask_str[17];
     sprintf(strbuffer,"%-32s: %d\n", "current iso", status.current_iso);
     sprintf(strbuffer+strlen(strbuffer),"%-32s: %d/%d\n", "current shutter speed", status.current_shutter_speed.nom, status.current_shutter_speed.denom);
     sprintf(strbuffer+strlen(strbuffer),"%-32s: %d/%d\n", "camera max shutter speed", status.max_shutter_speed.nom, status.max_shutter_speed.denom);
@@ -569,7 +838,7 @@ char *pslr_get_status_info( pslr_handle_t h, pslr_status status ) {
     sprintf(strbuffer+strlen(strbuffer),"%-32s: %.2f\n", "manual mode ev", (1.0 * status.manual_mode_ev / 10));
     sprintf(strbuffer+strlen(strbuffer),"%-32s: %s\n", "lens", pslr_get_lens_name(status.lens_id1, status.lens_id2));
     sprintf(strbuffer+strlen(strbuffer),"%-32s: %.2fV %.2fV %.2fV %.2fV\n", "battery", 0.01 * status.battery_1, 0.01 * status.battery_2, 0.01 * status.battery_3, 0.01 * status.battery_4);
-    sprintf(strbuffer+strlen(strbuffer),"%-32s: %s\n", "buffer mask", int_to_binary(status.bufmask));
+    sprintf(strbuffer+strlen(strbuffer),"%-32s: %s\n", "buffer mask", int_to_binary(status.bufmask, bufmask_str));
     return strbuffer;
 }
 
@@ -642,54 +911,280 @@ int pslr_get_settings_buffer(pslr_handle_t h, uint8_t *st_buf) {
     return PSLR_OK;
 }
 
-int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
-                    uint8_t **ppData, uint32_t *pLen) {
-    DPRINT("[C]\tpslr_get_buffer()\n");
-    uint8_t *buf = 0;
+int pslr_buffer_download(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+                         pslr_buffer_sink_t sink, uintptr_t user_data) {
+    return pslr_buffer_download_from(h, bufno, type, resolution, 0, sink, user_data);
+}
+
+int pslr_buffer_download_from(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+                              uint32_t offset, pslr_buffer_sink_t sink, uintptr_t user_data) {
+    DPRINT("[C]\tpslr_buffer_download_from(%u)\n", offset);
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    uint8_t buf[BLKSZ];
+    int retry = 0;
     int ret;
     ret = pslr_buffer_open(h, bufno, type, resolution);
     if ( ret != PSLR_OK ) {
         return ret;
     }
-
-    uint32_t size = pslr_buffer_get_size(h);
-    buf = malloc(size);
-    if (!buf) {
-        return PSLR_NO_MEMORY;
+    ret = pslr_buffer_seek(h, offset);
+    if ( ret != PSLR_OK ) {
+        pslr_buffer_close(h);
+        return ret;
     }
 
-    uint32_t bufpos = 0;
-    while (true) {
-        uint32_t nextread = size - bufpos > 65536 ? 65536 : size - bufpos;
-        if (nextread == 0) {
-            break;
+    uint32_t size = pslr_buffer_get_size(h);
+    while (p->offset < size) {
+        const uint8_t *data;
+        uint32_t bytes;
+        if (p->mapped_download) {
+            bytes = pslr_buffer_read_mapped(h, &data, sizeof (buf));
+        } else {
+            bytes = pslr_buffer_read(h, buf, sizeof (buf));
+            data = buf;
         }
-        uint32_t bytes = pslr_buffer_read(h, buf+bufpos, nextread);
         if (bytes == 0) {
+            // the offset is not advanced, only the failed block is read again
+            if (retry < BLOCK_RETRY) {
+                DPRINT("\tRetrying the block at %u\n", p->offset);
+                retry++;
+                continue;
+            }
+            break;
+        }
+        retry = 0;
+        ret = sink(data, bytes, user_data);
+        if (ret != PSLR_OK) {
+            DPRINT("\tDownload aborted by the sink: %d\n", ret);
             break;
         }
-        bufpos += bytes;
     }
-    if ( bufpos != size ) {
-        free(buf);
-        return PSLR_READ_ERROR;
+    if ( ret == PSLR_OK && p->offset != size ) {
+        ret = PSLR_READ_ERROR;
     }
     pslr_buffer_close(h);
+    return ret;
+}
+
+struct ipslr_pool_buffer {
+    ipslr_pool_buffer_t *next;
+    int size_class;                                  // BUFFER_POOL_CLASSES if it is too big for the pool
+    uint32_t capacity;
+    uint8_t *data;
+};
+
+static int ipslr_pool_size_class(uint32_t size, uint32_t *capacity) {
+    int c;
+    for (c = 0; c < BUFFER_POOL_CLASSES; c++) {
+        *capacity = BLKSZ << c;
+        if (size <= *capacity) {
+            return c;
+        }
+    }
+    *capacity = size;
+    return BUFFER_POOL_CLASSES;
+}
+
+uint8_t *pslr_buffer_pool_get(pslr_handle_t h, uint32_t size) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    pslr_buffer_pool_stats_t *stats = &p->pool_stats;
+    ipslr_pool_buffer_t *b;
+    uint32_t capacity;
+    int c = ipslr_pool_size_class(size, &capacity);
+
+    if (c < BUFFER_POOL_CLASSES && p->pool_idle[c]) {
+        b = p->pool_idle[c];
+        p->pool_idle[c] = b->next;
+        stats->idle--;
+        stats->reuses++;
+    } else {
+        b = malloc(sizeof (ipslr_pool_buffer_t));
+        if (!b) {
+            return NULL;
+        }
+        b->data = malloc(capacity);
+        if (!b->data) {
+            free(b);
+            return NULL;
+        }
+        b->size_class = c;
+        b->capacity = capacity;
+        stats->allocations++;
+        stats->bytes += capacity;
+        if (stats->bytes > stats->peak_bytes) {
+            stats->peak_bytes = stats->bytes;
+        }
+    }
+    b->next = p->pool_used;
+    p->pool_used = b;
+    stats->in_use++;
+    return b->data;
+}
+
+static void ipslr_pool_buffer_free(ipslr_handle_t *p, ipslr_pool_buffer_t *b) {
+    p->pool_stats.bytes -= b->capacity;
+    free(b->data);
+    free(b);
+}
+
+int pslr_buffer_pool_release(pslr_handle_t h, uint8_t *data) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    ipslr_pool_buffer_t **pb;
+    ipslr_pool_buffer_t *b;
+    int idle = 0;
+
+    if (!data) {
+        return PSLR_OK;
+    }
+    for (pb = &p->pool_used; *pb && (*pb)->data != data; pb = &(*pb)->next)
+        ;
+    if (!*pb) {
+        DPRINT("[C]\tpslr_buffer_pool_release(): not a pool buffer\n");
+        return PSLR_PARAM;
+    }
+    b = *pb;
+    *pb = b->next;
+    p->pool_stats.in_use--;
+    p->pool_stats.releases++;
+
+    if (b->size_class < BUFFER_POOL_CLASSES) {
+        ipslr_pool_buffer_t *i;
+        for (i = p->pool_idle[b->size_class]; i; i = i->next) {
+            idle++;
+        }
+    }
+    if (b->size_class == BUFFER_POOL_CLASSES || idle >= BUFFER_POOL_IDLE) {
+        ipslr_pool_buffer_free(p, b);
+    } else {
+        b->next = p->pool_idle[b->size_class];
+        p->pool_idle[b->size_class] = b;
+        p->pool_stats.idle++;
+    }
+    return PSLR_OK;
+}
+
+int pslr_get_buffer_pool_stats(pslr_handle_t h, pslr_buffer_pool_stats_t *stats) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    memcpy(stats, &p->pool_stats, sizeof (pslr_buffer_pool_stats_t));
+    return PSLR_OK;
+}
+
+static void ipslr_pool_free(ipslr_handle_t *p) {
+    ipslr_pool_buffer_t *b;
+    int c;
+    for (c = 0; c < BUFFER_POOL_CLASSES; c++) {
+        while ((b = p->pool_idle[c])) {
+            p->pool_idle[c] = b->next;
+            ipslr_pool_buffer_free(p, b);
+        }
+    }
+    while ((b = p->pool_used)) {
+        p->pool_used = b->next;
+        ipslr_pool_buffer_free(p, b);
+    }
+}
+
+typedef struct {
+    pslr_handle_t h;
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+} ipslr_memory_sink_t;
+
+static int ipslr_memory_sink(const uint8_t *data, uint32_t len, uintptr_t user_data) {
+    ipslr_memory_sink_t *m = (ipslr_memory_sink_t *) user_data;
+    if (!m->buf) {
+        m->size = pslr_buffer_get_size(m->h);
+        m->buf = pslr_buffer_pool_get(m->h, m->size);
+        if (!m->buf) {
+            return PSLR_NO_MEMORY;
+        }
+    }
+    if (len > m->size - m->pos) {
+        return PSLR_READ_ERROR;
+    }
+    memcpy(m->buf + m->pos, data, len);
+    m->pos += len;
+    return PSLR_OK;
+}
+
+int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+                    uint8_t **ppData, uint32_t *pLen) {
+    DPRINT("[C]\tpslr_get_buffer()\n");
+    ipslr_memory_sink_t m = { h, NULL, 0, 0 };
+    int ret;
+
+    ret = pslr_buffer_download(h, bufno, type, resolution, ipslr_memory_sink, (uintptr_t) &m);
+    if ( ret == PSLR_OK && (!m.buf || m.pos != m.size) ) {
+        ret = PSLR_READ_ERROR;
+    }
+    if ( ret != PSLR_OK ) {
+        pslr_buffer_pool_release(h, m.buf);
+        return ret;
+    }
     if (ppData) {
-        *ppData = buf;
+        *ppData = m.buf;
+    } else {
+        pslr_buffer_pool_release(h, m.buf);
     }
     if (pLen) {
-        *pLen = size;
+        *pLen = m.size;
     }
 
     return PSLR_OK;
 }
 
 int pslr_set_progress_callback(pslr_handle_t h, pslr_progress_callback_t cb, uintptr_t user_data) {
-    progress_callback = cb;
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    p->progress_callback = cb;
+    p->progress_user_data = user_data;
     return PSLR_OK;
 }
 
+int pslr_set_async_download(pslr_handle_t h, bool enable) {
+    DPRINT("[C]\tpslr_set_async_download(%d)\n", enable);
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (enable && !ipslr_async_supported(p)) {
+        DPRINT("\tQueued commands are not supported by the device\n");
+        p->async_download = false;
+        return PSLR_PARAM;
+    }
+    p->async_download = enable;
+    return PSLR_OK;
+}
+
+int pslr_set_mapped_download(pslr_handle_t h, bool enable) {
+    DPRINT("[C]\tpslr_set_mapped_download(%d)\n", enable);
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (p->mapped_buffer) {
+        p->transport->unmap_buffer(p->fd, p->mapped_buffer, BLKSZ);
+        p->mapped_buffer = NULL;
+    }
+    p->mapped_download = false;
+    if (enable) {
+        p->mapped_buffer = ipslr_map_buffer(p);
+        if (!p->mapped_buffer) {
+            DPRINT("\tCannot map the reserved buffer of the device\n");
+            return PSLR_PARAM;
+        }
+        p->mapped_download = true;
+    }
+    return PSLR_OK;
+}
+
+int pslr_get_download_stats(pslr_handle_t h, pslr_download_stats_t *stats) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    memcpy(stats, &p->download_stats, sizeof (pslr_download_stats_t));
+    return PSLR_OK;
+}
+
+int pslr_get_command_stats(pslr_handle_t h, pslr_command_stats_t *stats, int max_num) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    int n = p->command_stats_num < max_num ? p->command_stats_num : max_num;
+    memcpy(stats, p->command_stats, n * sizeof (pslr_command_stats_t));
+    return n;
+}
+
 static
 int ipslr_handle_command_x18( ipslr_handle_t *p, bool cmd9_wrap, int subcommand, int argnum,  ...) {
     DPRINT("[C]\t\tipslr_handle_command_x18(0x%x, %d)\n", subcommand, argnum);
@@ -709,8 +1204,8 @@ int ipslr_handle_command_x18( ipslr_handle_t *p, bool cmd9_wrap, int subcommand,
     }
     va_end(ap);
     CHECK(ipslr_write_args(p, argnum, args[0], args[1], args[2], args[3]));
-    CHECK(command(p->fd, 0x18, subcommand, 4 * argnum));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x18, subcommand, 4 * argnum));
+    CHECK(get_status(p));
     if ( cmd9_wrap ) {
         CHECK(ipslr_cmd_00_09(p, 2));
     }
@@ -919,24 +1414,24 @@ int pslr_delete_buffer(pslr_handle_t h, int bufno) {
         return PSLR_PARAM;
     }
     CHECK(ipslr_write_args(p, 1, bufno));
-    CHECK(command(p->fd, 0x02, 0x03, 0x04));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x02, 0x03, 0x04));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 int pslr_green_button(pslr_handle_t h) {
     DPRINT("[C]\tpslr_green_button()\n");
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    CHECK(command(p->fd, 0x10, X10_GREEN, 0x00));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_GREEN, 0x00));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 int pslr_dust_removal(pslr_handle_t h) {
     DPRINT("[C]\tpslr_dust_removal()\n");
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    CHECK(command(p->fd, 0x10, X10_DUST, 0x00));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_DUST, 0x00));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -944,8 +1439,8 @@ int pslr_bulb(pslr_handle_t h, bool on ) {
     DPRINT("[C]\tpslr_bulb(%d)\n", on);
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     CHECK(ipslr_write_args(p, 1, on ? 1 : 0));
-    CHECK(command(p->fd, 0x10, X10_BULB, 0x04));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_BULB, 0x04));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -954,8 +1449,8 @@ int pslr_button_test(pslr_handle_t h, int bno, int arg) {
     int r;
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     CHECK(ipslr_write_args(p, 1, arg));
-    CHECK(command(p->fd, 0x10, bno, 4));
-    r = get_status(p->fd);
+    CHECK(command(p, 0x10, bno, 4));
+    r = get_status(p);
     DPRINT("\tbutton result code: 0x%x\n", r);
     return PSLR_OK;
 }
@@ -965,11 +1460,11 @@ int pslr_ae_lock(pslr_handle_t h, bool lock) {
     DPRINT("[C]\tpslr_ae_lock(%X)\n", lock);
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     if (lock) {
-        CHECK(command(p->fd, 0x10, X10_AE_LOCK, 0x00));
+        CHECK(command(p, 0x10, X10_AE_LOCK, 0x00));
     } else {
-        CHECK(command(p->fd, 0x10, X10_AE_UNLOCK, 0x00));
+        CHECK(command(p, 0x10, X10_AE_UNLOCK, 0x00));
     }
-    CHECK(get_status(p->fd));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -999,6 +1494,7 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
     int retry2 = 0;
 
     ipslr_handle_t *p = (ipslr_handle_t *) h;
+    double start_time;
 
     memset(&info, 0, sizeof (info));
 
@@ -1012,6 +1508,7 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
         return PSLR_READ_ERROR;
     }
 
+    start_time = get_monotonic_sec();
     while (retry < 3) {
         /* If we get response 0x82 from the camera, there is a
          * desynch. We can recover by stepping through segment infos
@@ -1058,19 +1555,18 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
     } while (i < 9 && info.b != 2);
     p->segment_count = j;
     p->offset = 0;
+    p->download_stats.segment_records += i;
+    p->download_stats.segment_seconds += get_monotonic_sec() - start_time;
     return PSLR_OK;
 }
 
-uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
-    ipslr_handle_t *p = (ipslr_handle_t *) h;
+/* Camera address and size of the next block at the current offset of the
+ * opened buffer. Returns 0 at the end of the buffer. */
+static uint32_t ipslr_buffer_next_block(ipslr_handle_t *p, uint32_t size, uint32_t *addr) {
     uint32_t i;
     uint32_t pos = 0;
     uint32_t seg_offs;
-    uint32_t addr;
     uint32_t blksz;
-    int ret;
-
-    DPRINT("[C]\tpslr_buffer_read(%d)\n", size);
 
     /* Find current segment */
     for (i = 0; i < p->segment_count; i++) {
@@ -1079,9 +1575,12 @@ uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
         }
         pos += p->segments[i].length;
     }
+    if (i == p->segment_count) {
+        return 0;
+    }
 
     seg_offs = p->offset - pos;
-    addr = p->segments[i].addr + seg_offs;
+    *addr = p->segments[i].addr + seg_offs;
 
     /* Compute block size */
     blksz = size;
@@ -1093,8 +1592,22 @@ uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
     }
 
 //    DPRINT("File offset %d segment: %d offset %d address 0x%x read size %d\n", p->offset,
-//           i, seg_offs, addr, blksz);
+//           i, seg_offs, *addr, blksz);
+    return blksz;
+}
+
+uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    uint32_t addr;
+    uint32_t blksz;
+    int ret;
 
+    DPRINT("[C]\tpslr_buffer_read(%d)\n", size);
+
+    blksz = ipslr_buffer_next_block(p, size, &addr);
+    if (blksz == 0) {
+        return 0;
+    }
     ret = ipslr_download(p, addr, blksz, buf);
     if (ret != PSLR_OK) {
         return 0;
@@ -1103,6 +1616,31 @@ uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
     return blksz;
 }
 
+uint32_t pslr_buffer_read_mapped(pslr_handle_t h, const uint8_t **data, uint32_t size) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    uint32_t addr;
+    uint32_t blksz;
+    int ret;
+
+    DPRINT("[C]\tpslr_buffer_read_mapped(%d)\n", size);
+
+    *data = NULL;
+    if (!p->mapped_buffer) {
+        return 0;
+    }
+    blksz = ipslr_buffer_next_block(p, size, &addr);
+    if (blksz == 0) {
+        return 0;
+    }
+    ret = ipslr_download(p, addr, blksz, NULL);
+    if (ret != PSLR_OK) {
+        return 0;
+    }
+    p->offset += blksz;
+    *data = p->mapped_buffer;
+    return blksz;
+}
+
 uint32_t pslr_fullmemory_read(pslr_handle_t h, uint8_t *buf, uint32_t offset, uint32_t size) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     int ret;
@@ -1127,6 +1665,21 @@ uint32_t pslr_buffer_get_size(pslr_handle_t h) {
     return len;
 }
 
+int pslr_buffer_seek(pslr_handle_t h, uint32_t offset) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    DPRINT("[C]\tpslr_buffer_seek(%u)\n", offset);
+    if (offset > pslr_buffer_get_size(h)) {
+        return PSLR_PARAM;
+    }
+    p->offset = offset;
+    return PSLR_OK;
+}
+
+uint32_t pslr_buffer_tell(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return p->offset;
+}
+
 void pslr_buffer_close(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     memset(&p->segments[0], 0, sizeof (p->segments));
@@ -1221,11 +1774,7 @@ bool pslr_get_model_bufmask_single(pslr_handle_t h) {
 
 bool pslr_get_model_has_settings_parser(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    char cameraid[10];
-    sprintf(cameraid, "0x%0x", p->model->id);
-    int def_num;
-    setting_file_process(cameraid, &def_num);
-    return def_num>0;
+    return ipslr_get_setting_map(p)->def_num > 0;
 }
 
 const char *pslr_get_camera_name(pslr_handle_t h) {
@@ -1241,10 +1790,8 @@ const char *pslr_get_camera_name(pslr_handle_t h) {
     if (p->model) {
         return p->model->name;
     } else {
-        static char unk_name[256];
-        snprintf(unk_name, sizeof (unk_name), "ID#%x", p->id);
-        unk_name[sizeof (unk_name) - 1] = '\0';
-        return unk_name;
+        snprintf(p->unknown_name, sizeof (p->unknown_name), "ID#%x", p->id);
+        return p->unknown_name;
     }
 }
 
@@ -1256,24 +1803,24 @@ pslr_buffer_type pslr_get_jpeg_buffer_type(pslr_handle_t h, int jpeg_stars) {
 static int ipslr_set_mode(ipslr_handle_t *p, uint32_t mode) {
     DPRINT("[C]\t\tipslr_set_mode(0x%x)\n", mode);
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0, 0, 4));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0, 0, 4));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 static int ipslr_cmd_00_09(ipslr_handle_t *p, uint32_t mode) {
     DPRINT("[C]\t\tipslr_cmd_00_09(0x%x)\n", mode);
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0, 9, 4));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0, 9, 4));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 static int ipslr_cmd_10_0a(ipslr_handle_t *p, uint32_t mode) {
     DPRINT("[C]\t\tipslr_cmd_10_0a(0x%x)\n", mode);
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0x10, X10_CONNECT, 4));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_CONNECT, 4));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -1281,41 +1828,61 @@ static int ipslr_cmd_00_05(ipslr_handle_t *p) {
     DPRINT("[C]\t\tipslr_cmd_00_05()\n");
     int n;
     uint8_t buf[0xb8];
-    CHECK(command(p->fd, 0x00, 0x05, 0x00));
-    n = get_result(p->fd);
+    CHECK(command(p, 0x00, 0x05, 0x00));
+    n = get_result(p);
     if (n != 0xb8) {
         DPRINT("\tonly got %d bytes\n", n);
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, buf, n));
+    CHECK(read_result(p, buf, n));
     return PSLR_OK;
 }
 
 static int ipslr_status(ipslr_handle_t *p, uint8_t *buf) {
     int n;
     DPRINT("[C]\t\tipslr_status()\n");
-    CHECK(command(p->fd, 0, 1, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0, 1, 0));
+    n = get_result(p);
     if (n == 16 || n == 28) {
-        return read_result(p->fd, buf, n);
+        return read_result(p, buf, n);
     } else {
         return PSLR_READ_ERROR;
     }
 }
 
+/* Reads the raw status buffer, n is the length sent by the camera */
+static int ipslr_status_read(ipslr_handle_t *p, uint8_t *buf, int *n) {
+    CHECK(command(p, 0, 8, 0));
+    *n = get_result(p);
+    DPRINT("\tread %d bytes\n", *n);
+    return read_result(p, buf, *n > MAX_STATUS_BUF_SIZE ? MAX_STATUS_BUF_SIZE : *n);
+}
+
 static int ipslr_status_full(ipslr_handle_t *p, pslr_status *status) {
     int n;
     DPRINT("[C]\t\tipslr_status_full()\n");
-    CHECK(command(p->fd, 0, 8, 0));
-    n = get_result(p->fd);
-    DPRINT("\tread %d bytes\n", n);
+    if ( status == &p->status && p->status_valid &&
+            get_monotonic_sec() - p->status_time < p->status_cache_window ) {
+        DPRINT("\tcached\n");
+        p->status_cache_stats.hits++;
+        return PSLR_OK;
+    }
+    p->status_cache_stats.misses++;
+    p->status_valid = false;
+    uint8_t buf[MAX_STATUS_BUF_SIZE];
+    CHECK(ipslr_status_read(p, buf, &n));
+    uint32_t len = n > MAX_STATUS_BUF_SIZE ? MAX_STATUS_BUF_SIZE : n;
     int expected_bufsize = p->model != NULL ? p->model->status_buffer_size : 0;
     if ( p->model == NULL ) {
         DPRINT("\tp model null\n");
     }
     DPRINT("\texpected_bufsize: %d\n",expected_bufsize);
 
-    CHECK(read_result(p->fd, p->status_buffer, n > MAX_STATUS_BUF_SIZE ? MAX_STATUS_BUF_SIZE: n));
+    // the same raw buffer gives the same status, no need to parse it again
+    bool unchanged = status == &p->status && p->status_parsed_len == len &&
+                     memcmp(p->status_buffer, buf, len) == 0;
+    memcpy(p->status_buffer, buf, len);
+    p->status_parsed_len = 0;
 
     if ( expected_bufsize == 0 || !p->model->status_parser_function ) {
         // limited support only
@@ -1325,9 +1892,15 @@ static int ipslr_status_full(ipslr_handle_t *p, pslr_status *status) {
         return PSLR_READ_ERROR;
     } else {
         // everything OK
-        (*p->model->status_parser_function)(p, status);
-        if ( p->model->need_exposure_mode_conversion ) {
-            status->exposure_mode = exposure_mode_conversion( status->exposure_mode );
+        pslr_status prev_status;
+        memcpy(&prev_status, status, sizeof (pslr_status));
+        if ( !unchanged ) {
+            (*p->model->status_parser_function)(p, status, PSLR_STATUS_ALL);
+            if ( p->model->need_exposure_mode_conversion ) {
+                status->exposure_mode = exposure_mode_conversion( status->exposure_mode );
+            }
+        } else {
+            DPRINT("\tunchanged status buffer\n");
         }
         if ( p->model->bufmask_command ) {
             uint32_t x, y;
@@ -1339,97 +1912,294 @@ static int ipslr_status_full(ipslr_handle_t *p, pslr_status *status) {
             }
             status->bufmask = x;
         }
+        if ( status == &p->status ) {
+            p->status_changed |= ipslr_status_changed_fields(&prev_status, status);
+            p->status_parsed_len = len;
+            p->status_time = get_monotonic_sec();
+            p->status_valid = true;
+        }
         return PSLR_OK;
     }
 }
 
 // fullpress: take picture
 // halfpress: autofocus
-static int ipslr_press_shutter(ipslr_handle_t *p, bool fullpress) {
-    DPRINT("[C]\t\tipslr_press_shutter(fullpress = %s)\n", (fullpress ? "true" : "false"));
-    int r;
+/* Everything before the shutter command: the status fetch and the argument */
+static int ipslr_shutter_arm(ipslr_handle_t *p, bool fullpress) {
+    DPRINT("[C]\t\tipslr_shutter_arm(fullpress = %s)\n", (fullpress ? "true" : "false"));
     CHECK(ipslr_status_full(p, &p->status));
     DPRINT("\t\tbefore: mask=0x%x\n", p->status.bufmask);
     CHECK(ipslr_write_args(p, 1, fullpress ? 2 : 1));
-    CHECK(command(p->fd, 0x10, X10_SHUTTER, 0x04));
-    r = get_status(p->fd);
+    p->shutter_armed = true;
+    return PSLR_OK;
+}
+
+/* Sends the shutter command, the camera has to be armed before */
+static int ipslr_shutter_fire(ipslr_handle_t *p) {
+    int r;
+    if (!p->shutter_armed) {
+        return PSLR_PARAM;
+    }
+    p->shutter_armed = false;
+    CHECK(command(p, 0x10, X10_SHUTTER, 0x04));
+    p->shutter_sent_time = get_monotonic_sec();
+    r = get_status(p);
     DPRINT("\t\tshutter result code: 0x%x\n", r);
     return PSLR_OK;
 }
 
+static int ipslr_press_shutter(ipslr_handle_t *p, bool fullpress) {
+    DPRINT("[C]\t\tipslr_press_shutter(fullpress = %s)\n", (fullpress ? "true" : "false"));
+    CHECK(ipslr_shutter_arm(p, fullpress));
+    return ipslr_shutter_fire(p);
+}
+
 static int ipslr_select_buffer(ipslr_handle_t *p, int bufno, pslr_buffer_type buftype, int bufres) {
     int r;
     DPRINT("\t\tSelect buffer %d,%d,%d,0\n", bufno, buftype, bufres);
     if ( !p->model->old_scsi_command ) {
         CHECK(ipslr_write_args(p, 4, bufno, buftype, bufres, 0));
-        CHECK(command(p->fd, 0x02, 0x01, 0x10));
+        CHECK(command(p, 0x02, 0x01, 0x10));
     } else {
         /* older cameras: 3-arg select buffer */
         CHECK(ipslr_write_args(p, 4, bufno, buftype, bufres));
-        CHECK(command(p->fd, 0x02, 0x01, 0x0c));
+        CHECK(command(p, 0x02, 0x01, 0x0c));
     }
-    r = get_status(p->fd);
+    r = get_status(p);
+    p->segment_time = get_monotonic_sec();
+    p->segment_advanced = false;
+    p->segment_info_valid = false;
     if (r != 0) {
         return PSLR_COMMAND_ERROR;
     }
     return PSLR_OK;
 }
 
+/* The next segment info is not valid right after the command, the camera
+ * reports b = 0 for a while and cannot be read reliably before the model's
+ * segment_delay. ipslr_buffer_segment_info() waits for it. */
 static int ipslr_next_segment(ipslr_handle_t *p) {
     DPRINT("[C]\t\tipslr_next_segment()\n");
     int r;
     CHECK(ipslr_write_args(p, 1, 0));
-    CHECK(command(p->fd, 0x04, 0x01, 0x04));
-    usleep(100000); // needed !! 100 too short, 1000 not short enough for PEF
-    r = get_status(p->fd);
+    CHECK(command(p, 0x04, 0x01, 0x04));
+    r = get_status(p);
+    p->segment_time = get_monotonic_sec();
+    p->segment_advanced = true;
+    p->segment_info_valid = false;
     if (r == 0) {
         return PSLR_OK;
     }
     return PSLR_COMMAND_ERROR;
 }
 
+/* Reads the segment info of the current record. After selecting the buffer
+ * or advancing with ipslr_next_segment() it is polled until it is valid,
+ * otherwise the record already read is returned again. After an advance
+ * the first read waits for the model's delay, or for the shortest time
+ * this camera needed if that is longer. */
 static int ipslr_buffer_segment_info(ipslr_handle_t *p, pslr_buffer_segment_info *pInfo) {
     DPRINT("[C]\t\tipslr_buffer_segment_info()\n");
     uint8_t buf[16];
     uint32_t n;
-    int num_try = 20;
+    int polls = 0;
+    double wait = 0.001;
+    double elapsed;
+    double delay = p->model->segment_delay > 0 ? p->model->segment_delay : SEGMENT_DEFAULT_DELAY;
+
+    //  use the right function based on the endian.
+    get_uint32_func get_uint32_func_ptr;
+    if (p->model->is_little_endian) {
+        get_uint32_func_ptr = get_uint32_le;
+    } else {
+        get_uint32_func_ptr = get_uint32_be;
+    }
 
-    pInfo->b = 0;
-    while ( pInfo->b == 0 && --num_try > 0 ) {
-        CHECK(command(p->fd, 0x04, 0x00, 0x00));
-        n = get_result(p->fd);
+    if ( !p->segment_info_valid && p->segment_advanced ) {
+        if ( p->segment_delay > delay ) {
+            delay = p->segment_delay;
+        }
+        elapsed = get_monotonic_sec() - p->segment_time;
+        if ( elapsed < delay ) {
+            sleep_sec( delay - elapsed );
+        }
+    }
+    while ( !p->segment_info_valid ) {
+        CHECK(command(p, 0x04, 0x00, 0x00));
+        n = get_result(p);
         if (n != 16) {
             return PSLR_READ_ERROR;
         }
-        CHECK(read_result(p->fd, buf, 16));
-
-        //  use the right function based on the endian.
-        get_uint32_func get_uint32_func_ptr;
-        if (p->model->is_little_endian) {
-            get_uint32_func_ptr = get_uint32_le;
+        CHECK(read_result(p, buf, 16));
+        ++polls;
+        elapsed = get_monotonic_sec() - p->segment_time;
+        if ( (*get_uint32_func_ptr)(&buf[4]) != 0 ) {
+            memcpy(p->segment_info, buf, 16);
+            p->segment_info_valid = true;
+            if ( polls > 1 && p->segment_advanced && (p->segment_delay == 0 || elapsed < p->segment_delay) ) {
+                // the camera needed more than the model's delay, learn the shortest such time
+                p->segment_delay = elapsed;
+                DPRINT("\tSegment info delay: %.3f sec\n", elapsed);
+            }
+        } else if ( elapsed > SEGMENT_TIMEOUT ) {
+            DPRINT("\tSegment info is not valid after %.3f sec\n", elapsed);
+            return PSLR_READ_ERROR;
         } else {
-            get_uint32_func_ptr = get_uint32_be;
+            DPRINT("\tWaiting for segment info\n");
+            sleep_sec( wait );
+            wait = 2 * wait < SEGMENT_MAX_WAIT ? 2 * wait : SEGMENT_MAX_WAIT;
+        }
+    }
+    pInfo->a = (*get_uint32_func_ptr)(&p->segment_info[0]);
+    pInfo->b = (*get_uint32_func_ptr)(&p->segment_info[4]);
+    pInfo->addr = (*get_uint32_func_ptr)(&p->segment_info[8]);
+    pInfo->length = (*get_uint32_func_ptr)(&p->segment_info[12]);
+    return PSLR_OK;
+}
+
+static void ipslr_init_request(ipslr_handle_t *p, scsi_request_t *req, bool to_device,
+                               uint8_t *cmd, uint8_t *buf, uint32_t bufLen) {
+    memset(req, 0, sizeof (*req));
+    req->pack_id = ++p->pack_id;
+    req->to_device = to_device;
+    memcpy(req->cmd, cmd, 8);
+    req->cmdLen = 8;
+    req->buf = buf;
+    req->bufLen = bufLen;
+}
+
+/* Same command sequence as the synchronous download, but the data read of
+ * the current block, the status read after it, and the argument write and
+ * 0x06 0x00 command of the next block are queued to the sg driver at once,
+ * so the kernel can start the next command as soon as the previous one
+ * completes, without a round-trip through the user space. The arguments
+ * are written like _ipslr_write_args(): at once, or one by one for the
+ * old_scsi_command models. */
+static int ipslr_download_queued(ipslr_handle_t *p, uint32_t addr, uint32_t length, uint8_t *buf) {
+    uint8_t downloadCmd[8] = {0xf0, 0x24, 0x06, 0x02, 0x00, 0x00, 0x00, 0x00};
+    uint8_t statusCmd[8] = {0xf0, 0x26, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    uint8_t argsCmd[8] = {0xf0, 0x4f, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00};
+    uint8_t argCmd[2][8] = {{0xf0, 0x4f, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00},
+        {0xf0, 0x4f, 0x04, 0x00, 0x04, 0x00, 0x00, 0x00}
+    };
+    uint8_t prepareCmd[8] = {0xf0, 0x24, 0x06, 0x00, 0x08, 0x00, 0x00, 0x00};
+    uint8_t statusbuf[8];
+    uint8_t argsbuf[8];
+    scsi_request_t req[5];
+    int req_num;
+    int queued;
+    uint32_t block;
+    uint32_t next_block;
+    int n;
+    int i;
+    int retry = 0;
+    bool prepared = false;
+    uint32_t length_start = length;
+    double start;
+
+    while (length > 0) {
+        block = length > BLKSZ ? BLKSZ : length;
+
+        if (!prepared) {
+            CHECK(ipslr_write_args(p, 2, addr, block));
+            CHECK(command(p, 0x06, 0x00, 0x08));
+        }
+        get_status(p);
+
+        req_num = 0;
+        ipslr_init_request(p, &req[req_num], false, downloadCmd, buf ? buf : p->mapped_buffer, block);
+        req[req_num++].mapped = buf == NULL;
+        memset(statusbuf, 0, sizeof (statusbuf));
+        ipslr_init_request(p, &req[req_num++], false, statusCmd, statusbuf, sizeof (statusbuf));
+        next_block = length - block > BLKSZ ? BLKSZ : length - block;
+        if (next_block > 0) {
+            if (p->model->is_little_endian) {
+                set_uint32_le(addr + block, &argsbuf[0]);
+                set_uint32_le(next_block, &argsbuf[4]);
+            } else {
+                set_uint32_be(addr + block, &argsbuf[0]);
+                set_uint32_be(next_block, &argsbuf[4]);
+            }
+            if (!p->model->old_scsi_command) {
+                ipslr_init_request(p, &req[req_num++], true, argsCmd, argsbuf, sizeof (argsbuf));
+            } else {
+                ipslr_init_request(p, &req[req_num++], true, argCmd[0], &argsbuf[0], 4);
+                ipslr_init_request(p, &req[req_num++], true, argCmd[1], &argsbuf[4], 4);
+            }
+            ipslr_init_request(p, &req[req_num++], true, prepareCmd, NULL, 0);
+        }
+        queued = req_num;
+
+        start = get_monotonic_sec();
+        for (i = 0; i < req_num; ++i) {
+            if (p->transport->submit(p->fd, &req[i]) != PSLR_OK) {
+                break;
+            }
+        }
+        req_num = i;
+        for (i = 0; i < req_num; ++i) {
+            p->transport->complete(p->fd, &req[i]);
+            if (p->trace) {
+                ipslr_trace(p, start, req[i].to_device, req[i].cmd, req[i].cmdLen, req[i].buf,
+                            req[i].to_device ? req[i].bufLen : (req[i].result > 0 ? req[i].result : 0),
+                            req[i].result, req[i].sense, req[i].senseLen);
+            }
+        }
+
+        /* The next block can only be used if everything was queued and
+         * the camera was not busy when it got the arguments, otherwise
+         * it is set up again as in the synchronous case. */
+        prepared = req_num > 2 && req_num == queued && statusbuf[7] != 0x01;
+        for (i = 2; i < req_num; ++i) {
+            prepared = prepared && req[i].result == PSLR_OK;
+        }
+        if (statusbuf[7] == 0x01) {
+            get_status(p);
         }
 
-        pInfo->a = (*get_uint32_func_ptr)(&buf[0]);
-        pInfo->b = (*get_uint32_func_ptr)(&buf[4]);
-        pInfo->addr = (*get_uint32_func_ptr)(&buf[8]);
-        pInfo->length = (*get_uint32_func_ptr)(&buf[12]);
-        if ( pInfo-> b == 0 ) {
-            DPRINT("\tWaiting for segment info addr: 0x%x len: %d B=%d\n", pInfo->addr, pInfo->length, pInfo->b);
-            sleep_sec( 0.1 );
+        n = req_num > 0 ? req[0].result : -PSLR_DEVICE_ERROR;
+        if (n < 0) {
+            prepared = false;
+            if (retry < BLOCK_RETRY) {
+                retry++;
+                continue;
+            }
+            return PSLR_READ_ERROR;
+        }
+        if (buf) {
+            buf += n;
+        }
+        length -= n;
+        addr += n;
+        retry = 0;
+        ++p->download_stats.blocks;
+        if (p->progress_callback) {
+            p->progress_callback(length_start - length, length_start, p->progress_user_data);
         }
     }
     return PSLR_OK;
 }
 
+/* If buf is NULL the data is read into the mmap-ed reserved buffer, in this
+ * case length cannot be larger than BLKSZ. */
 static int ipslr_download(ipslr_handle_t *p, uint32_t addr, uint32_t length, uint8_t *buf) {
     DPRINT("[C]\t\tipslr_download(address = 0x%X, length = %d)\n", addr, length);
     uint8_t downloadCmd[8] = {0xf0, 0x24, 0x06, 0x02, 0x00, 0x00, 0x00, 0x00};
     uint32_t block;
     int n;
     int retry;
+    int ret;
     uint32_t length_start = length;
+    double start_time = get_monotonic_sec();
+
+    if (p->async_download) {
+        ret = ipslr_download_queued(p, addr, length, buf);
+        p->download_stats.seconds += get_monotonic_sec() - start_time;
+        if (ret == PSLR_OK) {
+            p->download_stats.bytes += length_start;
+        }
+        return ret;
+    }
 
     retry = 0;
     while (length > 0) {
@@ -1441,27 +2211,41 @@ static int ipslr_download(ipslr_handle_t *p, uint32_t addr, uint32_t length, uin
 
         //DPRINT("Get 0x%x bytes from 0x%x\n", block, addr);
         CHECK(ipslr_write_args(p, 2, addr, block));
-        CHECK(command(p->fd, 0x06, 0x00, 0x08));
-        get_status(p->fd);
+        CHECK(command(p, 0x06, 0x00, 0x08));
+        get_status(p);
 
-        n = scsi_read(p->fd, downloadCmd, sizeof (downloadCmd), buf, block);
-        get_status(p->fd);
+        if (buf) {
+            n = ipslr_scsi_read(p, downloadCmd, sizeof (downloadCmd), buf, block);
+        } else {
+            double start = get_monotonic_sec();
+            n = p->transport->read_mapped(p->fd, downloadCmd, sizeof (downloadCmd), p->mapped_buffer, block);
+            if (p->trace) {
+                ipslr_trace(p, start, false, downloadCmd, sizeof (downloadCmd), p->mapped_buffer, n > 0 ? n : 0, n, NULL, 0);
+            }
+        }
+        get_status(p);
 
         if (n < 0) {
             if (retry < BLOCK_RETRY) {
                 retry++;
                 continue;
             }
+            p->download_stats.seconds += get_monotonic_sec() - start_time;
             return PSLR_READ_ERROR;
         }
-        buf += n;
+        if (buf) {
+            buf += n;
+        }
         length -= n;
         addr += n;
         retry = 0;
-        if (progress_callback) {
-            progress_callback(length_start - length, length_start);
+        ++p->download_stats.blocks;
+        if (p->progress_callback) {
+            p->progress_callback(length_start - length, length_start, p->progress_user_data);
         }
     }
+    p->download_stats.seconds += get_monotonic_sec() - start_time;
+    p->download_stats.bytes += length_start;
     return PSLR_OK;
 }
 
@@ -1470,12 +2254,12 @@ static int ipslr_identify(ipslr_handle_t *p) {
     uint8_t idbuf[8];
     int n;
 
-    CHECK(command(p->fd, 0, 4, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0, 4, 0));
+    n = get_result(p);
     if (n != 8) {
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, idbuf, 8));
+    CHECK(read_result(p, idbuf, 8));
     //  Check the camera endian, which affect ID
     if (idbuf[0] == 0) {
         p->id = get_uint32_be(&idbuf[0]);
@@ -1493,13 +2277,13 @@ int pslr_get_datetime(pslr_handle_t *h, int *year, int *month, int *day, int *ho
     uint8_t idbuf[800];
     int n;
 
-    CHECK(command(p->fd, 0x20, 0x06, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0x20, 0x06, 0));
+    n = get_result(p);
     DPRINT("[C]\t\tipslr_get_datetime() bytes: %d\n",n);
     if (n!= 24) {
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, idbuf, n));
+    CHECK(read_result(p, idbuf, n));
     get_uint32_func get_uint32_func_ptr;
 
     if (p->model->is_little_endian) {
@@ -1522,13 +2306,13 @@ int pslr_get_dspinfo(pslr_handle_t *h, char* firmware) {
     uint8_t buf[4];
     int n;
 
-    CHECK(command(p->fd, 0x01, 0x01, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0x01, 0x01, 0));
+    n = get_result(p);
     DPRINT("[C]\t\tipslr_get_dspinfo() bytes: %d\n",n);
     if (n!= 4) {
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, buf, n));
+    CHECK(read_result(p, buf, n));
     if (p->model->is_little_endian) {
         snprintf( firmware, 16, "%d.%02d.%02d.%02d", buf[3], buf[2], buf[1], buf[0]);
     } else {
@@ -1544,13 +2328,13 @@ int pslr_get_setting(pslr_handle_t *h, int offset, uint32_t *value) {
     int n;
 
     CHECK(ipslr_write_args(p, 1, offset));
-    CHECK(command(p->fd, 0x20, 0x09, 4));
-    n = get_result(p->fd);
+    CHECK(command(p, 0x20, 0x09, 4));
+    n = get_result(p);
     DPRINT("[C]\t\tipslr_get_setting() bytes: %d\n",n);
     if (n!= 4) {
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, buf, n));
+    CHECK(read_result(p, buf, n));
     get_uint32_func get_uint32_func_ptr;
     if (p->model->is_little_endian) {
         get_uint32_func_ptr = get_uint32_le;
@@ -1566,19 +2350,14 @@ int pslr_set_setting(pslr_handle_t *h, int offset, uint32_t value) {
     DPRINT("[C]\t\tipslr_set_setting(%d)=%d\n", offset, value);
     CHECK(ipslr_cmd_00_09(p, 1));
     CHECK(ipslr_write_args(p, 2, offset, value));
-    CHECK(command(p->fd, 0x20, 0x08, 8));
+    CHECK(command(p, 0x20, 0x08, 8));
     CHECK(ipslr_cmd_00_09(p, 2));
     return PSLR_OK;
 }
 
 int pslr_set_setting_by_name(pslr_handle_t *h, char *name, uint32_t value) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    int def_num;
-    char cameraid[10];
-    sprintf(cameraid, "0x%0x", p->model->id);
-    //    printf("cameraid: %s\n", cameraid);
-    pslr_setting_def_t *defs = setting_file_process(cameraid, &def_num);
-    pslr_setting_def_t *setting_def = pslr_find_setting_by_name(defs, def_num, name);
+    const pslr_setting_def_t *setting_def = pslr_setting_map_find(ipslr_get_setting_map(p), name);
     if (setting_def != NULL) {
         if (strcmp(setting_def->type,"boolean") == 0) {
             pslr_set_setting(h, setting_def->address, value);
@@ -1592,13 +2371,7 @@ int pslr_set_setting_by_name(pslr_handle_t *h, char *name, uint32_t value) {
 
 bool pslr_has_setting_by_name(pslr_handle_t *h, char *name) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    int def_num;
-    char cameraid[10];
-    sprintf(cameraid, "0x%0x", p->model->id);
-    pslr_setting_def_t *defs = setting_file_process(cameraid, &def_num);
-    pslr_setting_def_t *setting_def = pslr_find_setting_by_name(defs, def_num, name);
-//    printf("%d %d\n", def_num, (setting_def != NULL));
-    return (setting_def != NULL);
+    return pslr_setting_map_find(ipslr_get_setting_map(p), name) != NULL;
 }
 
 
@@ -1617,15 +2390,47 @@ int pslr_get_settings(pslr_handle_t *h) {
     return PSLR_OK;
 }
 
+/* Reads only the settings memory addresses the json definitions of the
+ * camera refer to, instead of the whole SETTINGS_BUFFER_SIZE bytes.
+ * There is no command reading more than one byte at once, so every
+ * address still costs a 0x20 0x09 round-trip. */
+static int ipslr_get_settings_sparse(ipslr_handle_t *p) {
+    bool fetched[SETTINGS_BUFFER_SIZE];
+    uint32_t value;
+    uint32_t address;
+    int i, j;
+    int ret;
+
+    const pslr_setting_map_t *map = ipslr_get_setting_map(p);
+    const pslr_setting_def_t *defs = map->defs;
+    memset(fetched, 0, sizeof (fetched));
+    for (i = 0; i < map->def_num; ++i) {
+        if (defs[i].value != NULL || defs[i].address == 0) {
+            // hardwired or not available
+            continue;
+        }
+        // uint16 settings are stored in two bytes
+        for (j = 0; j < (strcmp(defs[i].type, "uint16") == 0 ? 2 : 1); ++j) {
+            address = defs[i].address + j;
+            if (address >= SETTINGS_BUFFER_SIZE || fetched[address]) {
+                continue;
+            }
+            if ( (ret = pslr_get_setting((pslr_handle_t *)p, address, &value)) != PSLR_OK ) {
+                return ret;
+            }
+            p->settings_buffer[address] = value;
+            fetched[address] = true;
+        }
+    }
+    return PSLR_OK;
+}
+
 int pslr_get_settings_json(pslr_handle_t h, pslr_settings *ps) {
     DPRINT("[C]\tpslr_get_settings_json()\n");
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     memset( ps, 0, sizeof( pslr_settings ));
-    CHECK(pslr_get_settings(h));
-    char cameraid[20];
-    sprintf(cameraid, "0x%05x", p->id);
-    DPRINT("cameraid:%s\n", cameraid);
-    ipslr_settings_parser_json(cameraid, p, &p->settings);
+    CHECK(ipslr_get_settings_sparse(p));
+    ipslr_settings_parser_json(p, &p->settings);
     memcpy(ps, &p->settings, sizeof (pslr_settings));
     return PSLR_OK;
 }
@@ -1635,7 +2440,6 @@ static int _ipslr_write_args(uint8_t cmd_2, ipslr_handle_t *p, int n, ...) {
     va_list ap;
     uint8_t cmd[8] = {0xf0, 0x4f, cmd_2, 0x00, 0x00, 0x00, 0x00, 0x00};
     uint8_t buf[4 * n];
-    FDTYPE fd = p->fd;
     int res;
     int i;
     uint32_t data;
@@ -1652,6 +2456,8 @@ static int _ipslr_write_args(uint8_t cmd_2, ipslr_handle_t *p, int n, ...) {
     DPRINT("})\n");
     va_end(ap);
 
+    // the shutter argument of an armed camera is overwritten
+    p->shutter_armed = false;
     va_start(ap, n);
     if ( p->model && !p->model->old_scsi_command ) {
         /* All at once */
@@ -1667,7 +2473,7 @@ static int _ipslr_write_args(uint8_t cmd_2, ipslr_handle_t *p, int n, ...) {
         cmd[4] = 4 * n;
 
 
-        res = scsi_write(fd, cmd, sizeof (cmd), buf, 4 * n);
+        res = ipslr_scsi_write(p, cmd, sizeof (cmd), buf, 4 * n);
         if (res != PSLR_OK) {
             va_end(ap);
             return res;
@@ -1685,7 +2491,7 @@ static int _ipslr_write_args(uint8_t cmd_2, ipslr_handle_t *p, int n, ...) {
 
             cmd[4] = 4;
             cmd[2] = i * 4;
-            res = scsi_write(fd, cmd, sizeof (cmd), buf, 4);
+            res = ipslr_scsi_write(p, cmd, sizeof (cmd), buf, 4);
             if (res != PSLR_OK) {
                 va_end(ap);
                 return res;
@@ -1696,23 +2502,166 @@ static int _ipslr_write_args(uint8_t cmd_2, ipslr_handle_t *p, int n, ...) {
     return PSLR_OK;
 }
 
-static int command(FDTYPE fd, int a, int b, int c) {
-    DPRINT("[C]\t\t\tcommand(fd=%x, %x, %x, %x)\n", fd, a, b, c);
+/* Records a transport call into the trace of the handle. If sense is NULL
+ * the sense data of a failed call is asked from the transport. */
+static void ipslr_trace(ipslr_handle_t *p, double start, bool to_device, uint8_t *cmd, uint32_t cmdLen,
+                        uint8_t *buf, uint32_t bufLen, int result, uint8_t *sense, uint32_t senseLen) {
+    uint8_t last_sense[32];
+    bool failed = to_device ? result != PSLR_OK : result < 0;
+    if (sense == NULL && failed && p->transport->get_sense) {
+        sense = last_sense;
+        senseLen = p->transport->get_sense(p->fd, last_sense, sizeof (last_sense));
+    }
+    pslr_trace_record(p->trace, start, to_device, cmd, cmdLen, buf, bufLen, result, sense, senseLen);
+}
+
+static int ipslr_scsi_read(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen) {
+    double start = p->trace ? get_monotonic_sec() : 0;
+    int n = p->transport->read(p->fd, cmd, cmdLen, buf, bufLen);
+    if (p->trace) {
+        ipslr_trace(p, start, false, cmd, cmdLen, buf, n > 0 ? n : 0, n, NULL, 0);
+    }
+    return n;
+}
+
+static int ipslr_scsi_write(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen) {
+    double start = p->trace ? get_monotonic_sec() : 0;
+    int r = p->transport->write(p->fd, cmd, cmdLen, buf, bufLen);
+    if (p->trace) {
+        ipslr_trace(p, start, true, cmd, cmdLen, buf, bufLen, r, NULL, 0);
+    }
+    return r;
+}
+
+/* Commands that only read from the camera, every other command (x18
+ * setters, x10 buttons and shutter, buffer deletion, mode changes,
+ * setting writes) can change the status. b == -1 matches every b. */
+static const struct {
+    int a;
+    int b;
+} read_only_commands[] = {
+    { 0x00, 0x01 },             /* status */
+    { 0x00, 0x04 },             /* identify */
+    { 0x00, 0x08 },             /* full status */
+    { 0x01, 0x01 },             /* dsp info */
+    { 0x02, 0x00 },             /* buffer status */
+    { 0x04, -1 },               /* segment info */
+    { 0x06, -1 },               /* download */
+    { 0x20, 0x06 },             /* date and time */
+    { 0x20, 0x09 }              /* setting read */
+};
+
+static bool ipslr_command_changes_status(int a, int b) {
+    unsigned int i;
+    for (i = 0; i < sizeof(read_only_commands) / sizeof(read_only_commands[0]); i++) {
+        if (read_only_commands[i].a == a && (read_only_commands[i].b == -1 || read_only_commands[i].b == b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int command(ipslr_handle_t *p, int a, int b, int c) {
+    DPRINT("[C]\t\t\tcommand(fd=%x, %x, %x, %x)\n", p->fd, a, b, c);
     uint8_t cmd[8] = {0xf0, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
     cmd[2] = a;
     cmd[3] = b;
     cmd[4] = c;
 
-    CHECK(scsi_write(fd, cmd, sizeof (cmd), 0, 0));
+    if (p->status_valid && ipslr_command_changes_status(a, b)) {
+        p->status_valid = false;
+        p->status_cache_stats.invalidations++;
+    }
+    p->last_command = (a & 0xff) << 8 | (b & 0xff);
+    p->command_time = get_monotonic_sec();
+    p->command_pending = true;
+    CHECK(ipslr_scsi_write(p, cmd, sizeof (cmd), 0, 0));
     return PSLR_OK;
 }
 
-static int read_status(FDTYPE fd, uint8_t *buf) {
+/* Waiting strategy of the status polling for a command class: the first
+ * re-polls are immediate, then the wait doubles from min_wait up to
+ * max_wait. Most commands complete within a few ms, the shutter and the
+ * buttons can take much longer. */
+typedef struct {
+    int first_cmd;              /* a of the command 0x24 a b */
+    int last_cmd;
+    int spins;                  /* number of immediate re-polls */
+    uint32_t min_wait;          /* us */
+    uint32_t max_wait;          /* us */
+} ipslr_poll_policy_t;
+
+static const ipslr_poll_policy_t poll_policies[] = {
+    { 0x06, 0x06, 4, 100, 2000 },               /* download */
+    { 0x10, 0x10, 1, 1000, POLL_INTERVAL },     /* buttons, shutter */
+    { 0x23, 0x23, 1, 1000, POLL_INTERVAL },     /* debug mode */
+    { 0x00, 0xff, 2, 500, 10000 }               /* everything else */
+};
+
+static void ipslr_poll_wait(ipslr_handle_t *p, int polls) {
+    const ipslr_poll_policy_t *policy = poll_policies;
+    int cmd = p->last_command >> 8;
+    uint32_t wait;
+    int i;
+
+    while (cmd < policy->first_cmd || cmd > policy->last_cmd) {
+        ++policy;
+    }
+    if (polls <= policy->spins) {
+        return;
+    }
+    wait = policy->min_wait;
+    for (i = policy->spins + 1; i < polls && wait < policy->max_wait; ++i) {
+        wait *= 2;
+    }
+    usleep(wait < policy->max_wait ? wait : policy->max_wait);
+}
+
+/* Latency of the last command, from sending it until the camera reports
+ * its completion */
+static void ipslr_command_done(ipslr_handle_t *p, int polls) {
+    pslr_command_stats_t *stats;
+    double latency;
+    int i;
+
+    if (!p->command_pending) {
+        return;
+    }
+    p->command_pending = false;
+    latency = get_monotonic_sec() - p->command_time;
+    for (i = 0; i < p->command_stats_num; ++i) {
+        if ((p->command_stats[i].a << 8 | p->command_stats[i].b) == p->last_command) {
+            break;
+        }
+    }
+    if (i == MAX_COMMAND_STATS) {
+        return;
+    }
+    stats = &p->command_stats[i];
+    if (i == p->command_stats_num) {
+        memset(stats, 0, sizeof (*stats));
+        stats->a = p->last_command >> 8;
+        stats->b = p->last_command & 0xff;
+        stats->min = latency;
+        ++p->command_stats_num;
+    }
+    ++stats->count;
+    stats->polls += polls;
+    stats->total += latency;
+    if (latency < stats->min) {
+        stats->min = latency;
+    }
+    if (latency > stats->max) {
+        stats->max = latency;
+    }
+}
+
+static int read_status(ipslr_handle_t *p, uint8_t *buf) {
     uint8_t cmd[8] = {0xf0, 0x26, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     int n;
 
-    n = scsi_read(fd, cmd, 8, buf, 8);
+    n = ipslr_scsi_read(p, cmd, 8, buf, 8);
     if (n != 8) {
         DPRINT("\tOnly got %d bytes\n", n);
         /* The *ist DS doesn't know to return the correct number of
@@ -1723,40 +2672,46 @@ static int read_status(FDTYPE fd, uint8_t *buf) {
     return PSLR_OK;
 }
 
-static int get_status(FDTYPE fd) {
-    DPRINT("[C]\t\t\tget_status(0x%x)\n", fd);
+static int get_status(ipslr_handle_t *p) {
+    DPRINT("[C]\t\t\tget_status(0x%x)\n", p->fd);
 
     uint8_t statusbuf[8];
+    int polls = 0;
     memset(statusbuf,0,8);
 
     while (1) {
-        CHECK(read_status(fd, statusbuf));
+        CHECK(read_status(p, statusbuf));
+        ++polls;
         DPRINT("[R]\t\t\t\t => ERROR: 0x%02X\n", statusbuf[7]);
         if (statusbuf[7] != 0x01) {
             break;
         }
-        usleep(POLL_INTERVAL);
+        ipslr_poll_wait(p, polls);
     }
+    ipslr_command_done(p, polls);
     if (statusbuf[7] != 0) {
         DPRINT("\tERROR: 0x%x\n", statusbuf[7]);
     }
     return statusbuf[7];
 }
 
-static int get_result(FDTYPE fd) {
-    DPRINT("[C]\t\t\tget_result(0x%x)\n", fd);
+static int get_result(ipslr_handle_t *p) {
+    DPRINT("[C]\t\t\tget_result(0x%x)\n", p->fd);
     uint8_t statusbuf[8];
+    int polls = 0;
     while (1) {
         //DPRINT("read out status\n");
-        CHECK(read_status(fd, statusbuf));
+        CHECK(read_status(p, statusbuf));
+        ++polls;
         //hexdump_debug(statusbuf, 8);
         if (statusbuf[6] == 0x01) {
             break;
         }
         //DPRINT("Waiting for result\n");
         //hexdump_debug(statusbuf, 8);
-        usleep(POLL_INTERVAL);
+        ipslr_poll_wait(p, polls);
     }
+    ipslr_command_done(p, polls);
     if ((statusbuf[7] & 0xff) != 0) {
         DPRINT("\tERROR: 0x%x\n", statusbuf[7]);
         return -1;
@@ -1767,13 +2722,13 @@ static int get_result(FDTYPE fd) {
     return statusbuf[0] | statusbuf[1] << 8 | statusbuf[2] << 16 | statusbuf[3] << 24;
 }
 
-static int read_result(FDTYPE fd, uint8_t *buf, uint32_t n) {
-    DPRINT("[C]\t\t\tread_result(0x%x, size=%d)\n", fd, n);
+static int read_result(ipslr_handle_t *p, uint8_t *buf, uint32_t n) {
+    DPRINT("[C]\t\t\tread_result(0x%x, size=%d)\n", p->fd, n);
     uint8_t cmd[8] = {0xf0, 0x49, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     int r;
     uint32_t i;
     set_uint32_le(n, &cmd[4]);
-    r = scsi_read(fd, cmd, sizeof (cmd), buf, n);
+    r = ipslr_scsi_read(p, cmd, sizeof (cmd), buf, n);
     if ((uint32_t)r != n) {
         return PSLR_READ_ERROR;
     }  else {
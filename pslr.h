@@ -114,18 +114,46 @@ typedef struct {
     uint32_t length;
 } pslr_buffer_segment_info;
 
-typedef void (*pslr_progress_callback_t)(uint32_t current, uint32_t total);
-
 pslr_handle_t pslr_init(char *model, char *device);
+/* Opens every camera found (at most max_num), returns their number.
+ * The handles are independent, they can be used from different threads. */
+int pslr_init_all(char *model, char *device, pslr_handle_t *handles, int max_num);
 int pslr_connect(pslr_handle_t h);
 int pslr_disconnect(pslr_handle_t h);
+/* Closes the device and frees the handle */
 int pslr_shutdown(pslr_handle_t h);
 const char *pslr_model(uint32_t id);
 
 int pslr_shutter(pslr_handle_t h);
+/* Fires the shutter of all the cameras as close to simultaneously as
+ * possible: each camera is armed from its own thread, then they are
+ * released together through a barrier. trigger_times[i] is the monotonic
+ * host time (sec) the shutter command reached handles[i], the same as
+ * pslr_get_shutter_sent_time(), 0 if that camera failed. skew is the spread of the successful trigger times. */
+int pslr_group_shutter(pslr_handle_t *handles, int num, double *trigger_times, double *skew);
+/* Two step shutter: arm fetches the status and writes the shutter
+ * argument, fire sends only the shutter command. Any other command
+ * writing arguments in between disarms the camera, then fire returns
+ * PSLR_PARAM. */
+int pslr_shutter_arm(pslr_handle_t h, bool fullpress);
+int pslr_shutter_fire(pslr_handle_t h);
+/* get_monotonic_sec() time when the last fired shutter command was sent */
+double pslr_get_shutter_sent_time(pslr_handle_t h);
 int pslr_focus(pslr_handle_t h);
 
 int pslr_get_status(pslr_handle_t h, pslr_status *sbuf);
+/* Same as pslr_get_status, changed is the PSLR_STATUS_BIT mask of the fields
+ * that changed since the previous call (PSLR_STATUS_ALL for the first one). */
+int pslr_get_status_delta(pslr_handle_t h, pslr_status *sbuf, uint64_t *changed);
+/* Reads the status and decodes only the PSLR_STATUS_BIT fields, the other
+ * fields of sbuf are left as they are. The bufmask command is only sent
+ * for PSLR_STATUS_BUFMASK. */
+int pslr_get_status_fields(pslr_handle_t h, uint64_t fields, pslr_status *sbuf);
+/* The status read within the last window_sec is reused, until a command
+ * that can change it (setters, buttons, shutter) is sent. 0 disables it,
+ * that is the default. */
+int pslr_set_status_cache(pslr_handle_t h, double window_sec);
+int pslr_get_status_cache_stats(pslr_handle_t h, pslr_status_cache_stats_t *stats);
 int pslr_get_status_buffer(pslr_handle_t h, uint8_t *st_buf);
 int pslr_get_settings_json(pslr_handle_t h, pslr_settings *ps);
 int pslr_get_settings_buffer(pslr_handle_t h, uint8_t *st_buf);
@@ -133,11 +161,33 @@ int pslr_get_settings_buffer(pslr_handle_t h, uint8_t *st_buf);
 char *pslr_get_status_info( pslr_handle_t h, pslr_status status );
 char *pslr_get_settings_info( pslr_handle_t h, pslr_settings settings );
 
+/* The image is allocated from the buffer pool of the handle,
+ * it has to be given back with pslr_buffer_pool_release. */
 int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
                     uint8_t **pdata, uint32_t *pdatalen);
 
+/* Reusable download buffers owned by the handle, in power of two size classes.
+ * They are freed by pslr_shutdown at the latest. */
+uint8_t *pslr_buffer_pool_get(pslr_handle_t h, uint32_t size);
+int pslr_buffer_pool_release(pslr_handle_t h, uint8_t *data);
+int pslr_get_buffer_pool_stats(pslr_handle_t h, pslr_buffer_pool_stats_t *stats);
+/* Streams the buffer to the sink without keeping the whole image in memory.
+ * pslr_buffer_get_size can be called from the sink. */
+int pslr_buffer_download(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+                         pslr_buffer_sink_t sink, uintptr_t user_data);
+/* Same as pslr_buffer_download, starting at the given offset of the image,
+ * e.g. to resume an interrupted download. */
+int pslr_buffer_download_from(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+                              uint32_t offset, pslr_buffer_sink_t sink, uintptr_t user_data);
+
 int pslr_set_progress_callback(pslr_handle_t h, pslr_progress_callback_t cb,
                                uintptr_t user_data);
+int pslr_set_async_download(pslr_handle_t h, bool enable);
+int pslr_set_mapped_download(pslr_handle_t h, bool enable);
+int pslr_get_download_stats(pslr_handle_t h, pslr_download_stats_t *stats);
+/* Latency statistics of the commands issued so far, one entry per
+ * command. Returns the number of entries copied to stats. */
+int pslr_get_command_stats(pslr_handle_t h, pslr_command_stats_t *stats, int max_num);
 
 int pslr_set_shutter(pslr_handle_t h, pslr_rational_t value);
 int pslr_set_aperture(pslr_handle_t h, pslr_rational_t value);
@@ -182,7 +232,12 @@ int pslr_bulb(pslr_handle_t h, bool on );
 
 int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution);
 uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size);
+uint32_t pslr_buffer_read_mapped(pslr_handle_t h, const uint8_t **data, uint32_t size);
 uint32_t pslr_fullmemory_read(pslr_handle_t h, uint8_t *buf, uint32_t offset, uint32_t size);
+/* Position of the next pslr_buffer_read in the opened buffer,
+ * the segments of the buffer are handled as one continuous image. */
+int pslr_buffer_seek(pslr_handle_t h, uint32_t offset);
+uint32_t pslr_buffer_tell(pslr_handle_t h);
 void pslr_buffer_close(pslr_handle_t h);
 uint32_t pslr_buffer_get_size(pslr_handle_t h);
 
@@ -0,0 +1,582 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+#ifdef RAD10
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "pslr_log.h"
+#include "pslr_model.h"
+#include "pslr_utils.h"
+#include "pslr_archive.h"
+
+/* pslr_status is the uint16 bufmask followed by 32 bit fields only */
+#define STATUS_WORDS (1 + (sizeof(pslr_status) - offsetof(pslr_status, current_iso)) / 4)
+#define MAX_STATUS_LEN 4096
+
+struct pslr_archive {
+    FILE *file;
+    FILE *index;
+    uint8_t header[PSLR_ARCHIVE_HEADER_SIZE];   // of the record being written
+    uint8_t status[4 * STATUS_WORDS];
+    uint64_t written;
+    uint32_t crc;
+    pslr_archive_entry_t entry;
+    uint64_t next_frame;                        // after the last frame of the archive
+};
+
+static void set_uint64_le(uint64_t v, uint8_t *buf) {
+    set_uint32_le(v & 0xffffffff, buf);
+    set_uint32_le(v >> 32, buf + 4);
+}
+
+static uint64_t get_uint64_le(uint8_t *buf) {
+    return get_uint32_le(buf) | (uint64_t)get_uint32_le(buf + 4) << 32;
+}
+
+static char *index_filename(const char *filename) {
+    char *name = malloc(strlen(filename) + 5);
+    sprintf(name, "%s.idx", filename);
+    return name;
+}
+
+static void status_to_words(pslr_status *status, uint8_t *buf) {
+    const uint8_t *fields = (const uint8_t *)status + offsetof(pslr_status, current_iso);
+    uint32_t v;
+    unsigned int i;
+
+    set_uint32_le(status->bufmask, buf);
+    for (i = 1; i < STATUS_WORDS; ++i) {
+        memcpy(&v, fields + 4 * (i - 1), 4);
+        set_uint32_le(v, buf + 4 * i);
+    }
+}
+
+static void words_to_status(uint8_t *buf, uint32_t len, pslr_status *status) {
+    uint8_t *fields = (uint8_t *)status + offsetof(pslr_status, current_iso);
+    uint32_t v;
+    unsigned int i;
+
+    memset(status, 0, sizeof(pslr_status));
+    if (len < 4) {
+        return;
+    }
+    status->bufmask = get_uint32_le(buf);
+    // an older or newer snapshot has less or more fields
+    for (i = 1; i < STATUS_WORDS && i < len / 4; ++i) {
+        v = get_uint32_le(buf + 4 * i);
+        memcpy(fields + 4 * (i - 1), &v, 4);
+    }
+}
+
+static void entry_to_bytes(const pslr_archive_entry_t *entry, uint8_t *buf) {
+    set_uint64_le(entry->frame, &buf[0]);
+    set_uint64_le(entry->offset, &buf[8]);
+    set_uint64_le(entry->length, &buf[16]);
+    set_uint32_le(entry->crc, &buf[24]);
+    set_uint32_le(entry->format, &buf[28]);
+    set_uint32_le(entry->iso, &buf[32]);
+    set_uint32_le(entry->shutter_speed.nom, &buf[36]);
+    set_uint32_le(entry->shutter_speed.denom, &buf[40]);
+    set_uint32_le(entry->aperture.nom, &buf[44]);
+    set_uint32_le(entry->aperture.denom, &buf[48]);
+}
+
+static void bytes_to_entry(uint8_t *buf, pslr_archive_entry_t *entry) {
+    entry->frame = get_uint64_le(&buf[0]);
+    entry->offset = get_uint64_le(&buf[8]);
+    entry->length = get_uint64_le(&buf[16]);
+    entry->crc = get_uint32_le(&buf[24]);
+    entry->format = get_uint32_le(&buf[28]);
+    entry->iso = get_uint32_le(&buf[32]);
+    entry->shutter_speed.nom = get_uint32_le(&buf[36]);
+    entry->shutter_speed.denom = get_uint32_le(&buf[40]);
+    entry->aperture.nom = get_uint32_le(&buf[44]);
+    entry->aperture.denom = get_uint32_le(&buf[48]);
+}
+
+static void entry_set_status(pslr_archive_entry_t *entry, pslr_status *status) {
+    entry->iso = status->current_iso;
+    entry->shutter_speed = status->current_shutter_speed;
+    entry->aperture = status->current_aperture;
+}
+
+static uint64_t file_size(FILE *f) {
+    fseeko(f, 0, SEEK_END);
+    return ftello(f);
+}
+
+static bool check_magic(FILE *f, const char *magic) {
+    char buf[8];
+    uint8_t version[4];
+    return fread(buf, 1, sizeof(buf), f) == sizeof(buf) && memcmp(buf, magic, sizeof(buf)) == 0
+           && fread(version, 1, sizeof(version), f) == sizeof(version) && get_uint32_le(version) == PSLR_ARCHIVE_VERSION;
+}
+
+static void write_magic(FILE *f, const char *magic) {
+    uint8_t version[4];
+    set_uint32_le(PSLR_ARCHIVE_VERSION, version);
+    fwrite(magic, 1, strlen(magic), f);
+    fwrite(version, 1, sizeof(version), f);
+}
+
+/* Checks the complete record at offset. Only the header, the status and
+ * the trailer are read, the data CRC is checked by the extraction.
+ * received is the data length of the trailer, less than the entry length
+ * for an incomplete download. */
+static int read_record(FILE *f, uint64_t offset, uint64_t size, pslr_archive_entry_t *entry, pslr_status *status,
+                       uint64_t *data_offset, uint64_t *record_end, uint64_t *received) {
+    uint8_t header[PSLR_ARCHIVE_HEADER_SIZE];
+    uint8_t trailer[PSLR_ARCHIVE_TRAILER_SIZE];
+    uint8_t status_buf[MAX_STATUS_LEN];
+    pslr_status record_status;
+    uint32_t status_len;
+    uint32_t crc;
+
+    if (offset + PSLR_ARCHIVE_HEADER_SIZE > size || fseeko(f, offset, SEEK_SET) != 0
+            || fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "PKFR", 4) != 0) {
+        return PSLR_READ_ERROR;
+    }
+    status_len = get_uint32_le(&header[4]);
+    if (status_len > MAX_STATUS_LEN || fread(status_buf, 1, status_len, f) != status_len) {
+        return PSLR_READ_ERROR;
+    }
+    crc = crc32c_update(0, header, 28);
+    crc = crc32c_update(crc, status_buf, status_len);
+    if (crc != get_uint32_le(&header[28])) {
+        return PSLR_READ_ERROR;
+    }
+    entry->frame = get_uint64_le(&header[8]);
+    entry->length = get_uint64_le(&header[16]);
+    entry->format = get_uint32_le(&header[24]);
+    entry->offset = offset;
+    *data_offset = offset + PSLR_ARCHIVE_HEADER_SIZE + status_len;
+    *record_end = *data_offset + entry->length + PSLR_ARCHIVE_TRAILER_SIZE;
+    if (*record_end > size || fseeko(f, *data_offset + entry->length, SEEK_SET) != 0
+            || fread(trailer, 1, sizeof(trailer), f) != sizeof(trailer)
+            || memcmp(trailer, "PKFE", 4) != 0 || get_uint64_le(&trailer[8]) > entry->length) {
+        return PSLR_READ_ERROR;
+    }
+    entry->crc = get_uint32_le(&trailer[4]);
+    if (received) {
+        *received = get_uint64_le(&trailer[8]);
+    }
+    words_to_status(status_buf, status_len, &record_status);
+    entry_set_status(entry, &record_status);
+    if (status) {
+        *status = record_status;
+    }
+    return PSLR_OK;
+}
+
+/* Offset of the first readable record after offset, size if there is none */
+static uint64_t find_record(FILE *f, uint64_t offset, uint64_t size) {
+    uint8_t buf[65536];
+    pslr_archive_entry_t entry;
+    uint64_t data_offset;
+    uint64_t record_end;
+    size_t n;
+    size_t i;
+
+    while (offset < size) {
+        if (fseeko(f, offset, SEEK_SET) != 0 || (n = fread(buf, 1, sizeof(buf), f)) < 4) {
+            break;
+        }
+        for (i = 0; i + 4 <= n; ++i) {
+            if (memcmp(&buf[i], "PKFR", 4) == 0
+                    && read_record(f, offset + i, size, &entry, NULL, &data_offset, &record_end, NULL) == PSLR_OK) {
+                return offset + i;
+            }
+        }
+        // the magic may cross the end of the block
+        offset += n - 3;
+    }
+    return size;
+}
+
+/* An interrupted write leaves a record with an intact header cut by the end of the file */
+static bool is_partial_record(FILE *f, uint64_t offset, uint64_t size) {
+    uint8_t header[PSLR_ARCHIVE_HEADER_SIZE];
+    uint8_t status_buf[MAX_STATUS_LEN];
+    uint64_t left = size - offset;
+    uint32_t status_len;
+    size_t n = left < sizeof(header) ? left : sizeof(header);
+
+    if (fseeko(f, offset, SEEK_SET) != 0 || fread(header, 1, n, f) != n || memcmp(header, "PKFR", n < 4 ? n : 4) != 0) {
+        return false;
+    }
+    if (n < sizeof(header)) {
+        return true;
+    }
+    status_len = get_uint32_le(&header[4]);
+    if (status_len > MAX_STATUS_LEN) {
+        return false;
+    }
+    if (left < PSLR_ARCHIVE_HEADER_SIZE + status_len) {
+        return true;
+    }
+    if (fread(status_buf, 1, status_len, f) != status_len
+            || crc32c_update(crc32c_update(0, header, 28), status_buf, status_len) != get_uint32_le(&header[28])) {
+        return false;
+    }
+    return PSLR_ARCHIVE_HEADER_SIZE + status_len + get_uint64_le(&header[16]) + PSLR_ARCHIVE_TRAILER_SIZE > left;
+}
+
+/* Returns the number of readable records, damaged ones are skipped. end
+ * is set after the last record, before the unreadable end of the file. */
+static int scan_archive(FILE *f, pslr_archive_entry_t **entries, uint64_t *end) {
+    pslr_archive_entry_t *e = NULL;
+    uint64_t size = file_size(f);
+    uint64_t offset = strlen(PSLR_ARCHIVE_MAGIC) + 4;
+    uint64_t data_offset;
+    uint64_t record_end;
+    int num = 0;
+    int max = 0;
+
+    fseeko(f, 0, SEEK_SET);
+    if (!check_magic(f, PSLR_ARCHIVE_MAGIC)) {
+        return -1;
+    }
+    while (offset < size) {
+        if (num == max) {
+            max = max ? 2 * max : 256;
+            e = realloc(e, max * sizeof(pslr_archive_entry_t));
+        }
+        if (read_record(f, offset, size, &e[num], NULL, &data_offset, &record_end, NULL) != PSLR_OK) {
+            uint64_t next = find_record(f, offset + 1, size);
+            if (next == size) {
+                break;
+            }
+            pslr_write_log(PSLR_WARNING, "Skipping %llu damaged bytes at %llu\n",
+                           (unsigned long long)(next - offset), (unsigned long long)offset);
+            offset = next;
+            continue;
+        }
+        offset = record_end;
+        ++num;
+    }
+    DPRINT("Scanned %d records, %llu of %llu bytes\n", num, (unsigned long long)offset, (unsigned long long)size);
+    *entries = e;
+    *end = offset;
+    return num;
+}
+
+static int write_index(const char *filename, pslr_archive_entry_t *entries, int num) {
+    uint8_t buf[PSLR_ARCHIVE_ENTRY_SIZE];
+    char *name = index_filename(filename);
+    FILE *f = fopen(name, "wb");
+    int i;
+
+    free(name);
+    if (f == NULL) {
+        return PSLR_DEVICE_ERROR;
+    }
+    write_magic(f, PSLR_ARCHIVE_INDEX_MAGIC);
+    for (i = 0; i < num; ++i) {
+        entry_to_bytes(&entries[i], buf);
+        fwrite(buf, 1, sizeof(buf), f);
+    }
+    fclose(f);
+    return PSLR_OK;
+}
+
+pslr_archive_t *pslr_archive_open(const char *filename) {
+    pslr_archive_entry_t *entries = NULL;
+    pslr_archive_t *archive;
+    uint64_t end;
+    int num = 0;
+    int i;
+    FILE *f = fopen(filename, "r+b");
+
+    if (f != NULL) {
+        num = scan_archive(f, &entries, &end);
+        if (num < 0) {
+            pslr_write_log(PSLR_ERROR, "%s is not a capture archive\n", filename);
+            fclose(f);
+            return NULL;
+        }
+        uint64_t size = file_size(f);
+        if (end < size && is_partial_record(f, end, size)) {
+            pslr_write_log(PSLR_WARNING, "Dropping the incomplete last record of %s\n", filename);
+            fflush(f);
+            if (ftruncate(fileno(f), end) != 0) {
+                pslr_write_log(PSLR_ERROR, "Cannot truncate %s\n", filename);
+            }
+        } else if (end < size) {
+            // not a cut record, kept for a manual recovery, the scans skip it
+            pslr_write_log(PSLR_WARNING, "Keeping %llu unreadable bytes at the end of %s\n",
+                           (unsigned long long)(size - end), filename);
+            end = size;
+        }
+        fseeko(f, end, SEEK_SET);
+    } else {
+        f = fopen(filename, "w+b");
+        if (f == NULL) {
+            pslr_write_log(PSLR_ERROR, "Cannot open archive %s\n", filename);
+            return NULL;
+        }
+        write_magic(f, PSLR_ARCHIVE_MAGIC);
+    }
+    // the index may be behind or ahead of the archive after a crash
+    write_index(filename, entries, num);
+
+    archive = calloc(1, sizeof(pslr_archive_t));
+    archive->file = f;
+    for (i = 0; i < num; ++i) {
+        if (entries[i].frame >= archive->next_frame) {
+            archive->next_frame = entries[i].frame + 1;
+        }
+    }
+    free(entries);
+    char *name = index_filename(filename);
+    archive->index = fopen(name, "ab");
+    free(name);
+    DPRINT("Writing archive %s, %d records\n", filename, num);
+    return archive;
+}
+
+static void archive_write_header(pslr_archive_t *archive) {
+    set_uint32_le(crc32c_update(crc32c_update(0, archive->header, 28), archive->status, sizeof(archive->status)),
+                  &archive->header[28]);
+    fwrite(archive->header, 1, sizeof(archive->header), archive->file);
+}
+
+int pslr_archive_begin(pslr_archive_t *archive, uint64_t frame, uint64_t length, uint32_t format, pslr_status *status) {
+    memset(&archive->entry, 0, sizeof(archive->entry));
+    archive->entry.frame = frame;
+    archive->entry.offset = ftello(archive->file);
+    archive->entry.length = length;
+    archive->entry.format = format;
+    entry_set_status(&archive->entry, status);
+
+    memcpy(archive->header, "PKFR", 4);
+    set_uint32_le(sizeof(archive->status), &archive->header[4]);
+    set_uint64_le(frame, &archive->header[8]);
+    set_uint64_le(length, &archive->header[16]);
+    set_uint32_le(format, &archive->header[24]);
+    status_to_words(status, archive->status);
+    archive_write_header(archive);
+    fwrite(archive->status, 1, sizeof(archive->status), archive->file);
+    archive->written = 0;
+    archive->crc = 0;
+    return ferror(archive->file) ? PSLR_DEVICE_ERROR : PSLR_OK;
+}
+
+int pslr_archive_write(pslr_archive_t *archive, const uint8_t *buf, uint32_t len) {
+    if (fwrite(buf, 1, len, archive->file) != len) {
+        return PSLR_DEVICE_ERROR;
+    }
+    archive->crc = crc32c_update(archive->crc, buf, len);
+    archive->written += len;
+    return PSLR_OK;
+}
+
+int pslr_archive_end(pslr_archive_t *archive) {
+    uint8_t trailer[PSLR_ARCHIVE_TRAILER_SIZE];
+    uint8_t buf[PSLR_ARCHIVE_ENTRY_SIZE];
+
+    if (archive->written > archive->entry.length) {
+        // more data than announced, the header has to tell the real size
+        archive->entry.length = archive->written;
+        set_uint64_le(archive->written, &archive->header[16]);
+        fseeko(archive->file, archive->entry.offset, SEEK_SET);
+        archive_write_header(archive);
+        fseeko(archive->file, 0, SEEK_END);
+    } else if (archive->written < archive->entry.length) {
+        // an incomplete download keeps its size, the trailer tells what arrived
+        uint8_t zero[4096];
+        uint64_t left = archive->entry.length - archive->written;
+        memset(zero, 0, sizeof(zero));
+        while (left > 0) {
+            size_t n = left < sizeof(zero) ? left : sizeof(zero);
+            fwrite(zero, 1, n, archive->file);
+            left -= n;
+        }
+        pslr_write_log(PSLR_WARNING, "Frame %llu is incomplete: %llu of %llu bytes\n", (unsigned long long)archive->entry.frame,
+                       (unsigned long long)archive->written, (unsigned long long)archive->entry.length);
+    }
+    memcpy(trailer, "PKFE", 4);
+    set_uint32_le(archive->crc, &trailer[4]);
+    set_uint64_le(archive->written, &trailer[8]);
+    fwrite(trailer, 1, sizeof(trailer), archive->file);
+    // the record is complete before its index entry
+    if (fflush(archive->file) != 0) {
+        return PSLR_DEVICE_ERROR;
+    }
+    archive->entry.crc = archive->crc;
+    if (archive->index) {
+        entry_to_bytes(&archive->entry, buf);
+        fwrite(buf, 1, sizeof(buf), archive->index);
+        fflush(archive->index);
+    }
+    return PSLR_OK;
+}
+
+uint64_t pslr_archive_next_frame(pslr_archive_t *archive) {
+    return archive->next_frame;
+}
+
+void pslr_archive_close(pslr_archive_t *archive) {
+    if (archive == NULL) {
+        return;
+    }
+    fclose(archive->file);
+    if (archive->index) {
+        fclose(archive->index);
+    }
+    free(archive);
+}
+
+/* Entries of the index if it matches the archive: the last entry has to
+ * be the last record */
+static int load_index_file(const char *filename, FILE *f, pslr_archive_entry_t **entries) {
+    uint8_t buf[PSLR_ARCHIVE_ENTRY_SIZE];
+    pslr_archive_entry_t *e;
+    pslr_archive_entry_t last;
+    uint64_t size = file_size(f);
+    uint64_t data_offset;
+    uint64_t record_end;
+    uint64_t index_size;
+    char *name = index_filename(filename);
+    FILE *idx = fopen(name, "rb");
+    int num;
+    int i;
+
+    free(name);
+    if (idx == NULL) {
+        return -1;
+    }
+    index_size = file_size(idx);
+    fseeko(idx, 0, SEEK_SET);
+    if (!check_magic(idx, PSLR_ARCHIVE_INDEX_MAGIC) || (index_size - 12) % PSLR_ARCHIVE_ENTRY_SIZE != 0) {
+        fclose(idx);
+        return -1;
+    }
+    num = (index_size - 12) / PSLR_ARCHIVE_ENTRY_SIZE;
+    e = malloc((num > 0 ? num : 1) * sizeof(pslr_archive_entry_t));
+    for (i = 0; i < num; ++i) {
+        if (fread(buf, 1, sizeof(buf), idx) != sizeof(buf)) {
+            break;
+        }
+        bytes_to_entry(buf, &e[i]);
+    }
+    fclose(idx);
+    if (i < num
+            || (num == 0 && size != strlen(PSLR_ARCHIVE_MAGIC) + 4)
+            || (num > 0 && (read_record(f, e[num - 1].offset, size, &last, NULL, &data_offset, &record_end, NULL) != PSLR_OK
+                            || record_end != size || last.frame != e[num - 1].frame))) {
+        free(e);
+        return -1;
+    }
+    *entries = e;
+    return num;
+}
+
+int pslr_archive_load_index(const char *filename, pslr_archive_entry_t **entries) {
+    uint64_t end;
+    int num;
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL) {
+        pslr_write_log(PSLR_ERROR, "Cannot open archive %s\n", filename);
+        return -1;
+    }
+    num = load_index_file(filename, f, entries);
+    if (num < 0) {
+        DPRINT("Index of %s does not match, scanning the archive\n", filename);
+        num = scan_archive(f, entries, &end);
+    }
+    fclose(f);
+    return num;
+}
+
+int pslr_archive_reindex(const char *filename) {
+    pslr_archive_entry_t *entries = NULL;
+    uint64_t end;
+    int num;
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL) {
+        pslr_write_log(PSLR_ERROR, "Cannot open archive %s\n", filename);
+        return -1;
+    }
+    num = scan_archive(f, &entries, &end);
+    fclose(f);
+    if (num >= 0 && write_index(filename, entries, num) != PSLR_OK) {
+        num = -1;
+    }
+    free(entries);
+    return num;
+}
+
+int pslr_archive_extract(const char *filename, const pslr_archive_entry_t *entry, int fd, pslr_status *status) {
+    uint8_t buf[65536];
+    pslr_archive_entry_t record;
+    uint64_t data_offset;
+    uint64_t record_end;
+    uint64_t received;
+    uint64_t left;
+    uint32_t crc = 0;
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL) {
+        return PSLR_READ_ERROR;
+    }
+    if (read_record(f, entry->offset, file_size(f), &record, status, &data_offset, &record_end, &received) != PSLR_OK) {
+        fclose(f);
+        return PSLR_READ_ERROR;
+    }
+    fseeko(f, data_offset, SEEK_SET);
+    for (left = received; left > 0; ) {
+        size_t n = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), f);
+        if (n == 0 || (fd >= 0 && write(fd, buf, n) != (ssize_t)n)) {
+            fclose(f);
+            return PSLR_READ_ERROR;
+        }
+        crc = crc32c_update(crc, buf, n);
+        left -= n;
+    }
+    fclose(f);
+    if (crc != record.crc) {
+        pslr_write_log(PSLR_ERROR, "CRC mismatch in frame %llu\n", (unsigned long long)record.frame);
+        return PSLR_READ_ERROR;
+    }
+    if (received < record.length) {
+        pslr_write_log(PSLR_ERROR, "Frame %llu is incomplete: %llu of %llu bytes\n", (unsigned long long)record.frame,
+                       (unsigned long long)received, (unsigned long long)record.length);
+        return PSLR_READ_ERROR;
+    }
+    return PSLR_OK;
+}
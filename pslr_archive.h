@@ -0,0 +1,107 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PSLR_ARCHIVE_H
+#define PSLR_ARCHIVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "pslr_model.h"
+
+/* Append-only capture archive: every downloaded buffer is streamed into
+ * one file, with a separate index for fast listing.
+ *
+ * Archive: "PKTARCHV" magic, uint32 format version, then records (all
+ * values little-endian):
+ *   32 byte header
+ *     "PKFR"
+ *     uint32 status_len   bytes of the status snapshot following the header
+ *     uint64 frame        frame number
+ *     uint64 length       bytes of data
+ *     uint32 format       user_file_format of the data
+ *     uint32 header_crc   CRC32C of the first 28 header bytes and the status
+ *   status snapshot, the pslr_status fields as uint32 values
+ *   data
+ *   16 byte trailer
+ *     "PKFE"
+ *     uint32 data_crc     CRC32C of the received data
+ *     uint64 length       bytes received, less than in the header for an
+ *                         incomplete download, the rest of the data is zero
+ *
+ * A record only counts once its trailer is written, so the archive can
+ * always be recovered by scanning it from the start. A damaged record is
+ * skipped up to the next readable "PKFR" header, only a record cut by
+ * the end of the file is dropped when the archive is opened again. The index
+ * (ARCHIVE.idx) is "PKTINDEX", uint32 version, then one 52 byte entry
+ * per record (see pslr_archive_entry_t). It is rebuilt by scanning if it
+ * does not match the archive. */
+
+#define PSLR_ARCHIVE_MAGIC "PKTARCHV"
+#define PSLR_ARCHIVE_INDEX_MAGIC "PKTINDEX"
+#define PSLR_ARCHIVE_VERSION 1
+#define PSLR_ARCHIVE_HEADER_SIZE 32
+#define PSLR_ARCHIVE_TRAILER_SIZE 16
+#define PSLR_ARCHIVE_ENTRY_SIZE 52
+
+typedef struct {
+    uint64_t frame;
+    uint64_t offset;                 // of the record header in the archive
+    uint64_t length;                 // of the data
+    uint32_t crc;                    // CRC32C of the data
+    uint32_t format;                 // user_file_format
+    uint32_t iso;                    // exposure from the status snapshot
+    pslr_rational_t shutter_speed;
+    pslr_rational_t aperture;
+} pslr_archive_entry_t;
+
+typedef struct pslr_archive pslr_archive_t;
+
+/* Creates the archive or opens it for appending. A partial last record
+ * of an interrupted capture is cut off and the index is rewritten. */
+pslr_archive_t *pslr_archive_open(const char *filename);
+/* A record is written by one begin, any number of write and one end call.
+ * length is the expected data size, if less data arrived end keeps it and
+ * marks the record incomplete, extract and verify report it. */
+int pslr_archive_begin(pslr_archive_t *archive, uint64_t frame, uint64_t length, uint32_t format, pslr_status *status);
+int pslr_archive_write(pslr_archive_t *archive, const uint8_t *buf, uint32_t len);
+int pslr_archive_end(pslr_archive_t *archive);
+/* Frame number after the last one of the archive, the appended frames continue from it */
+uint64_t pslr_archive_next_frame(pslr_archive_t *archive);
+void pslr_archive_close(pslr_archive_t *archive);
+
+/* Reads the entries from the index, or by scanning the archive if the
+ * index is missing or does not match. Returns the number of entries or
+ * -1 on error, the entries are freed by the caller. */
+int pslr_archive_load_index(const char *filename, pslr_archive_entry_t **entries);
+/* Rebuilds ARCHIVE.idx by scanning, returns the number of entries or -1 */
+int pslr_archive_reindex(const char *filename);
+/* Copies the data of the record into fd and checks its CRC, fd -1 only
+ * checks the CRC. status is filled from the snapshot if not NULL. */
+int pslr_archive_extract(const char *filename, const pslr_archive_entry_t *entry, int fd, pslr_status *status);
+
+#endif
@@ -30,21 +30,27 @@
 
 #include <stdio.h>
 
+/* Sorted by (id1, id2), generated from exiftool_pentax_lens.txt */
 static const struct {
     uint32_t id1;
     uint32_t id2;
     const char *name;
 } lens_id[] = {
-#include "exiftool_pentax_lens.txt"
+#include "pslr_lens_table.h"
 };
 
 const char *pslr_get_lens_name( uint32_t id1, uint32_t id2) {
-    int lens_num = sizeof(lens_id)/sizeof(lens_id[0]);
-    int i;
-    for ( i=0; i<lens_num; ++i ) {
-        if ( lens_id[i].id1 == id1 &&
-                lens_id[i].id2 == id2 ) {
-            return lens_id[i].name;
+    int low = 0;
+    int high = sizeof(lens_id)/sizeof(lens_id[0]) - 1;
+    while ( low <= high ) {
+        int middle = (low + high) / 2;
+        if ( lens_id[middle].id1 == id1 && lens_id[middle].id2 == id2 ) {
+            return lens_id[middle].name;
+        } else if ( lens_id[middle].id1 < id1 ||
+                    (lens_id[middle].id1 == id1 && lens_id[middle].id2 < id2) ) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
         }
     }
     return "";
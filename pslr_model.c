@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <fcntl.h>
 #ifndef RAD10
 #include <unistd.h>
@@ -49,29 +50,17 @@
 #include "pslr_model.h"
 #include "pslr_log.h"
 #include "pslr.h"
+#include "pslr_settings_table.h"
 
-static uint8_t lastbuf[MAX_STATUS_BUF_SIZE];
-static int first = 1;
-static char *jsontext=NULL;
-static int jsonsize;
 
-static int dir_exists(char *dir) {
-    int res = 0;
-    struct stat info;
-
-    if ( (stat(dir, &info) == 0) && (info.st_mode & S_IFDIR) ) {
-        res = 1;
-    }
-    return res;
-}
-
-static void ipslr_status_diff(uint8_t *buf) {
+static void ipslr_status_diff(ipslr_handle_t *p, uint8_t *buf) {
+    uint8_t *lastbuf = p->status_diff_buffer;
     int n;
     int diffs;
-    if (first) {
+    if (!p->status_diff_valid) {
         hexdump(buf, MAX_STATUS_BUF_SIZE);
         memcpy(lastbuf, buf, MAX_STATUS_BUF_SIZE);
-        first = 0;
+        p->status_diff_valid = true;
     }
 
     diffs = 0;
@@ -100,33 +89,12 @@ uint32_t get_uint32_be(uint8_t *buf) {
     return res;
 }
 
-static
-int32_t get_int32_be(uint8_t *buf) {
-    int32_t res;
-    res = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
-    return res;
-}
-
-static
-uint16_t get_uint16_le(const uint8_t *buf) {
-    uint16_t res;
-    res = buf[1] << 8 | buf[0];
-    return res;
-}
-
 uint32_t get_uint32_le(uint8_t *buf) {
     uint32_t res;
     res = buf[3] << 24 | buf[2] << 16 | buf[1] << 8 | buf[0];
     return res;
 }
 
-static
-int32_t get_int32_le(uint8_t *buf) {
-    int32_t res;
-    res = buf[3] << 24 | buf[2] << 16 | buf[1] << 8 | buf[0];
-    return res;
-}
-
 void set_uint32_le(uint32_t v, uint8_t *buf) {
     buf[0] = v;
     buf[1] = v >> 8;
@@ -178,8 +146,7 @@ void hexdump_debug(uint8_t *buf, uint32_t bufLen) {
 
 // based on http://stackoverflow.com/a/657202/21348
 
-const char* int_to_binary( uint16_t x ) {
-    static char b[sizeof(uint16_t)*8+1] = {0};
+char* int_to_binary( uint16_t x, char *b ) {
     int y;
     long long z;
     for (z=(1LL<<sizeof(uint16_t)*8)-1,y=0; z>0; z>>=1,y++) {
@@ -220,619 +187,718 @@ int pslr_get_hw_jpeg_quality( ipslr_model_info_t *model, int user_jpeg_stars) {
 }
 
 
-static
-void ipslr_status_parse_k10d(ipslr_handle_t  *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-    memset(status, 0, sizeof (*status));
-    status->bufmask = get_uint16_be(&buf[0x16]);
-    status->user_mode_flag = get_uint32_be(&buf[0x1c]);
-    status->set_shutter_speed.nom = get_uint32_be(&buf[0x2c]);
-    status->set_shutter_speed.denom = get_uint32_be(&buf[0x30]);
-    status->set_aperture.nom = get_uint32_be(&buf[0x34]);
-    status->set_aperture.denom = get_uint32_be(&buf[0x38]);
-    status->ec.nom = get_uint32_be(&buf[0x3c]);
-    status->ec.denom = get_uint32_be(&buf[0x40]);
-    status->fixed_iso = get_uint32_be(&buf[0x60]);
-    status->image_format = get_uint32_be(&buf[0x78]);
-    status->jpeg_resolution = get_uint32_be(&buf[0x7c]);
-    status->jpeg_quality = _get_user_jpeg_stars( p->model, get_uint32_be(&buf[0x80]));
-    status->raw_format = get_uint32_be(&buf[0x84]);
-    status->jpeg_image_tone = get_uint32_be(&buf[0x88]);
-    status->jpeg_saturation = get_uint32_be(&buf[0x8c]);
-    status->jpeg_sharpness = get_uint32_be(&buf[0x90]);
-    status->jpeg_contrast = get_uint32_be(&buf[0x94]);
-    status->custom_ev_steps = get_uint32_be(&buf[0x9c]);
-    status->custom_sensitivity_steps = get_uint32_be(&buf[0xa0]);
-    status->af_point_select = get_uint32_be(&buf[0xbc]);
-    status->selected_af_point = get_uint32_be(&buf[0xc0]);
-    status->exposure_mode = get_uint32_be(&buf[0xac]);
-    status->current_shutter_speed.nom = get_uint32_be(&buf[0xf4]);
-    status->current_shutter_speed.denom = get_uint32_be(&buf[0xf8]);
-    status->current_aperture.nom = get_uint32_be(&buf[0xfc]);
-    status->current_aperture.denom = get_uint32_be(&buf[0x100]);
-    status->current_iso = get_uint32_be(&buf[0x11c]);
-    status->light_meter_flags = get_uint32_be(&buf[0x124]);
-    status->lens_min_aperture.nom = get_uint32_be(&buf[0x12c]);
-    status->lens_min_aperture.denom = get_uint32_be(&buf[0x130]);
-    status->lens_max_aperture.nom = get_uint32_be(&buf[0x134]);
-    status->lens_max_aperture.denom = get_uint32_be(&buf[0x138]);
-    status->focused_af_point = get_uint32_be(&buf[0x150]);
-    status->zoom.nom = get_uint32_be(&buf[0x16c]);
-    status->zoom.denom = get_uint32_be(&buf[0x170]);
-    status->focus = get_int32_be(&buf[0x174]);
-}
-
-static
-void ipslr_status_parse_k20d(ipslr_handle_t *p, pslr_status *status) {
+/* The pslr_status fields, STATUS(pslr_status_field_t name, pslr_status member) */
+#define STATUS_FIELDS(STATUS) \
+    STATUS(BUFMASK, bufmask) \
+    STATUS(CURRENT_ISO, current_iso) \
+    STATUS(CURRENT_SHUTTER_SPEED, current_shutter_speed) \
+    STATUS(CURRENT_APERTURE, current_aperture) \
+    STATUS(LENS_MAX_APERTURE, lens_max_aperture) \
+    STATUS(LENS_MIN_APERTURE, lens_min_aperture) \
+    STATUS(SET_SHUTTER_SPEED, set_shutter_speed) \
+    STATUS(SET_APERTURE, set_aperture) \
+    STATUS(MAX_SHUTTER_SPEED, max_shutter_speed) \
+    STATUS(AUTO_BRACKET_MODE, auto_bracket_mode) \
+    STATUS(AUTO_BRACKET_EV, auto_bracket_ev) \
+    STATUS(AUTO_BRACKET_PICTURE_COUNT, auto_bracket_picture_count) \
+    STATUS(AUTO_BRACKET_PICTURE_COUNTER, auto_bracket_picture_counter) \
+    STATUS(FIXED_ISO, fixed_iso) \
+    STATUS(JPEG_RESOLUTION, jpeg_resolution) \
+    STATUS(JPEG_SATURATION, jpeg_saturation) \
+    STATUS(JPEG_QUALITY, jpeg_quality) \
+    STATUS(JPEG_CONTRAST, jpeg_contrast) \
+    STATUS(JPEG_SHARPNESS, jpeg_sharpness) \
+    STATUS(JPEG_IMAGE_TONE, jpeg_image_tone) \
+    STATUS(JPEG_HUE, jpeg_hue) \
+    STATUS(ZOOM, zoom) \
+    STATUS(FOCUS, focus) \
+    STATUS(IMAGE_FORMAT, image_format) \
+    STATUS(RAW_FORMAT, raw_format) \
+    STATUS(LIGHT_METER_FLAGS, light_meter_flags) \
+    STATUS(EC, ec) \
+    STATUS(CUSTOM_EV_STEPS, custom_ev_steps) \
+    STATUS(CUSTOM_SENSITIVITY_STEPS, custom_sensitivity_steps) \
+    STATUS(EXPOSURE_MODE, exposure_mode) \
+    STATUS(SCENE_MODE, scene_mode) \
+    STATUS(USER_MODE_FLAG, user_mode_flag) \
+    STATUS(AE_METERING_MODE, ae_metering_mode) \
+    STATUS(AF_MODE, af_mode) \
+    STATUS(AF_POINT_SELECT, af_point_select) \
+    STATUS(SELECTED_AF_POINT, selected_af_point) \
+    STATUS(FOCUSED_AF_POINT, focused_af_point) \
+    STATUS(AUTO_ISO_MIN, auto_iso_min) \
+    STATUS(AUTO_ISO_MAX, auto_iso_max) \
+    STATUS(DRIVE_MODE, drive_mode) \
+    STATUS(SHAKE_REDUCTION, shake_reduction) \
+    STATUS(WHITE_BALANCE_MODE, white_balance_mode) \
+    STATUS(WHITE_BALANCE_ADJUST_MG, white_balance_adjust_mg) \
+    STATUS(WHITE_BALANCE_ADJUST_BA, white_balance_adjust_ba) \
+    STATUS(FLASH_MODE, flash_mode) \
+    STATUS(FLASH_EXPOSURE_COMPENSATION, flash_exposure_compensation) \
+    STATUS(MANUAL_MODE_EV, manual_mode_ev) \
+    STATUS(COLOR_SPACE, color_space) \
+    STATUS(LENS_ID1, lens_id1) \
+    STATUS(LENS_ID2, lens_id2) \
+    STATUS(BATTERY_1, battery_1) \
+    STATUS(BATTERY_2, battery_2) \
+    STATUS(BATTERY_3, battery_3) \
+    STATUS(BATTERY_4, battery_4)
+
+#define STATUS_FIELD(name, f) [PSLR_STATUS_##name] = { offsetof(pslr_status, f), sizeof(((pslr_status *) 0)->f) },
+
+/* Location of the pslr_status fields, indexed by pslr_status_field_t */
+static const struct {
+    size_t offset;
+    size_t size;
+} status_fields[PSLR_STATUS_FIELD_MAX] = {
+    STATUS_FIELDS(STATUS_FIELD)
+};
 
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-    memset(status, 0, sizeof (*status));
-    status->bufmask = get_uint16_be( &buf[0x16]);
-    status->user_mode_flag = get_uint32_be(&buf[0x1c]);
-    status->set_shutter_speed.nom = get_uint32_be(&buf[0x2c]);
-    status->set_shutter_speed.denom = get_uint32_be(&buf[0x30]);
-    status->set_aperture.nom = get_uint32_be(&buf[0x34]);
-    status->set_aperture.denom = get_uint32_be(&buf[0x38]);
-    status->ec.nom = get_uint32_be(&buf[0x3c]);
-    status->ec.denom = get_uint32_be(&buf[0x40]);
-    status->fixed_iso = get_uint32_be(&buf[0x60]);
-    status->image_format = get_uint32_be(&buf[0x78]);
-    status->jpeg_resolution = get_uint32_be(&buf[0x7c]);
-    status->jpeg_quality = _get_user_jpeg_stars( p->model, get_uint32_be(&buf[0x80]));
-    status->raw_format = get_uint32_be(&buf[0x84]);
-    status->jpeg_image_tone = get_uint32_be(&buf[0x88]);
-    status->jpeg_saturation = get_uint32_be(&buf[0x8c]); // commands do now work for it?
-    status->jpeg_sharpness = get_uint32_be(&buf[0x90]); // commands do now work for it?
-    status->jpeg_contrast = get_uint32_be(&buf[0x94]); // commands do now work for it?
-    status->custom_ev_steps = get_uint32_be(&buf[0x9c]);
-    status->custom_sensitivity_steps = get_uint32_be(&buf[0xa0]);
-    status->ae_metering_mode = get_uint32_be(&buf[0xb4]); // same as c4
-    status->af_mode = get_uint32_be(&buf[0xb8]);
-    status->af_point_select = get_uint32_be(&buf[0xbc]); // not sure
-    status->selected_af_point = get_uint32_be(&buf[0xc0]);
-    status->exposure_mode = get_uint32_be(&buf[0xac]);
-    status->current_shutter_speed.nom = get_uint32_be(&buf[0x108]);
-    status->current_shutter_speed.denom = get_uint32_be(&buf[0x10C]);
-    status->current_aperture.nom = get_uint32_be(&buf[0x110]);
-    status->current_aperture.denom = get_uint32_be(&buf[0x114]);
-    status->current_iso = get_uint32_be(&buf[0x130]);
-    status->light_meter_flags = get_uint32_be(&buf[0x138]);
-    status->lens_min_aperture.nom = get_uint32_be(&buf[0x140]);
-    status->lens_min_aperture.denom = get_uint32_be(&buf[0x144]);
-    status->lens_max_aperture.nom = get_uint32_be(&buf[0x148]);
-    status->lens_max_aperture.denom = get_uint32_be(&buf[0x14B]);
-    status->focused_af_point = get_uint32_be(&buf[0x160]); // unsure about it, a lot is changing when the camera focuses
-    status->zoom.nom = get_uint32_be(&buf[0x180]);
-    status->zoom.denom = get_uint32_be(&buf[0x184]);
-    status->focus = get_int32_be(&buf[0x188]); // current focus ring position?
-    // 0x158 current ev?
-    // 0x160 and 0x164 change when AF
+/* Removes the lowest bit of the nonzero mask, returns its index */
+static int status_next_field( uint64_t *fields ) {
+#ifdef __GNUC__
+    int i = __builtin_ctzll( *fields );
+#else
+    int i = 0;
+    while ( !(*fields & PSLR_STATUS_BIT(i)) ) {
+        ++i;
+    }
+#endif
+    *fields &= *fields - 1;
+    return i;
 }
 
-static
-void ipslr_status_parse_istds(ipslr_handle_t *p, pslr_status *status) {
+static void ipslr_status_clear_fields( pslr_status *status, uint64_t fields );
 
-    uint8_t *buf = p->status_buffer;
-    /* *ist DS status block */
-    memset(status, 0, sizeof (*status));
-    status->bufmask = get_uint16_be(&buf[0x12]);
-    status->set_shutter_speed.nom = get_uint32_be(&buf[0x80]);
-    status->set_shutter_speed.denom = get_uint32_be(&buf[0x84]);
-    status->set_aperture.nom = get_uint32_be(&buf[0x88]);
-    status->set_aperture.denom = get_uint32_be(&buf[0x8c]);
-    status->lens_min_aperture.nom = get_uint32_be(&buf[0xb8]);
-    status->lens_min_aperture.denom = get_uint32_be(&buf[0xbc]);
-    status->lens_max_aperture.nom = get_uint32_be(&buf[0xc0]);
-    status->lens_max_aperture.denom = get_uint32_be(&buf[0xc4]);
-
-    // no DNG support so raw format is PEF
-    status->raw_format = PSLR_RAW_FORMAT_PEF;
-}
+/* Status buffer layouts, FIELD(pslr_status field, buffer offset, type) where type is
+ *   UINT16, UINT32, INT32: value in the byte order of the camera
+ *   LENS_ID: low nibble of a 32 bit value
+ *   JPEG_STARS: 32 bit hardware jpeg quality, converted to stars
+ *   CONST: not in the buffer, the offset is the value itself
+ * Later layouts of a parser override the fields of the earlier ones. */
 
 // some of the cameras share most of the status fields
-// this method is used for K-x, K-7, K-5, K-r
+// this layout is used for K-x, K-7, K-5, K-r
 //
 // some cameras also have this data block, but it's shifted a bit
-static
-void ipslr_status_parse_common(ipslr_handle_t *p, pslr_status *status, int shift) {
+#define STATUS_LAYOUT_COMMON(FIELD) \
+    /* 0x0C: 0x85 0xA5 */ \
+    /* 0x0F: beginning 0 sometime changes to 1 */ \
+    /* 0x14: LCD panel 2: turned off 3: on? */ \
+    FIELD(bufmask, 0x1E, UINT16) \
+    FIELD(user_mode_flag, 0x24, UINT32) \
+    FIELD(flash_mode, 0x28, UINT32) \
+    FIELD(flash_exposure_compensation, 0x2C, INT32) \
+    FIELD(set_shutter_speed.nom, 0x34, UINT32) \
+    FIELD(set_shutter_speed.denom, 0x38, UINT32) \
+    FIELD(set_aperture.nom, 0x3C, UINT32) \
+    FIELD(set_aperture.denom, 0x40, UINT32) \
+    FIELD(ec.nom, 0x44, UINT32) \
+    FIELD(ec.denom, 0x48, UINT32) \
+    FIELD(auto_bracket_mode, 0x4C, UINT32) \
+    FIELD(auto_bracket_ev.nom, 0x50, UINT32) \
+    FIELD(auto_bracket_ev.denom, 0x54, UINT32) \
+    FIELD(auto_bracket_picture_count, 0x58, UINT32) \
+    FIELD(drive_mode, 0x5C, UINT32) \
+    FIELD(fixed_iso, 0x68, UINT32) \
+    FIELD(auto_iso_min, 0x6C, UINT32) \
+    FIELD(auto_iso_max, 0x70, UINT32) \
+    FIELD(white_balance_mode, 0x74, UINT32) \
+    FIELD(white_balance_adjust_mg, 0x78, UINT32) /* 0: M7 7: 0 14: G7 */ \
+    FIELD(white_balance_adjust_ba, 0x7C, UINT32) /* 0: B7 7: 0 14: A7 */ \
+    FIELD(image_format, 0x80, UINT32) \
+    FIELD(jpeg_resolution, 0x84, UINT32) \
+    FIELD(jpeg_quality, 0x88, JPEG_STARS) \
+    FIELD(raw_format, 0x8C, UINT32) \
+    FIELD(jpeg_image_tone, 0x90, UINT32) \
+    FIELD(jpeg_saturation, 0x94, UINT32) \
+    FIELD(jpeg_sharpness, 0x98, UINT32) \
+    FIELD(jpeg_contrast, 0x9C, UINT32) \
+    FIELD(color_space, 0xA0, UINT32) \
+    FIELD(custom_ev_steps, 0xA4, UINT32) \
+    FIELD(custom_sensitivity_steps, 0xa8, UINT32) \
+    FIELD(exposure_mode, 0xb4, UINT32) \
+    FIELD(scene_mode, 0xb8, UINT32) \
+    FIELD(ae_metering_mode, 0xbc, UINT32) /* same as cc */ \
+    FIELD(af_mode, 0xC0, UINT32) \
+    FIELD(af_point_select, 0xc4, UINT32) \
+    FIELD(selected_af_point, 0xc8, UINT32) \
+    FIELD(shake_reduction, 0xE0, UINT32) \
+    FIELD(auto_bracket_picture_counter, 0xE4, UINT32) \
+    FIELD(jpeg_hue, 0xFC, UINT32) \
+    FIELD(current_shutter_speed.nom, 0x10C, UINT32) \
+    FIELD(current_shutter_speed.denom, 0x110, UINT32) \
+    FIELD(current_aperture.nom, 0x114, UINT32) \
+    FIELD(current_aperture.denom, 0x118, UINT32) \
+    FIELD(max_shutter_speed.nom, 0x12C, UINT32) \
+    FIELD(max_shutter_speed.denom, 0x130, UINT32) \
+    FIELD(current_iso, 0x134, UINT32) \
+    FIELD(light_meter_flags, 0x13C, UINT32) \
+    FIELD(lens_min_aperture.nom, 0x144, UINT32) \
+    FIELD(lens_min_aperture.denom, 0x148, UINT32) \
+    FIELD(lens_max_aperture.nom, 0x14C, UINT32) \
+    FIELD(lens_max_aperture.denom, 0x150, UINT32) \
+    FIELD(manual_mode_ev, 0x15C, INT32) \
+    FIELD(focused_af_point, 0x168, UINT32) /* d, unsure about it, a lot is changing when the camera focuses */ \
+    /* probably voltage*100 */ \
+    /* battery_1 > battery2 ( noload vs load voltage?) */ \
+    FIELD(battery_1, 0x170, UINT32) \
+    FIELD(battery_2, 0x174, UINT32) \
+    FIELD(battery_3, 0x180, UINT32) \
+    FIELD(battery_4, 0x184, UINT32)
+
+#define STATUS_LAYOUT_K10D(FIELD) \
+    FIELD(bufmask, 0x16, UINT16) \
+    FIELD(user_mode_flag, 0x1c, UINT32) \
+    FIELD(set_shutter_speed.nom, 0x2c, UINT32) \
+    FIELD(set_shutter_speed.denom, 0x30, UINT32) \
+    FIELD(set_aperture.nom, 0x34, UINT32) \
+    FIELD(set_aperture.denom, 0x38, UINT32) \
+    FIELD(ec.nom, 0x3c, UINT32) \
+    FIELD(ec.denom, 0x40, UINT32) \
+    FIELD(fixed_iso, 0x60, UINT32) \
+    FIELD(image_format, 0x78, UINT32) \
+    FIELD(jpeg_resolution, 0x7c, UINT32) \
+    FIELD(jpeg_quality, 0x80, JPEG_STARS) \
+    FIELD(raw_format, 0x84, UINT32) \
+    FIELD(jpeg_image_tone, 0x88, UINT32) \
+    FIELD(jpeg_saturation, 0x8c, UINT32) \
+    FIELD(jpeg_sharpness, 0x90, UINT32) \
+    FIELD(jpeg_contrast, 0x94, UINT32) \
+    FIELD(custom_ev_steps, 0x9c, UINT32) \
+    FIELD(custom_sensitivity_steps, 0xa0, UINT32) \
+    FIELD(af_point_select, 0xbc, UINT32) \
+    FIELD(selected_af_point, 0xc0, UINT32) \
+    FIELD(exposure_mode, 0xac, UINT32) \
+    FIELD(current_shutter_speed.nom, 0xf4, UINT32) \
+    FIELD(current_shutter_speed.denom, 0xf8, UINT32) \
+    FIELD(current_aperture.nom, 0xfc, UINT32) \
+    FIELD(current_aperture.denom, 0x100, UINT32) \
+    FIELD(current_iso, 0x11c, UINT32) \
+    FIELD(light_meter_flags, 0x124, UINT32) \
+    FIELD(lens_min_aperture.nom, 0x12c, UINT32) \
+    FIELD(lens_min_aperture.denom, 0x130, UINT32) \
+    FIELD(lens_max_aperture.nom, 0x134, UINT32) \
+    FIELD(lens_max_aperture.denom, 0x138, UINT32) \
+    FIELD(focused_af_point, 0x150, UINT32) \
+    FIELD(zoom.nom, 0x16c, UINT32) \
+    FIELD(zoom.denom, 0x170, UINT32) \
+    FIELD(focus, 0x174, INT32)
+
+#define STATUS_LAYOUT_K20D(FIELD) \
+    FIELD(bufmask, 0x16, UINT16) \
+    FIELD(user_mode_flag, 0x1c, UINT32) \
+    FIELD(set_shutter_speed.nom, 0x2c, UINT32) \
+    FIELD(set_shutter_speed.denom, 0x30, UINT32) \
+    FIELD(set_aperture.nom, 0x34, UINT32) \
+    FIELD(set_aperture.denom, 0x38, UINT32) \
+    FIELD(ec.nom, 0x3c, UINT32) \
+    FIELD(ec.denom, 0x40, UINT32) \
+    FIELD(fixed_iso, 0x60, UINT32) \
+    FIELD(image_format, 0x78, UINT32) \
+    FIELD(jpeg_resolution, 0x7c, UINT32) \
+    FIELD(jpeg_quality, 0x80, JPEG_STARS) \
+    FIELD(raw_format, 0x84, UINT32) \
+    FIELD(jpeg_image_tone, 0x88, UINT32) \
+    FIELD(jpeg_saturation, 0x8c, UINT32) /* commands do now work for it? */ \
+    FIELD(jpeg_sharpness, 0x90, UINT32) /* commands do now work for it? */ \
+    FIELD(jpeg_contrast, 0x94, UINT32) /* commands do now work for it? */ \
+    FIELD(custom_ev_steps, 0x9c, UINT32) \
+    FIELD(custom_sensitivity_steps, 0xa0, UINT32) \
+    FIELD(ae_metering_mode, 0xb4, UINT32) /* same as c4 */ \
+    FIELD(af_mode, 0xb8, UINT32) \
+    FIELD(af_point_select, 0xbc, UINT32) /* not sure */ \
+    FIELD(selected_af_point, 0xc0, UINT32) \
+    FIELD(exposure_mode, 0xac, UINT32) \
+    FIELD(current_shutter_speed.nom, 0x108, UINT32) \
+    FIELD(current_shutter_speed.denom, 0x10C, UINT32) \
+    FIELD(current_aperture.nom, 0x110, UINT32) \
+    FIELD(current_aperture.denom, 0x114, UINT32) \
+    FIELD(current_iso, 0x130, UINT32) \
+    FIELD(light_meter_flags, 0x138, UINT32) \
+    FIELD(lens_min_aperture.nom, 0x140, UINT32) \
+    FIELD(lens_min_aperture.denom, 0x144, UINT32) \
+    FIELD(lens_max_aperture.nom, 0x148, UINT32) \
+    FIELD(lens_max_aperture.denom, 0x14B, UINT32) \
+    FIELD(focused_af_point, 0x160, UINT32) /* unsure about it, a lot is changing when the camera focuses */ \
+    FIELD(zoom.nom, 0x180, UINT32) \
+    FIELD(zoom.denom, 0x184, UINT32) \
+    FIELD(focus, 0x188, INT32) /* current focus ring position? */ \
+    /* 0x158 current ev? */ \
+    /* 0x160 and 0x164 change when AF */
+
+/* *ist DS status block */
+#define STATUS_LAYOUT_ISTDS(FIELD) \
+    FIELD(bufmask, 0x12, UINT16) \
+    FIELD(set_shutter_speed.nom, 0x80, UINT32) \
+    FIELD(set_shutter_speed.denom, 0x84, UINT32) \
+    FIELD(set_aperture.nom, 0x88, UINT32) \
+    FIELD(set_aperture.denom, 0x8c, UINT32) \
+    FIELD(lens_min_aperture.nom, 0xb8, UINT32) \
+    FIELD(lens_min_aperture.denom, 0xbc, UINT32) \
+    FIELD(lens_max_aperture.nom, 0xc0, UINT32) \
+    FIELD(lens_max_aperture.denom, 0xc4, UINT32) \
+    /* no DNG support so raw format is PEF */ \
+    FIELD(raw_format, PSLR_RAW_FORMAT_PEF, CONST)
+
+#define STATUS_LAYOUT_K200D(FIELD) \
+    FIELD(bufmask, 0x16, UINT16) \
+    FIELD(user_mode_flag, 0x1c, UINT32) \
+    FIELD(set_shutter_speed.nom, 0x2c, UINT32) \
+    FIELD(set_shutter_speed.denom, 0x30, UINT32) \
+    FIELD(current_aperture.nom, 0x034, UINT32) \
+    FIELD(current_aperture.denom, 0x038, UINT32) \
+    FIELD(set_aperture.nom, 0x34, UINT32) \
+    FIELD(set_aperture.denom, 0x38, UINT32) \
+    FIELD(ec.nom, 0x3c, UINT32) \
+    FIELD(ec.denom, 0x40, UINT32) \
+    FIELD(current_iso, 0x060, UINT32) \
+    FIELD(fixed_iso, 0x60, UINT32) \
+    FIELD(auto_iso_min, 0x64, UINT32) \
+    FIELD(auto_iso_max, 0x68, UINT32) \
+    FIELD(image_format, 0x78, UINT32) \
+    FIELD(jpeg_resolution, 0x7c, UINT32) \
+    FIELD(jpeg_quality, 0x80, JPEG_STARS) \
+    FIELD(raw_format, 0x84, UINT32) \
+    FIELD(jpeg_image_tone, 0x88, UINT32) \
+    FIELD(jpeg_saturation, 0x8c, UINT32) \
+    FIELD(jpeg_sharpness, 0x90, UINT32) \
+    FIELD(jpeg_contrast, 0x94, UINT32) \
+    /* FIELD(custom_ev_steps, 0x9c, UINT32) */ \
+    /* FIELD(custom_sensitivity_steps, 0xa0, UINT32) */ \
+    FIELD(exposure_mode, 0xac, UINT32) \
+    FIELD(af_mode, 0xb8, UINT32) \
+    FIELD(af_point_select, 0xbc, UINT32) \
+    FIELD(selected_af_point, 0xc0, UINT32) \
+    FIELD(drive_mode, 0xcc, UINT32) \
+    FIELD(shake_reduction, 0xda, UINT32) \
+    FIELD(jpeg_hue, 0xf4, UINT32) \
+    FIELD(current_shutter_speed.nom, 0x0104, UINT32) \
+    FIELD(current_shutter_speed.denom, 0x108, UINT32) \
+    FIELD(light_meter_flags, 0x124, UINT32) \
+    FIELD(lens_min_aperture.nom, 0x13c, UINT32) \
+    FIELD(lens_min_aperture.denom, 0x140, UINT32) \
+    FIELD(lens_max_aperture.nom, 0x144, UINT32) \
+    FIELD(lens_max_aperture.denom, 0x148, UINT32) \
+    FIELD(focused_af_point, 0x150, UINT32) \
+    FIELD(zoom.nom, 0x17c, UINT32) \
+    FIELD(zoom.denom, 0x180, UINT32) \
+    FIELD(focus, 0x184, INT32) \
+    /* Drive mode: 0=Single shot, 1= Continous Hi, 2= Continous Low or Self timer 12s, 3=Self timer 2s */ \
+    /* 4= remote, 5= remote 3s delay */
+
+#define STATUS_LAYOUT_KX(FIELD) \
+    FIELD(zoom.nom, 0x198, UINT32) \
+    FIELD(zoom.denom, 0x19C, UINT32) \
+    FIELD(focus, 0x1A0, INT32) \
+    FIELD(lens_id1, 0x188, LENS_ID) \
+    FIELD(lens_id2, 0x194, UINT32) \
+    /* selected_af_point: cannot find the field, 0xc8 is always zero */
 
-    uint8_t *buf = p->status_buffer;
-    get_uint32_func get_uint32_func_ptr;
-    get_int32_func get_int32_func_ptr;
-    get_uint16_func get_uint16_func_ptr;
-
-    if (p->model->is_little_endian) {
-        get_uint32_func_ptr = get_uint32_le;
-        get_int32_func_ptr = get_int32_le;
-        get_uint16_func_ptr = get_uint16_le;
-    } else {
-        get_uint32_func_ptr = get_uint32_be;
-        get_int32_func_ptr = get_int32_be;
-        get_uint16_func_ptr = get_uint16_be;
-    }
-
-    // 0x0C: 0x85 0xA5
-    // 0x0F: beginning 0 sometime changes to 1
-    // 0x14: LCD panel 2: turned off 3: on?
-    status->bufmask = (*get_uint16_func_ptr)( &buf[0x1E + shift]);
-    status->user_mode_flag = (*get_uint32_func_ptr)(&buf[0x24 + shift]);
-    status->flash_mode = (*get_uint32_func_ptr)(&buf[0x28 + shift]);
-    status->flash_exposure_compensation = (*get_int32_func_ptr)(&buf[0x2C + shift]);
-    status->set_shutter_speed.nom = (*get_uint32_func_ptr)(&buf[0x34 + shift]);
-    status->set_shutter_speed.denom = (*get_uint32_func_ptr)(&buf[0x38 + shift]);
-    status->set_aperture.nom = (*get_uint32_func_ptr)(&buf[0x3C + shift]);
-    status->set_aperture.denom = (*get_uint32_func_ptr)(&buf[0x40 + shift]);
-    status->ec.nom = (*get_uint32_func_ptr)(&buf[0x44 + shift]);
-    status->ec.denom = (*get_uint32_func_ptr)(&buf[0x48 + shift]);
-    status->auto_bracket_mode = (*get_uint32_func_ptr)(&buf[0x4C + shift]);
-    status->auto_bracket_ev.nom = (*get_uint32_func_ptr)(&buf[0x50 + shift]);
-    status->auto_bracket_ev.denom = (*get_uint32_func_ptr)(&buf[0x54 + shift]);
-    status->auto_bracket_picture_count = (*get_uint32_func_ptr)(&buf[0x58 + shift]);
-    status->drive_mode = (*get_uint32_func_ptr)(&buf[0x5C + shift]);
-    status->fixed_iso = (*get_uint32_func_ptr)(&buf[0x68 + shift]);
-    status->auto_iso_min = (*get_uint32_func_ptr)(&buf[0x6C + shift]);
-    status->auto_iso_max = (*get_uint32_func_ptr)(&buf[0x70 + shift]);
-    status->white_balance_mode = (*get_uint32_func_ptr)(&buf[0x74 + shift]);
-    status->white_balance_adjust_mg = (*get_uint32_func_ptr)(&buf[0x78 + shift]); // 0: M7 7: 0 14: G7
-    status->white_balance_adjust_ba = (*get_uint32_func_ptr)(&buf[0x7C + shift]); // 0: B7 7: 0 14: A7
-    status->image_format = (*get_uint32_func_ptr)(&buf[0x80 + shift]);
-    status->jpeg_resolution = (*get_uint32_func_ptr)(&buf[0x84 + shift]);
-    status->jpeg_quality = _get_user_jpeg_stars( p->model, (*get_uint32_func_ptr)(&buf[0x88 + shift]));
-    status->raw_format = (*get_uint32_func_ptr)(&buf[0x8C + shift]);
-    status->jpeg_image_tone = (*get_uint32_func_ptr)(&buf[0x90 + shift]);
-    status->jpeg_saturation = (*get_uint32_func_ptr)(&buf[0x94 + shift]);
-    status->jpeg_sharpness = (*get_uint32_func_ptr)(&buf[0x98 + shift]);
-    status->jpeg_contrast = (*get_uint32_func_ptr)(&buf[0x9C + shift]);
-    status->color_space = (*get_uint32_func_ptr)(&buf[0xA0 + shift]);
-    status->custom_ev_steps = (*get_uint32_func_ptr)(&buf[0xA4 + shift]);
-    status->custom_sensitivity_steps = (*get_uint32_func_ptr)(&buf[0xa8 + shift]);
-    status->exposure_mode = (*get_uint32_func_ptr)(&buf[0xb4 + shift]);
-    status->scene_mode = (*get_uint32_func_ptr)(&buf[0xb8 + shift]);
-    status->ae_metering_mode = (*get_uint32_func_ptr)(&buf[0xbc + shift]); // same as cc
-    status->af_mode = (*get_uint32_func_ptr)(&buf[0xC0 + shift]);
-    status->af_point_select = (*get_uint32_func_ptr)(&buf[0xc4 + shift]);
-    status->selected_af_point = (*get_uint32_func_ptr)(&buf[0xc8 + shift]);
-    status->shake_reduction = (*get_uint32_func_ptr)(&buf[0xE0 + shift]);
-    status->auto_bracket_picture_counter = (*get_uint32_func_ptr)(&buf[0xE4 + shift]);
-    status->jpeg_hue = (*get_uint32_func_ptr)(&buf[0xFC + shift]);
-    status->current_shutter_speed.nom = (*get_uint32_func_ptr)(&buf[0x10C + shift]);
-    status->current_shutter_speed.denom = (*get_uint32_func_ptr)(&buf[0x110 + shift]);
-    status->current_aperture.nom = (*get_uint32_func_ptr)(&buf[0x114 + shift]);
-    status->current_aperture.denom = (*get_uint32_func_ptr)(&buf[0x118 + shift]);
-    status->max_shutter_speed.nom = (*get_uint32_func_ptr)(&buf[0x12C + shift]);
-    status->max_shutter_speed.denom = (*get_uint32_func_ptr)(&buf[0x130 + shift]);
-    status->current_iso = (*get_uint32_func_ptr)(&buf[0x134 + shift]);
-    status->light_meter_flags = (*get_uint32_func_ptr)(&buf[0x13C + shift]);
-    status->lens_min_aperture.nom = (*get_uint32_func_ptr)(&buf[0x144 + shift]);
-    status->lens_min_aperture.denom = (*get_uint32_func_ptr)(&buf[0x148 + shift]);
-    status->lens_max_aperture.nom = (*get_uint32_func_ptr)(&buf[0x14C + shift]);
-    status->lens_max_aperture.denom = (*get_uint32_func_ptr)(&buf[0x150 + shift]);
-    status->manual_mode_ev = (*get_int32_func_ptr)(&buf[0x15C + shift]);
-    status->focused_af_point = (*get_uint32_func_ptr)(&buf[0x168 + shift]); //d, unsure about it, a lot is changing when the camera focuses
-    // probably voltage*100
-    // battery_1 > battery2 ( noload vs load voltage?)
-    status->battery_1 = (*get_uint32_func_ptr)( &buf[0x170 + shift] );
-    status->battery_2 = (*get_uint32_func_ptr)( &buf[0x174 + shift] );
-    status->battery_3 = (*get_uint32_func_ptr)( &buf[0x180 + shift] );
-    status->battery_4 = (*get_uint32_func_ptr)( &buf[0x184 + shift] );
+// Vince: K-r support 2011-06-22
+#define STATUS_LAYOUT_KR(FIELD) \
+    FIELD(zoom.nom, 0x19C, UINT32) \
+    FIELD(zoom.denom, 0x1A0, UINT32) \
+    FIELD(focus, 0x1A4, INT32) \
+    FIELD(lens_id1, 0x18C, LENS_ID) \
+    FIELD(lens_id2, 0x198, UINT32)
+
+#define STATUS_LAYOUT_K5(FIELD) \
+    FIELD(zoom.nom, 0x1A0, UINT32) \
+    FIELD(zoom.denom, 0x1A4, UINT32) \
+    FIELD(focus, 0x1A8, INT32) /* ? */ \
+    FIELD(lens_id1, 0x190, LENS_ID) \
+    FIELD(lens_id2, 0x19C, UINT32) \
+    /* TODO: check these fields */ \
+    /* status.focused = getInt32(statusBuf, 0x164); */
+
+// status check seems to be the same for K-30 and K-01
+#define STATUS_LAYOUT_K30(FIELD) \
+    FIELD(zoom.nom, 0x1A0, UINT32) /* - good for K01 */ \
+    FIELD(zoom.denom, 100, CONST) /* good for K-01 */ \
+    FIELD(focus, 0x1A8, INT32) /* ? - good for K01 */ \
+    FIELD(lens_id1, 0x190, LENS_ID) /* - good for K01 */ \
+    FIELD(lens_id2, 0x19C, UINT32) /* - good for K01 */
+
+#define STATUS_LAYOUT_K50(FIELD) \
+    FIELD(zoom.nom, 0x1A0, UINT32) \
+    FIELD(zoom.denom, 0x1A4, UINT32) \
+    /* FIELD(focus, 0x1A8, INT32) ? */ \
+    FIELD(lens_id1, 0x190, LENS_ID) \
+    FIELD(lens_id2, 0x19C, UINT32)
+
+// cannot read max_shutter_speed from status buffer, hardwire the values here
+#define STATUS_LAYOUT_K500(FIELD) \
+    FIELD(max_shutter_speed.nom, 1, CONST) \
+    FIELD(max_shutter_speed.denom, 6000, CONST)
+
+#define STATUS_LAYOUT_KM(FIELD) \
+    FIELD(zoom.nom, 0x180, UINT32) \
+    FIELD(zoom.denom, 0x184, UINT32) \
+    FIELD(lens_id1, 0x170, LENS_ID) \
+    FIELD(lens_id2, 0x17c, UINT32) \
+    /* TODO */ \
+    /* status.focused = getInt32(statusBuf, 0x164); */
 
+// K-3 returns data in little-endian
+#define STATUS_LAYOUT_K3(FIELD) \
+    FIELD(bufmask, 0x1C, UINT16) \
+    FIELD(zoom.nom, 0x1A0, UINT32) \
+    FIELD(zoom.denom, 0x1A4, UINT32) \
+    FIELD(focus, 0x1A8, INT32) \
+    FIELD(lens_id1, 0x190, LENS_ID) \
+    FIELD(lens_id2, 0x19C, UINT32) \
+    /* cannot read max_shutter_speed from status buffer, hardwire the values here */ \
+    FIELD(max_shutter_speed.nom, 1, CONST) \
+    FIELD(max_shutter_speed.denom, 8000, CONST)
+
+#define STATUS_LAYOUT_KS1(FIELD) \
+    FIELD(bufmask, 0x0C, UINT16) \
+    FIELD(zoom.nom, 0x1A0, UINT32) \
+    FIELD(zoom.denom, 0x1A4, UINT32) \
+    FIELD(focus, 0x1A8, INT32) \
+    FIELD(lens_id1, 0x190, LENS_ID) \
+    FIELD(lens_id2, 0x19C, UINT32)
+
+// the common block returns invalid values for the following fields. Fixing the fields:
+#define STATUS_LAYOUT_K1(FIELD) \
+    FIELD(jpeg_hue, 0x100, UINT32) \
+    FIELD(current_shutter_speed.nom, 0x110, UINT32) \
+    FIELD(current_shutter_speed.denom, 0x114, UINT32) \
+    FIELD(current_aperture.nom, 0x118, UINT32) \
+    FIELD(current_aperture.denom, 0x11c, UINT32) \
+    FIELD(max_shutter_speed.nom, 0x130, UINT32) \
+    FIELD(max_shutter_speed.denom, 0x134, UINT32) \
+    FIELD(current_iso, 0x138, UINT32) \
+    FIELD(light_meter_flags, 0x140, UINT32) /* ? */ \
+    FIELD(lens_min_aperture.nom, 0x148, UINT32) \
+    FIELD(lens_min_aperture.denom, 0x14c, UINT32) \
+    FIELD(lens_max_aperture.nom, 0x150, UINT32) \
+    FIELD(lens_max_aperture.denom, 0x154, UINT32) \
+    FIELD(manual_mode_ev, 0x160, INT32) /* ? */ \
+    FIELD(focused_af_point, 0x16c, UINT32) /* ? */ \
+    FIELD(battery_1, 0x174, UINT32) \
+    FIELD(battery_2, 0x178, UINT32) \
+    \
+    /* selected_af_point */ \
+    /* toprow left: 0x04000000 */ \
+    /* toprow leftmiddle: 0x02000000 */ \
+    /* toprow middle: 0x01000000 */ \
+    /* toprow rightmiddle: 0x00800000 */ \
+    /* bottomright: 0x00000004 */ \
+    \
+    FIELD(bufmask, 0x0C, UINT16) \
+    FIELD(zoom.nom, 0x1A4, UINT32) \
+    FIELD(zoom.denom, 0x1A8, UINT32) \
+    /* FIELD(focus, 0x1A8, INT32) */ \
+    FIELD(lens_id1, 0x194, LENS_ID) \
+    FIELD(lens_id2, 0x1A0, UINT32)
+
+// on top of the K-1 fields
+#define STATUS_LAYOUT_K70(FIELD) \
+    FIELD(auto_bracket_picture_counter, 0xE8, UINT32) \
+    FIELD(shake_reduction, 0xe4, UINT32) \
+    FIELD(battery_3, 0, CONST) \
+    FIELD(battery_4, 0, CONST)
+
+#if defined(__GNUC__)
+#define status_bswap16 __builtin_bswap16
+#define status_bswap32 __builtin_bswap32
+#else
+static inline uint16_t status_bswap16(uint16_t v) {
+    return v << 8 | v >> 8;
 }
 
-static
-void ipslr_status_parse_kx(ipslr_handle_t *p, pslr_status *status) {
+static inline uint32_t status_bswap32(uint32_t v) {
+    return v << 24 | (v & 0xff00) << 8 | (v >> 8 & 0xff00) | v >> 24;
+}
+#endif
 
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
+static inline uint16_t status_load16(const uint8_t *buf) {
+    uint16_t v;
+    memcpy(&v, buf, sizeof(v));
+    return v;
+}
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0);
-    status->zoom.nom = get_uint32_be(&buf[0x198]);
-    status->zoom.denom = get_uint32_be(&buf[0x19C]);
-    status->focus = get_int32_be(&buf[0x1A0]);
-    status->lens_id1 = get_uint32_be(&buf[0x188]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x194]);
-    // selected_af_point: cannot find the field, 0xc8 is always zero
+static inline uint32_t status_load32(const uint8_t *buf) {
+    uint32_t v;
+    memcpy(&v, buf, sizeof(v));
+    return v;
 }
 
-// Vince: K-r support 2011-06-22
-//
-static
-void ipslr_status_parse_kr(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define status_load16_be(buf) status_load16(buf)
+#define status_load32_be(buf) status_load32(buf)
+#define status_load16_le(buf) status_bswap16(status_load16(buf))
+#define status_load32_le(buf) status_bswap32(status_load32(buf))
+#else
+#define status_load16_le(buf) status_load16(buf)
+#define status_load32_le(buf) status_load32(buf)
+#define status_load16_be(buf) status_bswap16(status_load16(buf))
+#define status_load32_be(buf) status_bswap32(status_load32(buf))
+#endif
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    status->zoom.nom = get_uint32_be(&buf[0x19C]);
-    status->zoom.denom = get_uint32_be(&buf[0x1A0]);
-    status->focus = get_int32_be(&buf[0x1A4]);
-    status->lens_id1 = get_uint32_be(&buf[0x18C]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x198]);
+#define STATUS_GET_UINT16(order, offset) status_load16_##order(&buf[(offset) + shift])
+#define STATUS_GET_UINT32(order, offset) status_load32_##order(&buf[(offset) + shift])
+#define STATUS_GET_INT32(order, offset) (int32_t) STATUS_GET_UINT32(order, offset)
+#define STATUS_GET_LENS_ID(order, offset) (STATUS_GET_UINT32(order, offset) & 0x0F)
+#define STATUS_GET_JPEG_STARS(order, offset) _get_user_jpeg_stars(p->model, STATUS_GET_UINT32(order, offset))
+#define STATUS_GET_CONST(order, value) (value)
+
+#define STATUS_FIELD_LE(field, offset, type) status->field = STATUS_GET_##type(le, offset);
+#define STATUS_FIELD_BE(field, offset, type) status->field = STATUS_GET_##type(be, offset);
+#define STATUS_CASE_LE(field, offset, type) case offsetof(pslr_status, field): STATUS_FIELD_LE(field, offset, type) break;
+#define STATUS_CASE_BE(field, offset, type) case offsetof(pslr_status, field): STATUS_FIELD_BE(field, offset, type) break;
+
+// every layout is expanded to straight-line code for the byte order of the cameras using it.
+// The lazy decoding jumps to the requested members only, a rational is decoded word by word.
+#define STATUS_LAYOUT_PARSER(name, layout, order)                                               \
+static void name(ipslr_handle_t *p, const uint8_t *buf, pslr_status *status, int shift,       \
+                 uint64_t fields) {                                                             \
+    if (fields == PSLR_STATUS_ALL) {                                                            \
+        layout(STATUS_FIELD_##order)                                                            \
+        return;                                                                                 \
+    }                                                                                           \
+    fields &= PSLR_STATUS_ALL;                                                                  \
+    while (fields) {                                                                            \
+        int i = status_next_field(&fields);                                                     \
+        size_t at;                                                                              \
+        for (at = status_fields[i].offset; at < status_fields[i].offset + status_fields[i].size; \
+             at += sizeof(uint32_t)) {                                                          \
+            switch (at) {                                                                       \
+                layout(STATUS_CASE_##order)                                                     \
+                default:                                                                        \
+                    break;                                                                      \
+            }                                                                                   \
+        }                                                                                       \
+    }                                                                                           \
 }
 
+STATUS_LAYOUT_PARSER(ipslr_status_layout_common_be, STATUS_LAYOUT_COMMON, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_common_le, STATUS_LAYOUT_COMMON, LE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k10d_be, STATUS_LAYOUT_K10D, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k20d_be, STATUS_LAYOUT_K20D, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_istds_be, STATUS_LAYOUT_ISTDS, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k200d_be, STATUS_LAYOUT_K200D, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_kx_be, STATUS_LAYOUT_KX, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_kr_be, STATUS_LAYOUT_KR, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k5_be, STATUS_LAYOUT_K5, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k30_be, STATUS_LAYOUT_K30, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k50_be, STATUS_LAYOUT_K50, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k500_be, STATUS_LAYOUT_K500, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_km_be, STATUS_LAYOUT_KM, BE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k3_le, STATUS_LAYOUT_K3, LE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_ks1_le, STATUS_LAYOUT_KS1, LE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k1_le, STATUS_LAYOUT_K1, LE)
+STATUS_LAYOUT_PARSER(ipslr_status_layout_k70_le, STATUS_LAYOUT_K70, LE)
+
 static
-void ipslr_status_parse_k5(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
+uint8_t *ipslr_status_parse_begin(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
     if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
+        ipslr_status_diff(p, p->status_buffer);
     }
-
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    status->zoom.nom = get_uint32_be(&buf[0x1A0]);
-    status->zoom.denom = get_uint32_be(&buf[0x1A4]);
-    status->focus = get_int32_be(&buf[0x1A8]); // ?
-    status->lens_id1 = get_uint32_be(&buf[0x190]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x19C]);
-
-// TODO: check these fields
-//status.focused = getInt32(statusBuf, 0x164);
+    if ( fields == PSLR_STATUS_ALL ) {
+        memset(status, 0, sizeof (*status));
+    } else {
+        ipslr_status_clear_fields(status, fields);
+    }
+    return p->status_buffer;
 }
 
 static
-void ipslr_status_parse_k30(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    //~ status->jpeg_contrast -= 4;
-    //~ status->jpeg_hue -= 4;
-    //~ status->jpeg_sharpness -= 4;
-    //~ status->jpeg_saturation -= 4;
-    status->zoom.nom = get_uint32_be(&buf[0x1A0]);
-    status->zoom.denom = 100;
-    status->focus = get_int32_be(&buf[0x1A8]); // ?
-    status->lens_id1 = get_uint32_be(&buf[0x190]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x19C]);
+void ipslr_status_parse_k10d(ipslr_handle_t  *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_k10d_be(p, buf, status, 0, fields);
 }
 
-// status check seems to be the same as K30
 static
-void ipslr_status_parse_k01(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    //~ status->jpeg_contrast -= 4;
-    //~ status->jpeg_hue -= 4;
-    //~ status->jpeg_sharpness -= 4;
-    //~ status->jpeg_saturation -= 4;
-    status->zoom.nom = get_uint32_be(&buf[0x1A0]); // - good for K01
-    status->zoom.denom = 100; // good for K-01
-    status->focus = get_int32_be(&buf[0x1A8]); // ? - good for K01
-    status->lens_id1 = get_uint32_be(&buf[0x190]) & 0x0F; // - good for K01
-    status->lens_id2 = get_uint32_be( &buf[0x19C]); // - good for K01
+void ipslr_status_parse_k20d(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_k20d_be(p, buf, status, 0, fields);
 }
 
 static
-void ipslr_status_parse_k50(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
+void ipslr_status_parse_istds(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    if ( fields == PSLR_STATUS_ALL ) {
+        memset(status, 0, sizeof (*status));
+    } else {
+        ipslr_status_clear_fields(status, fields);
     }
+    ipslr_status_layout_istds_be(p, p->status_buffer, status, 0, fields);
+}
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    status->zoom.nom = get_uint32_be(&buf[0x1A0]);
-    status->zoom.denom = get_uint32_be(&buf[0x1A4]);
-    //    status->focus = get_int32_be(&buf[0x1A8]); // ?
-    status->lens_id1 = get_uint32_be(&buf[0x190]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x19C]);
+static
+void ipslr_status_parse_kx(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_kx_be(p, buf, status, 0, fields);
 }
 
 static
-void ipslr_status_parse_k500(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
+void ipslr_status_parse_kr(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_kr_be(p, buf, status, 0, fields);
+}
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    status->zoom.nom = get_uint32_be(&buf[0x1A0]);
-    status->zoom.denom = get_uint32_be(&buf[0x1A4]);
-    //    status->focus = get_int32_be(&buf[0x1A8]); // ?
-    status->lens_id1 = get_uint32_be(&buf[0x190]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x19C]);
-    // cannot read max_shutter_speed from status buffer, hardwire the values here
-    status->max_shutter_speed.nom = 1;
-    status->max_shutter_speed.denom = 6000;
+static
+void ipslr_status_parse_k5(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_k5_be(p, buf, status, 0, fields);
 }
 
 static
-void ipslr_status_parse_km(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
+void ipslr_status_parse_k30(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_k30_be(p, buf, status, 0, fields);
+}
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, -4);
-    status->zoom.nom = get_uint32_be(&buf[0x180]);
-    status->zoom.denom = get_uint32_be(&buf[0x184]);
-    status->lens_id1 = get_uint32_be(&buf[0x170]) & 0x0F;
-    status->lens_id2 = get_uint32_be( &buf[0x17c]);
-// TODO
-// status.focused = getInt32(statusBuf, 0x164);
+static
+void ipslr_status_parse_k01(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_k30_be(p, buf, status, 0, fields);
 }
 
-// K-3 returns data in little-endian
 static
-void ipslr_status_parse_k3(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
+void ipslr_status_parse_k50(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_k50_be(p, buf, status, 0, fields);
+}
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    status->bufmask = get_uint16_le( &buf[0x1C]);
-    status->zoom.nom = get_uint32_le(&buf[0x1A0]);
-    status->zoom.denom = get_uint32_le(&buf[0x1A4]);
-    status->focus = get_int32_le(&buf[0x1A8]);
-    status->lens_id1 = get_uint32_le(&buf[0x190]) & 0x0F;
-    status->lens_id2 = get_uint32_le( &buf[0x19C]);
-    // cannot read max_shutter_speed from status buffer, hardwire the values here
-    status->max_shutter_speed.nom = 1;
-    status->max_shutter_speed.denom = 8000;
+static
+void ipslr_status_parse_k500(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, 0, fields);
+    ipslr_status_layout_k50_be(p, buf, status, 0, fields);
+    ipslr_status_layout_k500_be(p, buf, status, 0, fields);
 }
 
 static
-void ipslr_status_parse_ks1(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
+void ipslr_status_parse_km(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_be(p, buf, status, -4, fields);
+    ipslr_status_layout_km_be(p, buf, status, 0, fields);
+}
 
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-    status->bufmask = get_uint16_le( &buf[0x0C]);
-    status->zoom.nom = get_uint32_le(&buf[0x1A0]);
-    status->zoom.denom = get_uint32_le(&buf[0x1A4]);
-    status->focus = get_int32_le(&buf[0x1A8]);
-    status->lens_id1 = get_uint32_le(&buf[0x190]) & 0x0F;
-    status->lens_id2 = get_uint32_le( &buf[0x19C]);
+static
+void ipslr_status_parse_k3(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_le(p, buf, status, 0, fields);
+    ipslr_status_layout_k3_le(p, buf, status, 0, fields);
 }
 
+static
+void ipslr_status_parse_ks1(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_le(p, buf, status, 0, fields);
+    ipslr_status_layout_ks1_le(p, buf, status, 0, fields);
+}
 
 static
-void ipslr_status_parse_k1(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-// parse_common returns invalid values for the following fields. Fixing the fields:
-
-    status->jpeg_hue = get_uint32_le(&buf[0x100]);
-    status->current_shutter_speed.nom = get_uint32_le(&buf[0x110]);
-    status->current_shutter_speed.denom = get_uint32_le(&buf[0x114]);
-    status->current_aperture.nom = get_uint32_le(&buf[0x118]);
-    status->current_aperture.denom = get_uint32_le(&buf[0x11c]);
-    status->max_shutter_speed.nom = get_uint32_le(&buf[0x130]);
-    status->max_shutter_speed.denom = get_uint32_le(&buf[0x134]);
-    status->current_iso = get_uint32_le(&buf[0x138]);
-    status->light_meter_flags = get_uint32_le(&buf[0x140]); // ?
-    status->lens_min_aperture.nom = get_uint32_le(&buf[0x148]);
-    status->lens_min_aperture.denom = get_uint32_le(&buf[0x14c]);
-    status->lens_max_aperture.nom = get_uint32_le(&buf[0x150]);
-    status->lens_max_aperture.denom = get_uint32_le(&buf[0x154]);
-    status->manual_mode_ev = get_uint32_le(&buf[0x160]); // ?
-    status->focused_af_point = get_uint32_le(&buf[0x16c]); // ?
-    status->battery_1 = get_uint32_le(&buf[0x174]);
-    status->battery_2 = get_uint32_le(&buf[0x178]);
-
-    // selected_af_point
-    // toprow left: 0x04000000
-    // toprow leftmiddle: 0x02000000
-    // toprow middle: 0x01000000
-    // toprow rightmiddle: 0x00800000
-    // bottomright: 0x00000004
-
-    status->bufmask = get_uint16_le( &buf[0x0C]);
-    status->zoom.nom = get_uint32_le(&buf[0x1A4]);
-    status->zoom.denom = get_uint32_le(&buf[0x1A8]);
-//    status->focus = get_int32_le(&buf[0x1A8]);
-    status->lens_id1 = get_uint32_le(&buf[0x194]) & 0x0F;
-    status->lens_id2 = get_uint32_le( &buf[0x1A0]);
+void ipslr_status_parse_k1(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_le(p, buf, status, 0, fields);
+    ipslr_status_layout_k1_le(p, buf, status, 0, fields);
 }
 
 static
-void ipslr_status_parse_k70(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-
-    memset(status, 0, sizeof (*status));
-    ipslr_status_parse_common( p, status, 0 );
-// parse_common returns invalid values for the following fields. Fixing the fields:
-
-    status->auto_bracket_picture_counter = get_uint32_le(&buf[0xE8]);
-    status->jpeg_hue = get_uint32_le(&buf[0x100]);
-    status->current_shutter_speed.nom = get_uint32_le(&buf[0x110]);
-    status->current_shutter_speed.denom = get_uint32_le(&buf[0x114]);
-    status->current_aperture.nom = get_uint32_le(&buf[0x118]);
-    status->current_aperture.denom = get_uint32_le(&buf[0x11c]);
-    status->max_shutter_speed.nom = get_uint32_le(&buf[0x130]);
-    status->max_shutter_speed.denom = get_uint32_le(&buf[0x134]);
-    status->current_iso = get_uint32_le(&buf[0x138]);
-    status->light_meter_flags = get_uint32_le(&buf[0x140]); // ?
-    status->lens_min_aperture.nom = get_uint32_le(&buf[0x148]);
-    status->lens_min_aperture.denom = get_uint32_le(&buf[0x14c]);
-    status->lens_max_aperture.nom = get_uint32_le(&buf[0x150]);
-    status->lens_max_aperture.denom = get_uint32_le(&buf[0x154]);
-    status->manual_mode_ev = get_uint32_le(&buf[0x160]); // ?
-    status->focused_af_point = get_uint32_le(&buf[0x16c]); // ?
-
-    switch ( status->af_point_select) {
-        case 0:
-            status->af_point_select=PSLR_AF_POINT_SEL_SPOT;
-            break;
-        case 1:
-            status->af_point_select=PSLR_AF_POINT_SEL_SELECT;
-            break;
-        case 2:
-            status->af_point_select=PSLR_AF_POINT_SEL_EXPANDED;
-            break;
-        case 5:
-            status->af_point_select=PSLR_AF_POINT_SEL_AUTO_5;
-            break;
-        case 6:
-            status->af_point_select=PSLR_AF_POINT_SEL_AUTO_11;
-            break;
-    }
-
-    status->battery_1 = get_uint32_le(&buf[0x174]);
-    status->battery_2 = get_uint32_le(&buf[0x178]);
-    status->battery_3 = 0;
-    status->battery_4 = 0;
-
-    uint32_t converted_selected_af_point=0;
-    int convert_bit_index[11] = { 26, 24, 22, 1, 16, 14, 12, 0, 6, 4, 2};
-    int bitidx=0;
-    for (bitidx=0; bitidx<11; ++bitidx) {
-        if (status->selected_af_point & 1<<convert_bit_index[bitidx]) {
-            converted_selected_af_point |= 1 << bitidx;
+void ipslr_status_parse_k70(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_common_le(p, buf, status, 0, fields);
+    ipslr_status_layout_k1_le(p, buf, status, 0, fields);
+    ipslr_status_layout_k70_le(p, buf, status, 0, fields);
+
+    if ( fields & PSLR_STATUS_BIT(PSLR_STATUS_AF_POINT_SELECT) ) {
+        switch ( status->af_point_select) {
+            case 0:
+                status->af_point_select=PSLR_AF_POINT_SEL_SPOT;
+                break;
+            case 1:
+                status->af_point_select=PSLR_AF_POINT_SEL_SELECT;
+                break;
+            case 2:
+                status->af_point_select=PSLR_AF_POINT_SEL_EXPANDED;
+                break;
+            case 5:
+                status->af_point_select=PSLR_AF_POINT_SEL_AUTO_5;
+                break;
+            case 6:
+                status->af_point_select=PSLR_AF_POINT_SEL_AUTO_11;
+                break;
         }
     }
-    status->selected_af_point = converted_selected_af_point;
 
-    status->bufmask = get_uint16_le( &buf[0x0C]);
-    status->zoom.nom = get_uint32_le(&buf[0x1A4]);
-    status->zoom.denom = get_uint32_le(&buf[0x1A8]);
-//    status->focus = get_int32_le(&buf[0x1A8]);
-    status->lens_id1 = get_uint32_le(&buf[0x194]) & 0x0F;
-    status->lens_id2 = get_uint32_le( &buf[0x1A0]);
-    status->shake_reduction = get_uint32_le(&buf[0xe4]);
+    if ( fields & PSLR_STATUS_BIT(PSLR_STATUS_SELECTED_AF_POINT) ) {
+        uint32_t converted_selected_af_point=0;
+        int convert_bit_index[11] = { 26, 24, 22, 1, 16, 14, 12, 0, 6, 4, 2};
+        int bitidx=0;
+        for (bitidx=0; bitidx<11; ++bitidx) {
+            if (status->selected_af_point & 1<<convert_bit_index[bitidx]) {
+                converted_selected_af_point |= 1 << bitidx;
+            }
+        }
+        status->selected_af_point = converted_selected_af_point;
+    }
 }
 
 static
-void ipslr_status_parse_k200d(ipslr_handle_t *p, pslr_status *status) {
-    uint8_t *buf = p->status_buffer;
-    if ( PSLR_DEBUG_ENABLED ) {
-        ipslr_status_diff(buf);
-    }
-
-    memset(status, 0, sizeof (*status));
-    status->bufmask = get_uint16_be(&buf[0x16]);
-    status->user_mode_flag = get_uint32_be(&buf[0x1c]);
-    status->set_shutter_speed.nom = get_uint32_be(&buf[0x2c]);
-    status->set_shutter_speed.denom = get_uint32_be(&buf[0x30]);
-    status->current_aperture.nom = get_uint32_be(&buf[0x034]);
-    status->current_aperture.denom = get_uint32_be(&buf[0x038]);
-    status->set_aperture.nom = get_uint32_be(&buf[0x34]);
-    status->set_aperture.denom = get_uint32_be(&buf[0x38]);
-    status->ec.nom = get_uint32_be(&buf[0x3c]);
-    status->ec.denom = get_uint32_be(&buf[0x40]);
-    status->current_iso = get_uint32_be(&buf[0x060]);
-    status->fixed_iso = get_uint32_be(&buf[0x60]);
-    status->auto_iso_min = get_uint32_be(&buf[0x64]);
-    status->auto_iso_max = get_uint32_be(&buf[0x68]);
-    status->image_format = get_uint32_be(&buf[0x78]);
-    status->jpeg_resolution = get_uint32_be(&buf[0x7c]);
-    status->jpeg_quality = _get_user_jpeg_stars( p->model, get_uint32_be(&buf[0x80]));
-    status->raw_format = get_uint32_be(&buf[0x84]);
-    status->jpeg_image_tone = get_uint32_be(&buf[0x88]);
-    status->jpeg_saturation = get_uint32_be(&buf[0x8c]);
-    status->jpeg_sharpness = get_uint32_be(&buf[0x90]);
-    status->jpeg_contrast = get_uint32_be(&buf[0x94]);
-    //status->custom_ev_steps = get_uint32_be(&buf[0x9c]);
-    //status->custom_sensitivity_steps = get_uint32_be(&buf[0xa0]);
-    status->exposure_mode = get_uint32_be(&buf[0xac]);
-    status->af_mode = get_uint32_be(&buf[0xb8]);
-    status->af_point_select = get_uint32_be(&buf[0xbc]);
-    status->selected_af_point = get_uint32_be(&buf[0xc0]);
-    status->drive_mode = get_uint32_be(&buf[0xcc]);
-    status->shake_reduction = get_uint32_be(&buf[0xda]);
-    status->jpeg_hue = get_uint32_be(&buf[0xf4]);
-    status->current_shutter_speed.nom = get_uint32_be(&buf[0x0104]);
-    status->current_shutter_speed.denom = get_uint32_be(&buf[0x108]);
-    status->light_meter_flags = get_uint32_be(&buf[0x124]);
-    status->lens_min_aperture.nom = get_uint32_be(&buf[0x13c]);
-    status->lens_min_aperture.denom = get_uint32_be(&buf[0x140]);
-    status->lens_max_aperture.nom = get_uint32_be(&buf[0x144]);
-    status->lens_max_aperture.denom = get_uint32_be(&buf[0x148]);
-    status->focused_af_point = get_uint32_be(&buf[0x150]);
-    status->zoom.nom = get_uint32_be(&buf[0x17c]);
-    status->zoom.denom = get_uint32_be(&buf[0x180]);
-    status->focus = get_int32_be(&buf[0x184]);
-    // Drive mode: 0=Single shot, 1= Continous Hi, 2= Continous Low or Self timer 12s, 3=Self timer 2s
-    // 4= remote, 5= remote 3s delay
-}
-
-pslr_setting_def_t *pslr_find_setting_by_name (pslr_setting_def_t *array, int array_length, char *name) {
-    if (array == NULL || array_length == 0) {
-        return NULL;
-    }
-    int i;
-    for ( i = 0; i<array_length; i++) {
-        if ( strncmp(array[i].name, name, strlen(name))==0 ) {
-            return &array[i];
-        }
-    }
-    return NULL;
+void ipslr_status_parse_k200d(ipslr_handle_t *p, pslr_status *status, uint64_t fields) {
+    uint8_t *buf = ipslr_status_parse_begin(p, status, fields);
+    ipslr_status_layout_k200d_be(p, buf, status, 0, fields);
 }
 
+/* The settings file named by PKTRIGGERCORD_SETTINGS, NULL without it. */
 static
 char *read_json_file(int *jsonsize) {
-    int jsonfd = open("pentax_settings.json", O_RDONLY);
+    const char *filename = getenv("PKTRIGGERCORD_SETTINGS");
+    if (filename == NULL || filename[0] == '\0') {
+        // no override, the built-in settings_table is used
+        return NULL;
+    }
+    int jsonfd = open(filename, O_RDONLY);
     if (jsonfd == -1) {
-        // cannot find in the current directory, also checking PKTDATADIR
-        if (dir_exists(PKTDATADIR)) {
-            jsonfd = open(PKTDATADIR "/pentax_settings.json", O_RDONLY);
-        }
-        if (jsonfd == -1) {
-            pslr_write_log(PSLR_ERROR, "Cannot open pentax_settings.json file\n");
-            return NULL;
-        }
+        pslr_write_log(PSLR_ERROR, "Cannot open settings file %s\n", filename);
+        return NULL;
     }
     *jsonsize = lseek(jsonfd, 0, SEEK_END);
     lseek(jsonfd, 0, SEEK_SET);
     char *jsontext=malloc(*jsonsize);
     ssize_t ret = read(jsonfd, jsontext, *jsonsize);
+    close(jsonfd);
     if (ret < *jsonsize) {
-        fprintf(stderr, "Could not read pentax_settings.json file\n");
+        pslr_write_log(PSLR_ERROR, "Could not read settings file %s\n", filename);
         free(jsontext);
         return NULL;
     }
+    pslr_write_log(PSLR_WARNING, "Using the setting definitions of %s instead of the built-in ones\n", filename);
     DPRINT("json text:\n%.*s\n", *jsonsize, jsontext);
     return jsontext;
 }
 
-pslr_setting_def_t *setting_file_process(const char *cameraid, int *def_num) {
+static pslr_setting_def_t *setting_file_process(const char *cameraid, int *def_num) {
     pslr_setting_def_t defs[128];
+    int jsonsize;
     *def_num=0;
+    // read on every call, the result is cached in the setting map of the handle
+    char *jsontext = read_json_file(&jsonsize);
     if (jsontext == NULL) {
-        jsontext = read_json_file(&jsonsize);
+        return NULL;
     }
     size_t json_part_length;
     const char *json_part;
     if (!(json_part = js0n(cameraid, strlen(cameraid), jsontext, jsonsize, &json_part_length))) {
-        pslr_write_log(PSLR_ERROR, "JSON: Cannot find camera model\n");
+        DPRINT("JSON: Cannot find camera model %s\n", cameraid);
+        free(jsontext);
         return NULL;
     }
 
     if (!(json_part = js0n("fields", strlen("fields"), json_part, json_part_length, &json_part_length))) {
         pslr_write_log(PSLR_ERROR, "JSON: No fields defined for the camera model\n");
+        free(jsontext);
         return NULL;
     }
     int ai=0;
@@ -844,6 +910,7 @@ pslr_setting_def_t *setting_file_process(const char *cameraid, int *def_num) {
         char *camera_field_name;
         if (!(camera_field_name_ptr=js0n( "name", strlen("name"), json_array_part, json_array_part_length, &name_length))) {
             pslr_write_log(PSLR_ERROR, "No name is defined\n");
+            free(jsontext);
             return NULL;
         } else {
             camera_field_name=malloc(name_length+1);
@@ -854,6 +921,7 @@ pslr_setting_def_t *setting_file_process(const char *cameraid, int *def_num) {
         char *camera_field_type;
         if (!(camera_field_type_ptr=js0n( "type", strlen("type"), json_array_part, json_array_part_length, &type_length))) {
             pslr_write_log(PSLR_ERROR, "No type is defined\n");
+            free(jsontext);
             return NULL;
         } else {
             camera_field_type=malloc(type_length+1);
@@ -881,15 +949,106 @@ pslr_setting_def_t *setting_file_process(const char *cameraid, int *def_num) {
         }
         DPRINT("name: %.*s %.*s %.*s %.*s\n", (int)name_length, camera_field_name, (int)address_length, camera_field_address, (int)value_length, camera_field_value, (int)type_length, camera_field_type);
         pslr_setting_def_t setting_def = { camera_field_name, camera_field_address==NULL?0:strtoul(camera_field_address,NULL,16), camera_field_value, camera_field_type };
+        free(camera_field_address);
         defs[(*def_num)++]=setting_def;
         ++ai;
     }
+    free(jsontext);
     pslr_setting_def_t *ret=malloc(*def_num*sizeof(pslr_setting_def_t));
     //        printf("return %d defs\n",*def_num);
     memcpy(ret, defs, *def_num*sizeof(pslr_setting_def_t));
     return ret;
 }
 
+static uint32_t setting_name_hash(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+pslr_setting_map_t *pslr_setting_map_build(uint32_t id) {
+    char cameraid[20];
+    int i;
+    sprintf(cameraid, "0x%05x", id);
+    pslr_setting_map_t *map = calloc(1, sizeof (pslr_setting_map_t));
+    map->id = id;
+    // the file of PKTRIGGERCORD_SETTINGS overrides the built-in table
+    map->defs = setting_file_process(cameraid, &map->def_num);
+    map->allocated = map->defs != NULL;
+    if (map->defs == NULL) {
+        int low = 0;
+        int high = sizeof(settings_table)/sizeof(settings_table[0]) - 1;
+        map->def_num = 0;
+        while (low <= high) {
+            int middle = (low + high) / 2;
+            if (settings_table[middle].id == id) {
+                map->defs = settings_table[middle].defs;
+                map->def_num = settings_table[middle].def_num;
+                break;
+            } else if (settings_table[middle].id < id) {
+                low = middle + 1;
+            } else {
+                high = middle - 1;
+            }
+        }
+    }
+    for (i = 0; i < map->def_num; ++i) {
+        uint32_t slot = setting_name_hash(map->defs[i].name);
+        while (map->hash[slot % SETTING_MAP_HASH_SIZE] != 0) {
+            ++slot;
+        }
+        map->hash[slot % SETTING_MAP_HASH_SIZE] = i + 1;
+    }
+    DPRINT("setting map %s: %d defs\n", cameraid, map->def_num);
+    return map;
+}
+
+const pslr_setting_def_t *pslr_setting_map_find(const pslr_setting_map_t *map, const char *name) {
+    if (map == NULL) {
+        return NULL;
+    }
+    uint32_t slot = setting_name_hash(name);
+    int index;
+    while ((index = map->hash[slot % SETTING_MAP_HASH_SIZE]) != 0) {
+        if (strcmp(map->defs[index-1].name, name) == 0) {
+            return &map->defs[index-1];
+        }
+        ++slot;
+    }
+    return NULL;
+}
+
+void pslr_setting_map_free(pslr_setting_map_t *map) {
+    int i;
+    if (map == NULL) {
+        return;
+    }
+    if (map->allocated) {
+        for (i = 0; i < map->def_num; ++i) {
+            free((char *)map->defs[i].name);
+            free((char *)map->defs[i].value);
+            free((char *)map->defs[i].type);
+        }
+        free((pslr_setting_def_t *)map->defs);
+    }
+    free(map);
+}
+
+const pslr_setting_map_t *ipslr_get_setting_map(ipslr_handle_t *p) {
+    if (p->setting_map != NULL && p->setting_map->id != p->id) {
+        // another camera is connected using the same handle
+        pslr_setting_map_free(p->setting_map);
+        p->setting_map = NULL;
+    }
+    if (p->setting_map == NULL) {
+        p->setting_map = pslr_setting_map_build(p->id);
+    }
+    return p->setting_map;
+}
+
 pslr_bool_setting ipslr_settings_parse_bool(const uint8_t *buf, const pslr_setting_def_t *def) {
     pslr_bool_setting bool_setting;
     if (def->value != NULL) {
@@ -927,12 +1086,12 @@ pslr_uint16_setting ipslr_settings_parse_uint16(const uint8_t *buf, const pslr_s
     return uint16_setting;
 }
 
-void ipslr_settings_parser_json(const char *cameraid, ipslr_handle_t *p, pslr_settings *settings) {
+void ipslr_settings_parser_json(ipslr_handle_t *p, pslr_settings *settings) {
     uint8_t *buf = p->settings_buffer;
     memset(settings, 0, sizeof (*settings));
-    int def_num;
-
-    pslr_setting_def_t *defs = setting_file_process(cameraid,&def_num);
+    const pslr_setting_map_t *map = ipslr_get_setting_map(p);
+    const pslr_setting_def_t *defs = map->defs;
+    int def_num = map->def_num;
     int def_index=0;
     while (def_index < def_num) {
         pslr_bool_setting bool_setting;
@@ -1021,3 +1180,99 @@ ipslr_model_info_t *pslr_find_model_by_id( uint32_t id ) {
     //    DPRINT("not found\n");
     return NULL;
 }
+
+ipslr_model_info_t *pslr_find_model_by_name( const char *name ) {
+    unsigned int i;
+    for ( i = 0; i<sizeof (camera_models) / sizeof (camera_models[0]); i++) {
+        if ( strlen(camera_models[i].name) == strlen(name)
+                && str_comparison_i( camera_models[i].name, name, strlen(name) ) == 0 ) {
+            return &camera_models[i];
+        }
+    }
+    return NULL;
+}
+
+ipslr_model_info_t *pslr_get_model( int index ) {
+    if ( index < 0 || index >= (int)(sizeof (camera_models) / sizeof (camera_models[0])) ) {
+        return NULL;
+    }
+    return &camera_models[index];
+}
+
+static
+void set_uint16_le(uint16_t v, uint8_t *buf) {
+    buf[0] = v;
+    buf[1] = v >> 8;
+}
+
+static
+void set_uint16_be(uint16_t v, uint8_t *buf) {
+    buf[0] = v >> 8;
+    buf[1] = v;
+}
+
+// inverse of the bufmask parsing of the status parsers
+void ipslr_status_set_bufmask( ipslr_model_info_t *model, uint8_t *buf, uint16_t bufmask ) {
+    ipslr_status_parse_t parser = model->status_parser_function;
+    if ( parser == NULL ) {
+        return;
+    } else if ( parser == ipslr_status_parse_k10d || parser == ipslr_status_parse_k20d || parser == ipslr_status_parse_k200d ) {
+        set_uint16_be( bufmask, &buf[0x16] );
+    } else if ( parser == ipslr_status_parse_istds ) {
+        set_uint16_be( bufmask, &buf[0x12] );
+    } else if ( parser == ipslr_status_parse_k3 ) {
+        set_uint16_le( bufmask, &buf[0x1C] );
+    } else if ( parser == ipslr_status_parse_ks1 || parser == ipslr_status_parse_k1 || parser == ipslr_status_parse_k70 ) {
+        set_uint16_le( bufmask, &buf[0x0C] );
+    } else {
+        // ipslr_status_parse_common based parsers
+        int offset = parser == ipslr_status_parse_km ? 0x1E - 4 : 0x1E;
+        if ( model->is_little_endian ) {
+            set_uint16_le( bufmask, &buf[offset] );
+        } else {
+            set_uint16_be( bufmask, &buf[offset] );
+        }
+    }
+}
+
+/* The selected fields get the value of the full parse without a buffer, zero */
+static void ipslr_status_clear_fields( pslr_status *status, uint64_t fields ) {
+    fields &= PSLR_STATUS_ALL;
+    while ( fields ) {
+        int i = status_next_field( &fields );
+        uint8_t *field = (uint8_t *) status + status_fields[i].offset;
+        // the fields are scalars or rationals, constant sizes keep the memset inline
+        switch ( status_fields[i].size ) {
+            case 4:
+                memset( field, 0, 4 );
+                break;
+            case 8:
+                memset( field, 0, 8 );
+                break;
+            default:
+                memset( field, 0, status_fields[i].size );
+                break;
+        }
+    }
+}
+
+void ipslr_status_copy_fields( pslr_status *dst, const pslr_status *src, uint64_t fields ) {
+    fields &= PSLR_STATUS_ALL;
+    while ( fields ) {
+        int i = status_next_field( &fields );
+        memcpy( (uint8_t *) dst + status_fields[i].offset,
+                (const uint8_t *) src + status_fields[i].offset, status_fields[i].size );
+    }
+}
+
+uint64_t ipslr_status_changed_fields( const pslr_status *old_status, const pslr_status *new_status ) {
+    uint64_t changed = 0;
+    int i;
+    for ( i = 0; i < PSLR_STATUS_FIELD_MAX; ++i ) {
+        if ( memcmp( (const uint8_t *) old_status + status_fields[i].offset,
+                     (const uint8_t *) new_status + status_fields[i].offset, status_fields[i].size ) != 0 ) {
+            changed |= PSLR_STATUS_BIT(i);
+        }
+    }
+    return changed;
+}
@@ -37,6 +37,7 @@
 
 #include "pslr_enum.h"
 #include "pslr_scsi.h"
+#include "pslr_trace.h"
 
 #define MAX_RESOLUTION_SIZE 4
 #define MAX_STATUS_BUF_SIZE 456
@@ -107,6 +108,68 @@ typedef struct {
     uint32_t battery_4;
 } pslr_status;
 
+/* Bits of the pslr_status fields, see pslr_get_status_delta */
+typedef enum {
+    PSLR_STATUS_BUFMASK,
+    PSLR_STATUS_CURRENT_ISO,
+    PSLR_STATUS_CURRENT_SHUTTER_SPEED,
+    PSLR_STATUS_CURRENT_APERTURE,
+    PSLR_STATUS_LENS_MAX_APERTURE,
+    PSLR_STATUS_LENS_MIN_APERTURE,
+    PSLR_STATUS_SET_SHUTTER_SPEED,
+    PSLR_STATUS_SET_APERTURE,
+    PSLR_STATUS_MAX_SHUTTER_SPEED,
+    PSLR_STATUS_AUTO_BRACKET_MODE,
+    PSLR_STATUS_AUTO_BRACKET_EV,
+    PSLR_STATUS_AUTO_BRACKET_PICTURE_COUNT,
+    PSLR_STATUS_AUTO_BRACKET_PICTURE_COUNTER,
+    PSLR_STATUS_FIXED_ISO,
+    PSLR_STATUS_JPEG_RESOLUTION,
+    PSLR_STATUS_JPEG_SATURATION,
+    PSLR_STATUS_JPEG_QUALITY,
+    PSLR_STATUS_JPEG_CONTRAST,
+    PSLR_STATUS_JPEG_SHARPNESS,
+    PSLR_STATUS_JPEG_IMAGE_TONE,
+    PSLR_STATUS_JPEG_HUE,
+    PSLR_STATUS_ZOOM,
+    PSLR_STATUS_FOCUS,
+    PSLR_STATUS_IMAGE_FORMAT,
+    PSLR_STATUS_RAW_FORMAT,
+    PSLR_STATUS_LIGHT_METER_FLAGS,
+    PSLR_STATUS_EC,
+    PSLR_STATUS_CUSTOM_EV_STEPS,
+    PSLR_STATUS_CUSTOM_SENSITIVITY_STEPS,
+    PSLR_STATUS_EXPOSURE_MODE,
+    PSLR_STATUS_SCENE_MODE,
+    PSLR_STATUS_USER_MODE_FLAG,
+    PSLR_STATUS_AE_METERING_MODE,
+    PSLR_STATUS_AF_MODE,
+    PSLR_STATUS_AF_POINT_SELECT,
+    PSLR_STATUS_SELECTED_AF_POINT,
+    PSLR_STATUS_FOCUSED_AF_POINT,
+    PSLR_STATUS_AUTO_ISO_MIN,
+    PSLR_STATUS_AUTO_ISO_MAX,
+    PSLR_STATUS_DRIVE_MODE,
+    PSLR_STATUS_SHAKE_REDUCTION,
+    PSLR_STATUS_WHITE_BALANCE_MODE,
+    PSLR_STATUS_WHITE_BALANCE_ADJUST_MG,
+    PSLR_STATUS_WHITE_BALANCE_ADJUST_BA,
+    PSLR_STATUS_FLASH_MODE,
+    PSLR_STATUS_FLASH_EXPOSURE_COMPENSATION,
+    PSLR_STATUS_MANUAL_MODE_EV,
+    PSLR_STATUS_COLOR_SPACE,
+    PSLR_STATUS_LENS_ID1,
+    PSLR_STATUS_LENS_ID2,
+    PSLR_STATUS_BATTERY_1,
+    PSLR_STATUS_BATTERY_2,
+    PSLR_STATUS_BATTERY_3,
+    PSLR_STATUS_BATTERY_4,
+    PSLR_STATUS_FIELD_MAX
+} pslr_status_field_t;
+
+#define PSLR_STATUS_BIT(field) (1ULL << (field))
+#define PSLR_STATUS_ALL ((1ULL << PSLR_STATUS_FIELD_MAX) - 1)
+
 typedef enum {
     PSLR_SETTING_STATUS_UNKNOWN,
     PSLR_SETTING_STATUS_READ,
@@ -144,10 +207,23 @@ typedef struct {
     const char *type;
 } pslr_setting_def_t;
 
-typedef void (*ipslr_status_parse_t)(ipslr_handle_t *p, pslr_status *status);
-pslr_setting_def_t *pslr_find_setting_by_name (pslr_setting_def_t *array, int array_length, char *name);
-void ipslr_settings_parser_json(const char *cameraid, ipslr_handle_t *p, pslr_settings *settings);
-pslr_setting_def_t *setting_file_process(const char *cameraid, int *def_num);
+#define SETTING_MAP_HASH_SIZE 256
+
+/* Setting definitions of one camera model, from the built-in table or from the PKTRIGGERCORD_SETTINGS file */
+typedef struct {
+    uint32_t id;                                     // camera id
+    const pslr_setting_def_t *defs;
+    int def_num;
+    bool allocated;                                  // defs are parsed from the json file
+    int16_t hash[SETTING_MAP_HASH_SIZE];             // open addressing by name, def index + 1, 0 if empty
+} pslr_setting_map_t;
+
+/* Decodes the PSLR_STATUS_BIT fields of the status buffer, the others are not touched */
+typedef void (*ipslr_status_parse_t)(ipslr_handle_t *p, pslr_status *status, uint64_t fields);
+pslr_setting_map_t *pslr_setting_map_build(uint32_t id);
+const pslr_setting_def_t *pslr_setting_map_find(const pslr_setting_map_t *map, const char *name);
+void pslr_setting_map_free(pslr_setting_map_t *map);
+void ipslr_settings_parser_json(ipslr_handle_t *p, pslr_settings *settings);
 
 typedef struct {
     uint32_t id;                                     // Pentax model ID
@@ -171,6 +247,7 @@ typedef struct {
     bool has_jpeg_hue;                               // camera has jpeg hue setting
     int af_point_num;                                // number of AF points
     ipslr_status_parse_t status_parser_function;     // parse function for status buffer
+    double segment_delay;                            // shortest wait (sec) for the next segment info, 0: SEGMENT_DEFAULT_DELAY
 } ipslr_model_info_t;
 
 typedef struct {
@@ -179,7 +256,57 @@ typedef struct {
     uint32_t length;
 } ipslr_segment_t;
 
+typedef struct {
+    uint64_t bytes;                                  // downloaded bytes
+    uint32_t blocks;                                 // number of downloaded blocks
+    double seconds;                                  // time spent downloading
+    uint32_t segment_records;                        // segment info records read by pslr_buffer_open
+    double segment_seconds;                          // time spent selecting the buffers and reading the segment infos
+} pslr_download_stats_t;
+
+
+typedef struct {
+    uint32_t hits;                                   // status requests served from the cache
+    uint32_t misses;                                 // status buffers read from the camera
+    uint32_t invalidations;                          // cached status dropped by a command
+} pslr_status_cache_stats_t;
+
+#define BUFFER_POOL_CLASSES 12                       // size classes of 64K << n, up to 128M
+#define BUFFER_POOL_IDLE 2                           // released buffers kept per size class
+
+typedef struct {
+    uint32_t allocations;                            // buffers allocated from the heap
+    uint32_t reuses;                                 // requests served by a released buffer
+    uint32_t releases;
+    uint32_t in_use;                                 // buffers handed out and not released yet
+    uint32_t idle;                                   // released buffers kept for reuse
+    uint64_t bytes;                                  // memory held by the pool (in use + idle)
+    uint64_t peak_bytes;
+} pslr_buffer_pool_stats_t;
+
+typedef struct ipslr_pool_buffer ipslr_pool_buffer_t;
+
+/* Download progress, user_data is the value given to pslr_set_progress_callback */
+typedef void (*pslr_progress_callback_t)(uint32_t current, uint32_t total, uintptr_t user_data);
+
+/* Receives the downloaded image block by block, user_data is the value given to
+   pslr_buffer_download. A nonzero return value aborts the download. */
+typedef int (*pslr_buffer_sink_t)(const uint8_t *data, uint32_t len, uintptr_t user_data);
+
+#define MAX_COMMAND_STATS 64
+
+typedef struct {
+    uint8_t a;                                       // command 0x24 a b
+    uint8_t b;
+    uint32_t count;                                  // number of completed commands
+    uint32_t polls;                                  // status reads until completion
+    double total;                                    // sum of the latencies (sec)
+    double min;
+    double max;
+} pslr_command_stats_t;
+
 struct ipslr_handle {
+    pslr_transport_t *transport;
     FDTYPE fd;
     pslr_status status;
     pslr_settings settings;
@@ -190,10 +317,58 @@ struct ipslr_handle {
     uint32_t offset;
     uint8_t status_buffer[MAX_STATUS_BUF_SIZE];
     uint8_t settings_buffer[SETTINGS_BUFFER_SIZE];
+    bool async_download;                             // queue the download commands (scsi_submit)
+    int pack_id;                                     // id of the last queued command
+    bool mapped_download;                            // download into the mmap-ed reserved buffer
+    uint8_t *mapped_buffer;                          // scsi_map_buffer() region
+    pslr_download_stats_t download_stats;
+    pslr_trace_t *trace;                             // SCSI trace recording, NULL if disabled
+    uint16_t last_command;                           // a << 8 | b of the last command
+    double command_time;                             // when the last command was sent
+    bool command_pending;                            // its latency is not recorded yet
+    pslr_command_stats_t command_stats[MAX_COMMAND_STATS];
+    int command_stats_num;
+    double segment_time;                             // when the buffer was selected or the segment info was advanced last
+    bool segment_advanced;                           // the last one was an advance, not a buffer select
+    double segment_delay;                            // shortest time an advanced segment info needed, 0 if not seen yet
+    uint8_t segment_info[16];                        // raw segment info of the current record
+    bool segment_info_valid;                         // read since the last select or advance
+    pslr_setting_map_t *setting_map;                 // cached setting definitions, see ipslr_get_setting_map
+    pslr_progress_callback_t progress_callback;
+    uintptr_t progress_user_data;
+    char unknown_name[16];                           // name of an unknown camera model
+    uint8_t status_diff_buffer[MAX_STATUS_BUF_SIZE]; // previous status buffer for the debug diff
+    bool status_diff_valid;
+    bool shutter_armed;                              // shutter argument written, see pslr_shutter_arm
+    double shutter_sent_time;                        // when the last shutter command reached the camera
+    double status_cache_window;                      // a status younger than this is not read again, 0: no cache
+    double status_time;                              // when the cached status was read
+    bool status_valid;                               // no command could have changed it since
+    pslr_status_cache_stats_t status_cache_stats;
+    uint32_t status_parsed_len;                      // length of the parsed status_buffer, 0 if it is not parsed
+    uint64_t status_changed;                         // fields changed since the last pslr_get_status_delta
+    ipslr_pool_buffer_t *pool_idle[BUFFER_POOL_CLASSES]; // released buffers, see pslr_buffer_pool_get
+    ipslr_pool_buffer_t *pool_used;                  // buffers handed out
+    pslr_buffer_pool_stats_t pool_stats;
 };
 
+/* Returns the setting definitions of the camera, building them on the first call */
+const pslr_setting_map_t *ipslr_get_setting_map( ipslr_handle_t *p );
+
 ipslr_model_info_t *pslr_find_model_by_id( uint32_t id );
 
+ipslr_model_info_t *pslr_find_model_by_name( const char *name );
+
+/* Returns the index-th entry of the model table, NULL after the last one */
+ipslr_model_info_t *pslr_get_model( int index );
+
+/* Stores bufmask into a raw status buffer where the parser of the model reads it */
+void ipslr_status_set_bufmask( ipslr_model_info_t *model, uint8_t *buf, uint16_t bufmask );
+
+/* PSLR_STATUS_BIT mask of the fields that differ */
+uint64_t ipslr_status_changed_fields( const pslr_status *old_status, const pslr_status *new_status );
+void ipslr_status_copy_fields( pslr_status *dst, const pslr_status *src, uint64_t fields );
+
 int pslr_get_hw_jpeg_quality( ipslr_model_info_t *model, int user_jpeg_stars);
 
 uint32_t get_uint32_be(uint8_t *buf);
@@ -202,12 +377,11 @@ void set_uint32_be(uint32_t v, uint8_t *buf);
 void set_uint32_le(uint32_t v, uint8_t *buf);
 
 typedef uint32_t (*get_uint32_func)(uint8_t *buf);
-typedef uint16_t (*get_uint16_func)(const uint8_t *buf);
-typedef int32_t (*get_int32_func)(uint8_t *buf);
 
 char *pslr_hexdump(uint8_t *buf, uint32_t bufLen);
 void hexdump(uint8_t *buf, uint32_t bufLen);
 void hexdump_debug(uint8_t *buf, uint32_t bufLen);
-const char* int_to_binary( uint16_t x );
+/* b has room for the 16 digits and the terminating zero, it is returned */
+char* int_to_binary( uint16_t x, char *b );
 
 #endif
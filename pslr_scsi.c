@@ -33,3 +33,20 @@
 #include "pslr_scsi_linux.c"
 #endif
 #endif
+
+pslr_transport_t pslr_scsi_transport = {
+    "scsi",
+    NULL,
+    get_drives,
+    get_drive_info,
+    close_drive,
+    scsi_read,
+    scsi_write,
+    scsi_async_supported,
+    scsi_submit,
+    scsi_complete,
+    scsi_map_buffer,
+    scsi_unmap_buffer,
+    scsi_read_mapped,
+    scsi_get_sense
+};
@@ -78,4 +78,64 @@ pslr_result get_drive_info(char* drive_name, FDTYPE* device,
                            char* product_id, int product_id_size_max);
 
 void close_drive(FDTYPE *device);
+
+/* Copies the sense data of the last failed synchronous command, returns
+ * its length (0 if there is none). */
+int scsi_get_sense(FDTYPE sg_fd, uint8_t *sense, uint32_t senseLen);
+
+/* Maps the reserved buffer of the driver into the memory, reads issued by
+ * scsi_read_mapped() transfer the data into it without extra copy.
+ * Returns NULL if it is not supported. */
+uint8_t *scsi_map_buffer(FDTYPE sg_fd, uint32_t size);
+
+void scsi_unmap_buffer(FDTYPE sg_fd, uint8_t *map, uint32_t size);
+
+int scsi_read_mapped(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                     uint8_t *map, uint32_t bufLen);
+
+/* Queued command for the asynchronous interface. The buffers have to stay
+ * valid until scsi_complete() returns for the request. */
+typedef struct {
+    int pack_id;
+    bool to_device;
+    uint8_t cmd[16];
+    uint32_t cmdLen;
+    uint8_t *buf;
+    uint32_t bufLen;
+    bool mapped;                /* read into the scsi_map_buffer() region, buf points into it */
+    uint8_t sense[32];
+    uint32_t senseLen;
+    int result;                 /* return value of the matching scsi_read / scsi_write */
+} scsi_request_t;
+
+bool scsi_async_supported(FDTYPE sg_fd);
+
+int scsi_submit(FDTYPE sg_fd, scsi_request_t *req);
+
+int scsi_complete(FDTYPE sg_fd, scsi_request_t *req);
+
+/* Runtime selectable backend of the SCSI layer. The optional members
+ * (async_supported ... get_sense) can be NULL if the backend does not
+ * support queueing or mapped reads. */
+typedef struct {
+    const char *name;
+    const char *prefix;         /* device name prefix selecting the backend, NULL for the platform default */
+    char **(*get_drives)(int *drive_num);
+    pslr_result (*get_drive_info)(char* drive_name, FDTYPE* device,
+                                  char* vendor_id, int vendor_id_size_max,
+                                  char* product_id, int product_id_size_max);
+    void (*close_drive)(FDTYPE *device);
+    int (*read)(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen);
+    int (*write)(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen);
+    bool (*async_supported)(FDTYPE sg_fd);
+    int (*submit)(FDTYPE sg_fd, scsi_request_t *req);
+    int (*complete)(FDTYPE sg_fd, scsi_request_t *req);
+    uint8_t *(*map_buffer)(FDTYPE sg_fd, uint32_t size);
+    void (*unmap_buffer)(FDTYPE sg_fd, uint8_t *map, uint32_t size);
+    int (*read_mapped)(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen, uint8_t *map, uint32_t bufLen);
+    int (*get_sense)(FDTYPE sg_fd, uint8_t *sense, uint32_t senseLen);
+} pslr_transport_t;
+
+/* the platform backend (Linux sg, OpenBSD, Windows) */
+extern pslr_transport_t pslr_scsi_transport;
 #endif
@@ -36,13 +36,24 @@
 #endif
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "pslr_log.h"
 #include "pslr_model.h"
 #include "pslr_scsi.h"
 
+#ifndef SG_FLAG_MMAP_IO
+/* defined by the kernel <scsi/sg.h>, but missing from the glibc one */
+#define SG_FLAG_MMAP_IO 4
+#endif
+
 static const int MAX_DEVICE_NUM = 256;
 
+/* sense data of the last failed synchronous command of the thread */
+static __thread uint8_t last_sense[32];
+static __thread int last_sense_len = 0;
+
 void print_scsi_error(sg_io_hdr_t *pIo, uint8_t *sense_buffer) {
     int k;
 
@@ -67,6 +78,40 @@ void print_scsi_error(sg_io_hdr_t *pIo, uint8_t *sense_buffer) {
     }
 }
 
+static void print_scsi_cmd(uint8_t *cmd, uint32_t cmdLen) {
+    uint32_t i;
+
+    DPRINT("[S]\t\t\t\t\t >>> [");
+    for (i = 0; i < cmdLen; ++i) {
+        if (i > 0) {
+            DPRINT(" ");
+            if ((i%4) == 0 ) {
+                DPRINT(" ");
+            }
+        }
+        DPRINT("%02X", cmd[i]);
+    }
+    DPRINT("]\n");
+}
+
+static void print_scsi_data(const char *direction, uint8_t *buf, uint32_t bufLen) {
+    uint32_t i;
+
+    DPRINT("[S]\t\t\t\t\t %s [", direction);
+    for (i = 0; i < 32 && i < bufLen; ++i) {
+        if (i > 0) {
+            DPRINT(" ");
+            if (i % 16 == 0) {
+                DPRINT("\n\t\t\t\t\t      ");
+            } else if ((i%4) == 0 ) {
+                DPRINT(" ");
+            }
+        }
+        DPRINT("%02X", buf[i]);
+    }
+    DPRINT("]\n");
+}
+
 const char* device_dirs[2] = {"/sys/class/scsi_generic", "/sys/block"};
 const int device_dir_num = sizeof(device_dirs)/sizeof(device_dirs[0]);
 
@@ -174,12 +219,24 @@ void close_drive(int *device) {
     close( *device );
 }
 
-int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-              uint8_t *buf, uint32_t bufLen) {
+static void save_sense(sg_io_hdr_t *pIo, uint8_t *sense_buffer) {
+    last_sense_len = pIo->sb_len_wr;
+    memcpy(last_sense, sense_buffer, last_sense_len);
+}
+
+int scsi_get_sense(int sg_fd, uint8_t *sense, uint32_t senseLen) {
+    uint32_t len = (uint32_t)last_sense_len < senseLen ? (uint32_t)last_sense_len : senseLen;
+    memcpy(sense, last_sense, len);
+    return len;
+}
+
+/* buf is only used for the debug output if the data goes to the mmap-ed
+ * reserved buffer (SG_FLAG_MMAP_IO) */
+static int scsi_read_flags(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                           uint8_t *buf, uint32_t bufLen, unsigned int flags) {
     sg_io_hdr_t io;
     uint8_t sense[32];
     int r;
-    uint32_t i;
 
     memset(&io, 0, sizeof (io));
 
@@ -189,25 +246,15 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
     io.mx_sb_len = sizeof (sense);
     io.dxfer_direction = SG_DXFER_FROM_DEV;
     io.dxfer_len = bufLen;
-    io.dxferp = buf;
+    io.dxferp = (flags & SG_FLAG_MMAP_IO) ? NULL : buf;
     io.cmdp = cmd;
     io.sbp = sense;
     io.timeout = 20000; /* 20000 millisecs == 20 seconds */
-    /* io.flags = 0; */ /* take defaults: indirect IO, etc */
+    io.flags = flags;
     /* io.pack_id = 0; */
     /* io.usr_ptr = NULL; */
 
-    DPRINT("[S]\t\t\t\t\t >>> [");
-    for (i = 0; i < cmdLen; ++i) {
-        if (i > 0) {
-            DPRINT(" ");
-            if ((i%4) == 0 ) {
-                DPRINT(" ");
-            }
-        }
-        DPRINT("%02X", cmd[i]);
-    }
-    DPRINT("]\n");
+    print_scsi_cmd(cmd, cmdLen);
 
     r = ioctl(sg_fd, SG_IO, &io);
     if (r == -1) {
@@ -217,21 +264,10 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
 
     if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
         print_scsi_error(&io, sense);
+        save_sense(&io, sense);
         return -PSLR_SCSI_ERROR;
     } else {
-        DPRINT("[S]\t\t\t\t\t <<< [");
-        for (i = 0; i < 32 && i < (bufLen - io.resid); ++i) {
-            if (i > 0) {
-                DPRINT(" ");
-                if (i % 16 == 0) {
-                    DPRINT("\n\t\t\t\t\t      ");
-                } else if ((i%4) == 0 ) {
-                    DPRINT(" ");
-                }
-            }
-            DPRINT("%02X", buf[i]);
-        }
-        DPRINT("]\n");
+        print_scsi_data("<<<", buf, bufLen - io.resid);
 
         /* Older Pentax DSLR will report all bytes remaining, so make
          * a special case for this (treat it as all bytes read). */
@@ -243,13 +279,23 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
     }
 }
 
+int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
+              uint8_t *buf, uint32_t bufLen) {
+    /* take defaults: indirect IO, etc */
+    return scsi_read_flags(sg_fd, cmd, cmdLen, buf, bufLen, 0);
+}
+
+int scsi_read_mapped(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                     uint8_t *map, uint32_t bufLen) {
+    return scsi_read_flags(sg_fd, cmd, cmdLen, map, bufLen, SG_FLAG_MMAP_IO);
+}
+
 int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
                uint8_t *buf, uint32_t bufLen) {
 
     sg_io_hdr_t io;
     uint8_t sense[32];
     int r;
-    uint32_t i;
 
     memset(&io, 0, sizeof (io));
 
@@ -268,32 +314,10 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
     /* io.usr_ptr = NULL; */
 
     /*  print debug scsi cmd */
-    DPRINT("[S]\t\t\t\t\t >>> [");
-    for (i = 0; i < cmdLen; ++i) {
-        if (i > 0) {
-            DPRINT(" ");
-            if ((i%4) == 0 ) {
-                DPRINT(" ");
-            }
-        }
-        DPRINT("%02X", cmd[i]);
-    }
-    DPRINT("]\n");
+    print_scsi_cmd(cmd, cmdLen);
     if (bufLen > 0) {
         /*  print debug write buffer */
-        DPRINT("[S]\t\t\t\t\t >>> [");
-        for (i = 0; i < 32 && i < bufLen; ++i) {
-            if (i > 0) {
-                DPRINT(" ");
-                if (i % 16 == 0) {
-                    DPRINT("\n\t\t\t\t\t      ");
-                } else if ((i%4) == 0 ) {
-                    DPRINT(" ");
-                }
-            }
-            DPRINT("%02X", buf[i]);
-        }
-        DPRINT("]\n");
+        print_scsi_data(">>>", buf, bufLen);
     }
 
     r = ioctl(sg_fd, SG_IO, &io);
@@ -305,8 +329,130 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
 
     if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
         print_scsi_error(&io, sense);
+        save_sense(&io, sense);
         return PSLR_SCSI_ERROR;
     } else {
         return PSLR_OK;
     }
 }
+
+/* The write()/read() interface and the reserved buffer mapping are only
+ * provided by the sg driver, block devices (/dev/sdX) would treat them as
+ * disk I/O. */
+static bool is_sg_device(int sg_fd) {
+    struct stat st;
+    int version;
+
+    if (fstat(sg_fd, &st) == -1 || !S_ISCHR(st.st_mode)) {
+        return false;
+    }
+    if (ioctl(sg_fd, SG_GET_VERSION_NUM, &version) == -1 || version < 30000) {
+        return false;
+    }
+    return true;
+}
+
+bool scsi_async_supported(int sg_fd) {
+    int force_pack_id = 1;
+
+    if (!is_sg_device(sg_fd)) {
+        return false;
+    }
+    /* read() should return the request we are waiting for, not the
+     * first completed one */
+    if (ioctl(sg_fd, SG_SET_FORCE_PACK_ID, &force_pack_id) == -1) {
+        return false;
+    }
+    return true;
+}
+
+int scsi_submit(int sg_fd, scsi_request_t *req) {
+    sg_io_hdr_t io;
+
+    memset(&io, 0, sizeof (io));
+
+    io.interface_id = 'S';
+    io.cmd_len = req->cmdLen;
+    io.mx_sb_len = sizeof (req->sense);
+    io.dxfer_direction = req->to_device ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+    io.dxfer_len = req->bufLen;
+    io.dxferp = req->mapped ? NULL : req->buf;
+    io.cmdp = req->cmd;
+    io.sbp = req->sense;
+    io.timeout = 20000; /* 20000 millisecs == 20 seconds */
+    io.flags = req->mapped ? SG_FLAG_MMAP_IO : 0;
+    io.pack_id = req->pack_id;
+    io.usr_ptr = req;
+
+    print_scsi_cmd(req->cmd, req->cmdLen);
+    if (req->to_device && req->bufLen > 0) {
+        print_scsi_data(">>>", req->buf, req->bufLen);
+    }
+
+    if (write(sg_fd, &io, sizeof (io)) == -1) {
+        perror("write");
+        req->result = req->to_device ? PSLR_DEVICE_ERROR : -PSLR_DEVICE_ERROR;
+        return PSLR_DEVICE_ERROR;
+    }
+    return PSLR_OK;
+}
+
+int scsi_complete(int sg_fd, scsi_request_t *req) {
+    sg_io_hdr_t io;
+
+    memset(&io, 0, sizeof (io));
+    io.interface_id = 'S';
+    io.dxfer_direction = req->to_device ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+    io.pack_id = req->pack_id;
+
+    if (read(sg_fd, &io, sizeof (io)) == -1) {
+        perror("read");
+        req->result = req->to_device ? PSLR_DEVICE_ERROR : -PSLR_DEVICE_ERROR;
+        return req->result;
+    }
+
+    if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+        print_scsi_error(&io, req->sense);
+        req->senseLen = io.sb_len_wr;
+        req->result = req->to_device ? PSLR_SCSI_ERROR : -PSLR_SCSI_ERROR;
+    } else if (req->to_device) {
+        req->result = PSLR_OK;
+    } else {
+        print_scsi_data("<<<", req->buf, req->bufLen - io.resid);
+        /* same special case as in scsi_read */
+        if ((uint32_t)io.resid == req->bufLen) {
+            req->result = req->bufLen;
+        } else {
+            req->result = req->bufLen - io.resid;
+        }
+    }
+    return req->result;
+}
+
+uint8_t *scsi_map_buffer(int sg_fd, uint32_t size) {
+    int reserved_size = size;
+    void *map;
+
+    if (!is_sg_device(sg_fd)) {
+        return NULL;
+    }
+    if (ioctl(sg_fd, SG_SET_RESERVED_SIZE, &reserved_size) == -1) {
+        perror("ioctl");
+        return NULL;
+    }
+    /* the driver can silently limit the size */
+    if (ioctl(sg_fd, SG_GET_RESERVED_SIZE, &reserved_size) == -1 || (uint32_t)reserved_size < size) {
+        DPRINT("Reserved buffer is only %d bytes instead of %d\n", reserved_size, size);
+        return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sg_fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return map;
+}
+
+void scsi_unmap_buffer(int sg_fd, uint8_t *map, uint32_t size) {
+    munmap(map, size);
+}
@@ -156,6 +156,10 @@ pslr_result get_drive_info(char* drive_name, int* device,
     return PSLR_OK;
 }
 
+int scsi_get_sense(int sg_fd, uint8_t *sense, uint32_t senseLen) {
+    return 0;
+}
+
 void close_drive(int *device) {
     close( *device );
 }
@@ -298,3 +302,34 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
         return PSLR_OK;
     }
 }
+
+bool scsi_async_supported(int sg_fd) {
+    return false;
+}
+
+/* No command queueing on this platform, the request is executed right away */
+int scsi_submit(int sg_fd, scsi_request_t *req) {
+    if (req->to_device) {
+        req->result = scsi_write(sg_fd, req->cmd, req->cmdLen, req->buf, req->bufLen);
+    } else {
+        req->result = scsi_read(sg_fd, req->cmd, req->cmdLen, req->buf, req->bufLen);
+    }
+    return PSLR_OK;
+}
+
+int scsi_complete(int sg_fd, scsi_request_t *req) {
+    return req->result;
+}
+
+/* The reserved buffer mapping is Linux sg specific */
+uint8_t *scsi_map_buffer(int sg_fd, uint32_t size) {
+    return NULL;
+}
+
+void scsi_unmap_buffer(int sg_fd, uint8_t *map, uint32_t size) {
+}
+
+int scsi_read_mapped(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                     uint8_t *map, uint32_t bufLen) {
+    return -PSLR_DEVICE_ERROR;
+}
@@ -0,0 +1,255 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "pslr_log.h"
+#include "pslr_model.h"
+#include "pslr_utils.h"
+#include "pslr_trace.h"
+#include "pslr_scsi_replay.h"
+
+#define REPLAY_MAX_SESSIONS 8
+
+typedef struct {
+    bool used;
+    pslr_trace_record_t *records;
+    int record_num;
+    int next;                   /* index of the next record to serve */
+    double cmd_time;            /* host time of the last non status command */
+    uint64_t cmd_timestamp;     /* trace time of the same command */
+    uint8_t status[8];          /* last served status */
+    uint8_t sense[32];
+    uint32_t sense_len;
+} replay_session_t;
+
+static replay_session_t replay_sessions[REPLAY_MAX_SESSIONS];
+/* guards the used flags, the sessions can be opened from several threads */
+static pthread_mutex_t replay_sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool replay_realtime = false;
+
+void pslr_replay_set_realtime(bool realtime) {
+    replay_realtime = realtime;
+}
+
+static replay_session_t *replay_get_session(int fd) {
+    if (fd < 0 || fd >= REPLAY_MAX_SESSIONS || !replay_sessions[fd].used) {
+        return NULL;
+    }
+    return &replay_sessions[fd];
+}
+
+static bool is_status_read(uint8_t *cmd) {
+    return cmd[0] == 0xf0 && cmd[1] == 0x26;
+}
+
+static void replay_wait(pslr_trace_record_t *rec) {
+    if (replay_realtime) {
+        sleep_sec(rec->duration / 1000000000.0);
+    }
+}
+
+static void replay_set_sense(replay_session_t *s, pslr_trace_record_t *rec) {
+    s->sense_len = rec->sense_len;
+    memcpy(s->sense, rec->sense, rec->sense_len);
+}
+
+/* The recorded status reads after the last command: the latest one that
+ * was already recorded at the same time after the command in realtime
+ * mode, the final one otherwise. */
+static int replay_status(replay_session_t *s, uint8_t *buf, uint32_t bufLen) {
+    pslr_trace_record_t *rec;
+    double elapsed = get_monotonic_sec() - s->cmd_time;
+    int i = s->next;
+    int selected = -1;
+
+    while (i < s->record_num && is_status_read(s->records[i].cmd)) {
+        if (selected == -1 || !replay_realtime
+                || (s->records[i].timestamp - s->cmd_timestamp) / 1000000000.0 <= elapsed) {
+            selected = i;
+        }
+        ++i;
+    }
+    memset(buf, 0, bufLen);
+    if (selected == -1) {
+        // polled more than during the recording, the camera is not busy any more
+        if (s->status[7] == 0x01) {
+            s->status[7] = 0;
+            s->status[6] = 0x01;
+        }
+        memcpy(buf, s->status, bufLen < 8 ? bufLen : 8);
+        return bufLen < 8 ? bufLen : 8;
+    }
+    rec = &s->records[selected];
+    s->next = selected;
+    replay_wait(rec);
+    replay_set_sense(s, rec);
+    memcpy(s->status, rec->data, rec->data_len < 8 ? rec->data_len : 8);
+    memcpy(buf, rec->data, rec->data_len < bufLen ? rec->data_len : bufLen);
+    return rec->result;
+}
+
+/* Next recorded non status command, it has to match the issued one */
+static pslr_trace_record_t *replay_next(replay_session_t *s, bool to_device, uint8_t *cmd, uint32_t cmdLen) {
+    pslr_trace_record_t *rec;
+
+    while (s->next < s->record_num && is_status_read(s->records[s->next].cmd)) {
+        ++s->next;
+    }
+    if (s->next == s->record_num) {
+        DPRINT("Replay: end of the trace\n");
+        return NULL;
+    }
+    rec = &s->records[s->next];
+    if (rec->to_device != to_device || rec->cmd_len != cmdLen || memcmp(rec->cmd, cmd, cmdLen) != 0) {
+        DPRINT("Replay: record %d differs from the command %02X %02X %02X %02X\n", s->next, cmd[1], cmd[2], cmd[3], cmd[4]);
+        return NULL;
+    }
+    ++s->next;
+    s->cmd_time = get_monotonic_sec();
+    s->cmd_timestamp = rec->timestamp;
+    replay_wait(rec);
+    replay_set_sense(s, rec);
+    return rec;
+}
+
+static char **replay_get_drives(int *drive_num) {
+    // the trace file has to be specified
+    *drive_num = 0;
+    return NULL;
+}
+
+static pslr_result replay_get_drive_info(char* drive_name, FDTYPE* device,
+        char* vendor_id, int vendor_id_size_max,
+        char* product_id, int product_id_size_max) {
+    replay_session_t *s;
+    int fd;
+
+    vendor_id[0] = '\0';
+    product_id[0] = '\0';
+    pthread_mutex_lock(&replay_sessions_lock);
+    for (fd = 0; fd < REPLAY_MAX_SESSIONS && replay_sessions[fd].used; ++fd) {
+    }
+    if (fd == REPLAY_MAX_SESSIONS) {
+        pthread_mutex_unlock(&replay_sessions_lock);
+        return PSLR_DEVICE_ERROR;
+    }
+    s = &replay_sessions[fd];
+    memset(s, 0, sizeof(*s));
+    s->used = true;
+    pthread_mutex_unlock(&replay_sessions_lock);
+    s->record_num = pslr_trace_load(drive_name, &s->records);
+    if (s->record_num < 0) {
+        pthread_mutex_lock(&replay_sessions_lock);
+        s->used = false;
+        pthread_mutex_unlock(&replay_sessions_lock);
+        return PSLR_DEVICE_ERROR;
+    }
+    snprintf(vendor_id, vendor_id_size_max, "PENTAX");
+    snprintf(product_id, product_id_size_max, "DIGITAL_CAMERA");
+    *device = fd;
+    return PSLR_OK;
+}
+
+static void replay_close_drive(FDTYPE *device) {
+    replay_session_t *s = replay_get_session(*device);
+    if (s) {
+        DPRINT("Replay: %d of %d records served\n", s->next, s->record_num);
+        pslr_trace_free_records(s->records, s->record_num);
+        pthread_mutex_lock(&replay_sessions_lock);
+        s->used = false;
+        pthread_mutex_unlock(&replay_sessions_lock);
+    }
+}
+
+static int replay_read(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                       uint8_t *buf, uint32_t bufLen) {
+    replay_session_t *s = replay_get_session(sg_fd);
+    pslr_trace_record_t *rec;
+
+    if (s == NULL) {
+        return -PSLR_DEVICE_ERROR;
+    }
+    if (is_status_read(cmd)) {
+        return replay_status(s, buf, bufLen);
+    }
+    rec = replay_next(s, false, cmd, cmdLen);
+    if (rec == NULL) {
+        return -PSLR_SCSI_ERROR;
+    }
+    memcpy(buf, rec->data, rec->data_len < bufLen ? rec->data_len : bufLen);
+    return rec->result;
+}
+
+static int replay_write(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                        uint8_t *buf, uint32_t bufLen) {
+    replay_session_t *s = replay_get_session(sg_fd);
+    pslr_trace_record_t *rec;
+
+    if (s == NULL) {
+        return PSLR_DEVICE_ERROR;
+    }
+    rec = replay_next(s, true, cmd, cmdLen);
+    if (rec == NULL) {
+        return PSLR_SCSI_ERROR;
+    }
+    if (rec->data_len != bufLen || (bufLen > 0 && memcmp(rec->data, buf, bufLen) != 0)) {
+        DPRINT("Replay: the data of record %d differs\n", s->next - 1);
+    }
+    return rec->result;
+}
+
+static int replay_get_sense(FDTYPE sg_fd, uint8_t *sense, uint32_t senseLen) {
+    replay_session_t *s = replay_get_session(sg_fd);
+    uint32_t len;
+
+    if (s == NULL) {
+        return 0;
+    }
+    len = s->sense_len < senseLen ? s->sense_len : senseLen;
+    memcpy(sense, s->sense, len);
+    return len;
+}
+
+pslr_transport_t pslr_replay_transport = {
+    "replay",
+    "replay:",
+    replay_get_drives,
+    replay_get_drive_info,
+    replay_close_drive,
+    replay_read,
+    replay_write,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    replay_get_sense
+};
@@ -0,0 +1,46 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PSLR_SCSI_REPLAY_H
+#define PSLR_SCSI_REPLAY_H
+
+#include "pslr_scsi.h"
+
+/* Serves a recorded trace (see pslr_trace.h) back instead of a camera,
+ * selected by the "replay:" device prefix, e.g. --device=replay:k3.trace.
+ *
+ * The commands have to come in the recorded order, except the status
+ * reads (0xF0 0x26): their number depends on the polling, so surplus
+ * recorded status reads are skipped and missing ones are answered with
+ * the last status. */
+extern pslr_transport_t pslr_replay_transport;
+
+/* In realtime mode every call takes as long as the recorded one and the
+ * camera stays busy as long as it did during the recording, otherwise
+ * the replay runs as fast as possible. */
+void pslr_replay_set_realtime(bool realtime);
+
+#endif
@@ -0,0 +1,421 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "pslr_log.h"
+#include "pslr.h"
+#include "pslr_utils.h"
+#include "pslr_scsi_sim.h"
+
+#define SIM_MAX_CAMERAS 8
+#define SIM_RESULT_SIZE 1024
+#define SIM_SETTINGS_SIZE 1024
+#define SIM_MAX_BUFFERS 16
+#define SIM_MAX_RECORDS 10
+#define SIM_COMMAND_TIME 0.002  /* seconds the camera is busy after a command */
+#define SIM_EXPOSURE_TIME 0.3   /* time until a new picture appears in bufmask */
+#define SIM_SEGMENT_TIME 0.02   /* time until the next segment info is valid */
+
+typedef struct {
+    uint32_t a;
+    uint32_t b;
+    uint32_t addr;
+    uint32_t length;
+} sim_segment_record_t;
+
+typedef struct {
+    bool used;
+    ipslr_model_info_t *model;
+    uint8_t args[64];
+    uint8_t result[SIM_RESULT_SIZE];
+    uint32_t result_len;
+    uint8_t status_code;
+    double busy_until;
+    uint16_t bufmask;
+    uint16_t pending_bufmask;   /* pictures still being exposed */
+    double exposure_done;
+    uint8_t status_buffer[MAX_STATUS_BUF_SIZE];
+    uint8_t settings[SIM_SETTINGS_SIZE];
+    sim_segment_record_t records[SIM_MAX_RECORDS];
+    int record_num;
+    int record_index;
+    double segment_ready;
+    uint32_t download_addr;
+    uint32_t download_len;
+} sim_camera_t;
+
+static sim_camera_t sim_cameras[SIM_MAX_CAMERAS];
+/* guards the used flags, the cameras can be opened from several threads */
+static pthread_mutex_t sim_cameras_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static sim_camera_t *sim_get_camera(int fd) {
+    if (fd < 0 || fd >= SIM_MAX_CAMERAS || !sim_cameras[fd].used) {
+        return NULL;
+    }
+    return &sim_cameras[fd];
+}
+
+static uint32_t sim_get_uint32(sim_camera_t *cam, uint8_t *buf) {
+    return cam->model->is_little_endian ? get_uint32_le(buf) : get_uint32_be(buf);
+}
+
+static void sim_set_uint32(sim_camera_t *cam, uint32_t v, uint8_t *buf) {
+    if (cam->model->is_little_endian) {
+        set_uint32_le(v, buf);
+    } else {
+        set_uint32_be(v, buf);
+    }
+}
+
+static uint32_t sim_arg(sim_camera_t *cam, int i) {
+    return sim_get_uint32(cam, &cam->args[4 * i]);
+}
+
+/* Content of the simulated camera memory, depends only on the address */
+static uint8_t sim_data(uint32_t addr) {
+    return (addr * 2654435761u) >> 24;
+}
+
+/* Applies the pictures whose exposure has been finished */
+static void sim_update(sim_camera_t *cam) {
+    if (cam->pending_bufmask && get_monotonic_sec() >= cam->exposure_done) {
+        cam->bufmask |= cam->pending_bufmask;
+        cam->pending_bufmask = 0;
+    }
+    ipslr_status_set_bufmask(cam->model, cam->status_buffer, cam->bufmask);
+}
+
+static void sim_set_result(sim_camera_t *cam, uint8_t *buf, uint32_t len) {
+    memcpy(cam->result, buf, len);
+    cam->result_len = len;
+}
+
+static uint32_t sim_buffer_size(sim_camera_t *cam, uint32_t buftype) {
+    uint32_t megapixel = cam->model->jpeg_resolutions[0];
+    switch (buftype) {
+        case PSLR_BUF_PEF:
+        case PSLR_BUF_DNG:
+            return megapixel * 1250000 + 4321;
+        case PSLR_BUF_JPEG_MAX:
+        case PSLR_BUF_JPEG_MAX_M1:
+        case PSLR_BUF_JPEG_MAX_M2:
+        case PSLR_BUF_JPEG_MAX_M3:
+            return cam->model->jpeg_resolutions[buftype - PSLR_BUF_JPEG_MAX] * 400000 + 777;
+        case PSLR_BUF_PREVIEW:
+            return 150 * 1024 + 55;
+        default:
+            return 12 * 1024 + 3;
+    }
+}
+
+static void sim_add_record(sim_camera_t *cam, uint32_t b, uint32_t addr, uint32_t length) {
+    sim_segment_record_t *r = &cam->records[cam->record_num++];
+    r->a = 0;
+    r->b = b;
+    r->addr = addr;
+    r->length = length;
+}
+
+/* Segment info records of a buffer: first, (offset, data) for every
+ * segment, last. The data is split into two segments like real PEF
+ * buffers. */
+static void sim_select_buffer(sim_camera_t *cam, uint32_t bufno, uint32_t buftype) {
+    uint32_t size = sim_buffer_size(cam, buftype);
+    uint32_t base = 0x10000000 + bufno * 0x08000000 + buftype * 0x00800000;
+    uint32_t first = size > 0x30000 ? 0x30000 - 0x100 : size;
+
+    cam->record_num = 0;
+    cam->record_index = 0;
+    cam->segment_ready = 0;
+    sim_add_record(cam, 1, 0, 0);
+    sim_add_record(cam, 4, 0, 0);
+    sim_add_record(cam, 3, base, first);
+    if (first < size) {
+        sim_add_record(cam, 4, 0, first);
+        sim_add_record(cam, 3, base + 0x00400000, size - first);
+    }
+    sim_add_record(cam, 2, 0, 0);
+}
+
+static uint8_t sim_command(sim_camera_t *cam, int a, int b, uint32_t arglen) {
+    uint8_t buf[SIM_RESULT_SIZE];
+    double now = get_monotonic_sec();
+    int i;
+
+    memset(buf, 0, sizeof(buf));
+    cam->result_len = 0;
+    cam->busy_until = now + SIM_COMMAND_TIME;
+    switch (a << 8 | b) {
+        case 0x0001:
+            sim_set_result(cam, buf, cam->model->old_scsi_command ? 16 : 28);
+            break;
+        case 0x0004:
+            if (cam->model->is_little_endian) {
+                set_uint32_le(cam->model->id, buf);
+            } else {
+                set_uint32_be(cam->model->id, buf);
+            }
+            sim_set_result(cam, buf, 8);
+            break;
+        case 0x0005:
+            sim_set_result(cam, buf, 0xb8);
+            break;
+        case 0x0008:
+            sim_set_result(cam, cam->status_buffer, cam->model->status_buffer_size);
+            break;
+        case 0x0101:
+            buf[0] = 1;
+            buf[1] = 0;
+            buf[2] = 0;
+            buf[3] = 1;
+            sim_set_result(cam, buf, 4);
+            break;
+        case 0x0200:
+            sim_set_uint32(cam, cam->bufmask, buf);
+            sim_set_result(cam, buf, 8);
+            break;
+        case 0x0201:
+            if (sim_arg(cam, 0) >= SIM_MAX_BUFFERS || (cam->bufmask & (1 << sim_arg(cam, 0))) == 0) {
+                return 0x82;
+            }
+            sim_select_buffer(cam, sim_arg(cam, 0), sim_arg(cam, 1));
+            break;
+        case 0x0203:
+            if (sim_arg(cam, 0) < SIM_MAX_BUFFERS) {
+                cam->bufmask &= ~(1 << sim_arg(cam, 0));
+            }
+            break;
+        case 0x0400:
+            if (cam->record_num == 0) {
+                return 0x82;
+            }
+            if (now >= cam->segment_ready) {
+                sim_segment_record_t *r = &cam->records[cam->record_index];
+                sim_set_uint32(cam, r->a, buf);
+                sim_set_uint32(cam, r->b, buf + 4);
+                sim_set_uint32(cam, r->addr, buf + 8);
+                sim_set_uint32(cam, r->length, buf + 12);
+            }
+            sim_set_result(cam, buf, 16);
+            break;
+        case 0x0401:
+            if (cam->record_num == 0) {
+                return 0x82;
+            }
+            if (++cam->record_index == cam->record_num) {
+                cam->record_num = 0;
+            }
+            cam->segment_ready = now + SIM_SEGMENT_TIME;
+            break;
+        case 0x0600:
+            cam->download_addr = sim_arg(cam, 0);
+            cam->download_len = sim_arg(cam, 1);
+            break;
+        case 0x1005:
+            if (sim_arg(cam, 0) == 2) {
+                uint16_t used = cam->bufmask | cam->pending_bufmask;
+                if (cam->model->bufmask_single) {
+                    if (used == 0) {
+                        cam->pending_bufmask = 1;
+                    }
+                } else {
+                    for (i = 0; i < SIM_MAX_BUFFERS; i++) {
+                        if ((used & (1 << i)) == 0) {
+                            cam->pending_bufmask |= 1 << i;
+                            break;
+                        }
+                    }
+                }
+                cam->exposure_done = now + SIM_EXPOSURE_TIME;
+            }
+            break;
+        case 0x2006: {
+            time_t t = time(NULL);
+            struct tm *tm = localtime(&t);
+            sim_set_uint32(cam, tm->tm_year + 1900, buf);
+            sim_set_uint32(cam, tm->tm_mon + 1, buf + 4);
+            sim_set_uint32(cam, tm->tm_mday, buf + 8);
+            sim_set_uint32(cam, tm->tm_hour, buf + 12);
+            sim_set_uint32(cam, tm->tm_min, buf + 16);
+            sim_set_uint32(cam, tm->tm_sec, buf + 20);
+            sim_set_result(cam, buf, 24);
+            break;
+        }
+        case 0x2008:
+            if (sim_arg(cam, 0) < SIM_SETTINGS_SIZE) {
+                cam->settings[sim_arg(cam, 0)] = sim_arg(cam, 1);
+            }
+            break;
+        case 0x2009:
+            if (sim_arg(cam, 0) >= SIM_SETTINGS_SIZE) {
+                return 0x81;
+            }
+            sim_set_uint32(cam, cam->settings[sim_arg(cam, 0)], buf);
+            sim_set_result(cam, buf, 4);
+            break;
+        default:
+            // mode changes, buttons and x18 setters are accepted without any effect
+            break;
+    }
+    return 0;
+}
+
+static char **sim_get_drives(int *drive_num) {
+    ipslr_model_info_t *model;
+    char **ret;
+    int i = 0;
+
+    while (pslr_get_model(i) != NULL) {
+        ++i;
+    }
+    ret = malloc(i * sizeof(char *));
+    *drive_num = 0;
+    while ((model = pslr_get_model(*drive_num)) != NULL) {
+        ret[*drive_num] = strdup(model->name);
+        ++*drive_num;
+    }
+    return ret;
+}
+
+static pslr_result sim_get_drive_info(char* drive_name, FDTYPE* device,
+                                      char* vendor_id, int vendor_id_size_max,
+                                      char* product_id, int product_id_size_max) {
+    ipslr_model_info_t *model = pslr_find_model_by_name(drive_name);
+    int fd;
+
+    vendor_id[0] = '\0';
+    product_id[0] = '\0';
+    if (model == NULL) {
+        DPRINT("Unknown simulated camera %s\n", drive_name);
+        return PSLR_DEVICE_ERROR;
+    }
+    pthread_mutex_lock(&sim_cameras_lock);
+    for (fd = 0; fd < SIM_MAX_CAMERAS && sim_cameras[fd].used; ++fd) {
+    }
+    if (fd == SIM_MAX_CAMERAS) {
+        pthread_mutex_unlock(&sim_cameras_lock);
+        return PSLR_DEVICE_ERROR;
+    }
+    memset(&sim_cameras[fd], 0, sizeof(sim_cameras[fd]));
+    sim_cameras[fd].used = true;
+    sim_cameras[fd].model = model;
+    pthread_mutex_unlock(&sim_cameras_lock);
+    snprintf(vendor_id, vendor_id_size_max, "PENTAX");
+    snprintf(product_id, product_id_size_max, "DIGITAL_CAMERA");
+    *device = fd;
+    DPRINT("Simulated camera %s: %d\n", model->name, fd);
+    return PSLR_OK;
+}
+
+static void sim_close_drive(FDTYPE *device) {
+    sim_camera_t *cam = sim_get_camera(*device);
+    if (cam) {
+        pthread_mutex_lock(&sim_cameras_lock);
+        cam->used = false;
+        pthread_mutex_unlock(&sim_cameras_lock);
+    }
+}
+
+static int sim_read(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                    uint8_t *buf, uint32_t bufLen) {
+    sim_camera_t *cam = sim_get_camera(sg_fd);
+    uint32_t len;
+    uint32_t i;
+
+    if (cam == NULL) {
+        return -PSLR_DEVICE_ERROR;
+    }
+    sim_update(cam);
+    memset(buf, 0, bufLen);
+    if (cmd[1] == 0x26) {
+        if (get_monotonic_sec() < cam->busy_until) {
+            buf[7] = 0x01;
+        } else {
+            set_uint32_le(cam->result_len, buf);
+            buf[6] = 0x01;
+            buf[7] = cam->status_code;
+        }
+        return bufLen < 8 ? bufLen : 8;
+    } else if (cmd[1] == 0x49) {
+        uint32_t offset = cmd[2] | cmd[3] << 8;
+        len = offset < cam->result_len ? cam->result_len - offset : 0;
+        len = len < bufLen ? len : bufLen;
+        memcpy(buf, cam->result + offset, len);
+        return len;
+    } else if (cmd[1] == 0x24 && cmd[2] == 0x06 && cmd[3] == 0x02) {
+        len = cam->download_len < bufLen ? cam->download_len : bufLen;
+        for (i = 0; i < len; i++) {
+            buf[i] = sim_data(cam->download_addr + i);
+        }
+        return len;
+    }
+    DPRINT("Simulated camera: unknown read command %02X %02X\n", cmd[1], cmd[2]);
+    return -PSLR_SCSI_ERROR;
+}
+
+static int sim_write(FDTYPE sg_fd, uint8_t *cmd, uint32_t cmdLen,
+                     uint8_t *buf, uint32_t bufLen) {
+    sim_camera_t *cam = sim_get_camera(sg_fd);
+
+    if (cam == NULL) {
+        return PSLR_DEVICE_ERROR;
+    }
+    sim_update(cam);
+    if (cmd[1] == 0x4f) {
+        if (cmd[2] + bufLen > sizeof(cam->args)) {
+            return PSLR_SCSI_ERROR;
+        }
+        memcpy(cam->args + cmd[2], buf, bufLen);
+        return PSLR_OK;
+    } else if (cmd[1] == 0x24) {
+        cam->status_code = sim_command(cam, cmd[2], cmd[3], cmd[4]);
+        return PSLR_OK;
+    }
+    DPRINT("Simulated camera: unknown write command %02X\n", cmd[1]);
+    return PSLR_SCSI_ERROR;
+}
+
+pslr_transport_t pslr_sim_transport = {
+    "sim",
+    "sim:",
+    sim_get_drives,
+    sim_get_drive_info,
+    sim_close_drive,
+    sim_read,
+    sim_write,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
@@ -0,0 +1,76 @@
+/* Generated by pslr_tables_gen from pentax_settings.json, do not edit */
+
+static const pslr_setting_def_t settings_0x12dfe[] = {
+    { "bulb_mode_press_press", 0x0, "false", "boolean" },
+    { "remote_bulb_mode_press_press", 0x132, NULL, "boolean!" },
+    { "one_push_bracketing", 0x0, "false", "boolean" },
+    { "bulb_timer", 0x0, "false", "boolean" },
+    { "bulb_timer_sec", 0x0, "0", "uint16" },
+    { "using_aperture_ring", 0x142, NULL, "boolean" },
+    { "shake_reduction", 0x65, NULL, "boolean!" },
+    { "astrotracer", 0x0, "false", "boolean" },
+    { "astrotracer_timer_sec", 0x0, "0", "uint16" },
+    { "horizon_correction", 0x0, "false", "boolean" },
+};
+
+static const pslr_setting_def_t settings_0x12ef8[] = {
+    { "bulb_mode_press_press", 0xf2, NULL, "boolean" },
+};
+
+static const pslr_setting_def_t settings_0x12f70[] = {
+    { "bulb_mode_press_press", 0x0, "false", "boolean" },
+    { "remote_bulb_mode_press_press", 0xdb, NULL, "boolean!" },
+    { "one_push_bracketing", 0xd1, NULL, "boolean" },
+    { "bulb_timer", 0x0, "false", "boolean" },
+    { "bulb_timer_sec", 0x0, "0", "uint16" },
+    { "using_aperture_ring", 0xe3, NULL, "boolean" },
+    { "shake_reduction", 0x92, NULL, "boolean!" },
+    { "astrotracer", 0xbe, NULL, "boolean" },
+    { "astrotracer_timer_sec", 0xbf, NULL, "uint16" },
+    { "horizon_correction", 0x91, NULL, "boolean!" },
+};
+
+static const pslr_setting_def_t settings_0x12fb6[] = {
+    { "bulb_mode_press_press", 0xf2, NULL, "boolean" },
+};
+
+static const pslr_setting_def_t settings_0x13092[] = {
+    { "bulb_timer", 0x131, NULL, "boolean" },
+    { "bulb_timer_sec", 0x132, NULL, "uint16" },
+};
+
+static const pslr_setting_def_t settings_0x1309c[] = {
+    { "astrotracer", 0x1ac, NULL, "boolean" },
+    { "astrotracer_timer_sec", 0x1ad, NULL, "uint16" },
+};
+
+static const pslr_setting_def_t settings_0x13222[] = {
+    { "bulb_mode_press_press", 0x178, NULL, "boolean" },
+    { "one_push_bracketing", 0x17e, NULL, "boolean" },
+    { "bulb_timer", 0x133, NULL, "boolean" },
+    { "bulb_timer_sec", 0x134, NULL, "uint16" },
+    { "using_aperture_ring", 0x18c, NULL, "boolean" },
+    { "shake_reduction", 0x7d, NULL, "boolean!" },
+    { "astrotracer", 0x87, NULL, "boolean" },
+    { "horizon_correction", 0x80, NULL, "boolean!" },
+};
+
+static const pslr_setting_def_t settings_0x13240[] = {
+    { "bulb_timer", 0x131, NULL, "boolean" },
+    { "bulb_timer_sec", 0x132, NULL, "uint16" },
+};
+
+static const struct {
+    uint32_t id;
+    const pslr_setting_def_t *defs;
+    int def_num;
+} settings_table[] = {
+    { 0x12dfe, settings_0x12dfe, sizeof(settings_0x12dfe)/sizeof(settings_0x12dfe[0]) },
+    { 0x12ef8, settings_0x12ef8, sizeof(settings_0x12ef8)/sizeof(settings_0x12ef8[0]) },
+    { 0x12f70, settings_0x12f70, sizeof(settings_0x12f70)/sizeof(settings_0x12f70[0]) },
+    { 0x12fb6, settings_0x12fb6, sizeof(settings_0x12fb6)/sizeof(settings_0x12fb6[0]) },
+    { 0x13092, settings_0x13092, sizeof(settings_0x13092)/sizeof(settings_0x13092[0]) },
+    { 0x1309c, settings_0x1309c, sizeof(settings_0x1309c)/sizeof(settings_0x1309c[0]) },
+    { 0x13222, settings_0x13222, sizeof(settings_0x13222)/sizeof(settings_0x13222[0]) },
+    { 0x13240, settings_0x13240, sizeof(settings_0x13240)/sizeof(settings_0x13240[0]) },
+};
@@ -0,0 +1,100 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Microbenchmark of the status buffer parsers, run it with make bench.
+ * The status buffers are captured from the simulated cameras, one for
+ * every model of camera_models[] which has a parser. Both the full parse
+ * and the lazy decoding of the bufmask alone are timed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pslr.h"
+#include "pslr_model.h"
+#include "pslr_utils.h"
+
+#define BENCH_ITERATIONS 1000000
+
+/* the buffer polling loops only need the bufmask */
+#define BENCH_LAZY_FIELDS PSLR_STATUS_BIT(PSLR_STATUS_BUFMASK)
+
+static double bench_parse(ipslr_handle_t *p, uint64_t fields, int iterations) {
+    pslr_status status;
+    double start = get_monotonic_sec();
+    int n;
+    for (n = 0; n < iterations; ++n) {
+        p->model->status_parser_function(p, &status, fields);
+    }
+    return get_monotonic_sec() - start;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : BENCH_ITERATIONS;
+    ipslr_model_info_t *model;
+    double total = 0, total_lazy = 0;
+    int model_num = 0;
+    int i;
+
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [ITERATIONS]\n", argv[0]);
+        return 1;
+    }
+    printf("%-12s %-6s %12s %12s\n", "model", "endian", "ns/parse", "ns/bufmask");
+    for (i = 0; (model = pslr_get_model(i)) != NULL; ++i) {
+        char device[64];
+        pslr_handle_t h;
+        ipslr_handle_t *p;
+        double elapsed, elapsed_lazy;
+
+        if (!model->status_parser_function) {
+            continue;
+        }
+        snprintf(device, sizeof(device), "sim:%s", model->name);
+        h = pslr_init(NULL, device);
+        if (!h || pslr_connect(h) != PSLR_OK) {
+            fprintf(stderr, "Cannot capture the status buffer of %s\n", model->name);
+            if (h) {
+                pslr_shutdown(h);
+            }
+            return 1;
+        }
+        p = (ipslr_handle_t *) h;
+        elapsed = bench_parse(p, PSLR_STATUS_ALL, iterations);
+        elapsed_lazy = bench_parse(p, BENCH_LAZY_FIELDS, iterations);
+        printf("%-12s %-6s %12.1f %12.1f\n", model->name, model->is_little_endian ? "le" : "be",
+               elapsed * 1e9 / iterations, elapsed_lazy * 1e9 / iterations);
+        total += elapsed;
+        total_lazy += elapsed_lazy;
+        ++model_num;
+        pslr_disconnect(h);
+        pslr_shutdown(h);
+    }
+    if (model_num > 0) {
+        printf("%-12s %-6s %12.1f %12.1f\n", "average", "", total * 1e9 / iterations / model_num,
+               total_lazy * 1e9 / iterations / model_num);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Build time generator of the static lens and setting tables.
+ *
+ *   pslr_tables_gen lens                        > pslr_lens_table.h
+ *   pslr_tables_gen settings pentax_settings.json > pslr_settings_table.h
+ *
+ * The lens table is sorted by (id1, id2) for binary search, the camera
+ * entries of the settings table are sorted by camera id. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "js0n.h"
+
+#define MAX_CAMERAS 128
+
+static const struct {
+    uint32_t id1;
+    uint32_t id2;
+    const char *name;
+} lens_id[] = {
+#include "exiftool_pentax_lens.txt"
+};
+
+typedef struct {
+    uint32_t id;
+    const char *fields;
+    size_t fields_len;
+} camera_entry_t;
+
+static void print_c_string(const char *str, size_t len) {
+    size_t i;
+    putchar('"');
+    for (i = 0; i < len; ++i) {
+        if (str[i] == '"' || str[i] == '\\') {
+            putchar('\\');
+        }
+        putchar(str[i]);
+    }
+    putchar('"');
+}
+
+static int lens_cmp(const void *a, const void *b) {
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    if (lens_id[ia].id1 != lens_id[ib].id1) {
+        return lens_id[ia].id1 < lens_id[ib].id1 ? -1 : 1;
+    }
+    if (lens_id[ia].id2 != lens_id[ib].id2) {
+        return lens_id[ia].id2 < lens_id[ib].id2 ? -1 : 1;
+    }
+    // keep the original order of the duplicates, the first one wins
+    return ia - ib;
+}
+
+static int gen_lens(void) {
+    int lens_num = sizeof(lens_id)/sizeof(lens_id[0]);
+    int order[lens_num];
+    int i;
+    for (i = 0; i < lens_num; ++i) {
+        order[i] = i;
+    }
+    qsort(order, lens_num, sizeof(int), lens_cmp);
+    printf("/* Generated by pslr_tables_gen from exiftool_pentax_lens.txt, do not edit */\n");
+    for (i = 0; i < lens_num; ++i) {
+        printf("{%u, %u, ", lens_id[order[i]].id1, lens_id[order[i]].id2);
+        print_c_string(lens_id[order[i]].name, strlen(lens_id[order[i]].name));
+        printf("},\n");
+    }
+    return 0;
+}
+
+static int camera_cmp(const void *a, const void *b) {
+    const camera_entry_t *ca = a;
+    const camera_entry_t *cb = b;
+    return ca->id < cb->id ? -1 : ca->id > cb->id;
+}
+
+static void print_field(const char *json, size_t len, const char *key) {
+    size_t vlen;
+    const char *value = js0n(key, strlen(key), json, len, &vlen);
+    if (value == NULL) {
+        printf("NULL");
+    } else {
+        print_c_string(value, vlen);
+    }
+}
+
+static int gen_settings(const char *filename) {
+    camera_entry_t cameras[MAX_CAMERAS];
+    int camera_num = 0;
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", filename);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long jsonsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *json = malloc(jsonsize);
+    if (fread(json, 1, jsonsize, f) != (size_t)jsonsize) {
+        fprintf(stderr, "Cannot read %s\n", filename);
+        return 1;
+    }
+    fclose(f);
+
+    // in index mode js0n returns the keys and the values of an object alternately
+    const char *key;
+    size_t key_len;
+    while ((key = js0n(NULL, 2*camera_num, json, jsonsize, &key_len)) != NULL) {
+        size_t camera_len;
+        const char *camera = js0n(NULL, 2*camera_num+1, json, jsonsize, &camera_len);
+        if (camera_num == MAX_CAMERAS || camera == NULL) {
+            fprintf(stderr, "Invalid camera entry %.*s\n", (int)key_len, key);
+            return 1;
+        }
+        cameras[camera_num].id = strtoul(key, NULL, 16);
+        cameras[camera_num].fields = js0n("fields", strlen("fields"), camera, camera_len, &cameras[camera_num].fields_len);
+        if (cameras[camera_num].fields == NULL) {
+            fprintf(stderr, "No fields defined for %.*s\n", (int)key_len, key);
+            return 1;
+        }
+        ++camera_num;
+    }
+    qsort(cameras, camera_num, sizeof(camera_entry_t), camera_cmp);
+
+    printf("/* Generated by pslr_tables_gen from %s, do not edit */\n", filename);
+    int i;
+    for (i = 0; i < camera_num; ++i) {
+        printf("\nstatic const pslr_setting_def_t settings_0x%05x[] = {\n", cameras[i].id);
+        const char *field;
+        size_t field_len;
+        int fi = 0;
+        while ((field = js0n(NULL, fi, cameras[i].fields, cameras[i].fields_len, &field_len)) != NULL) {
+            size_t address_len;
+            const char *address = js0n("address", strlen("address"), field, field_len, &address_len);
+            printf("    { ");
+            print_field(field, field_len, "name");
+            printf(", 0x%lx, ", address == NULL ? 0 : strtoul(address, NULL, 16));
+            print_field(field, field_len, "value");
+            printf(", ");
+            print_field(field, field_len, "type");
+            printf(" },\n");
+            ++fi;
+        }
+        printf("};\n");
+    }
+    printf("\nstatic const struct {\n    uint32_t id;\n    const pslr_setting_def_t *defs;\n    int def_num;\n} settings_table[] = {\n");
+    for (i = 0; i < camera_num; ++i) {
+        printf("    { 0x%05x, settings_0x%05x, sizeof(settings_0x%05x)/sizeof(settings_0x%05x[0]) },\n",
+               cameras[i].id, cameras[i].id, cameras[i].id, cameras[i].id);
+    }
+    printf("};\n");
+    free(json);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "lens") == 0) {
+        return gen_lens();
+    } else if (argc == 3 && strcmp(argv[1], "settings") == 0) {
+        return gen_settings(argv[2]);
+    }
+    fprintf(stderr, "usage: %s lens | settings FILE\n", argv[0]);
+    return 1;
+}
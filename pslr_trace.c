@@ -0,0 +1,171 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_log.h"
+#include "pslr_model.h"
+#include "pslr_utils.h"
+#include "pslr_trace.h"
+
+struct pslr_trace {
+    FILE *file;
+    double start;
+};
+
+static char *trace_filename = NULL;
+
+void pslr_set_trace_file(const char *filename) {
+    free(trace_filename);
+    trace_filename = filename ? strdup(filename) : NULL;
+}
+
+const char *pslr_get_trace_file(void) {
+    return trace_filename;
+}
+
+pslr_trace_t *pslr_trace_open(const char *filename) {
+    pslr_trace_t *trace;
+    uint8_t version[4];
+    FILE *f = fopen(filename, "wb");
+
+    if (f == NULL) {
+        pslr_write_log(PSLR_ERROR, "Cannot open trace file %s\n", filename);
+        return NULL;
+    }
+    set_uint32_le(PSLR_TRACE_VERSION, version);
+    fwrite(PSLR_TRACE_MAGIC, 1, strlen(PSLR_TRACE_MAGIC), f);
+    fwrite(version, 1, sizeof(version), f);
+    trace = malloc(sizeof(pslr_trace_t));
+    trace->file = f;
+    trace->start = get_monotonic_sec();
+    DPRINT("Recording trace to %s\n", filename);
+    return trace;
+}
+
+void pslr_trace_record(pslr_trace_t *trace, double start, bool to_device, uint8_t *cmd, uint32_t cmd_len,
+                       uint8_t *data, uint32_t data_len, int result, uint8_t *sense, uint32_t sense_len) {
+    uint8_t header[PSLR_TRACE_HEADER_SIZE];
+    uint64_t timestamp = (start - trace->start) * 1000000000.0;
+    double duration = get_monotonic_sec() - start;
+
+    if (data == NULL) {
+        data_len = 0;
+    }
+    set_uint32_le(timestamp & 0xffffffff, &header[0]);
+    set_uint32_le(timestamp >> 32, &header[4]);
+    set_uint32_le(duration < 4.0 ? duration * 1000000000.0 : 4000000000u, &header[8]);
+    set_uint32_le(result, &header[12]);
+    set_uint32_le(data_len, &header[16]);
+    header[20] = to_device;
+    header[21] = cmd_len;
+    header[22] = sense_len;
+    header[23] = 0;
+    fwrite(header, 1, sizeof(header), trace->file);
+    fwrite(cmd, 1, cmd_len, trace->file);
+    if (data_len > 0) {
+        fwrite(data, 1, data_len, trace->file);
+    }
+    if (sense_len > 0) {
+        fwrite(sense, 1, sense_len, trace->file);
+    }
+    if (result < 0 || (to_device && result != 0)) {
+        // keep the failures even if the program crashes later
+        fflush(trace->file);
+    }
+}
+
+void pslr_trace_close(pslr_trace_t *trace) {
+    if (trace == NULL) {
+        return;
+    }
+    fclose(trace->file);
+    free(trace);
+}
+
+int pslr_trace_load(const char *filename, pslr_trace_record_t **records) {
+    uint8_t header[PSLR_TRACE_HEADER_SIZE];
+    char magic[8];
+    uint8_t version[4];
+    pslr_trace_record_t *rec = NULL;
+    int record_num = 0;
+    int record_max = 0;
+    FILE *f = fopen(filename, "rb");
+
+    if (f == NULL) {
+        DPRINT("Cannot open trace file %s\n", filename);
+        return -1;
+    }
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, PSLR_TRACE_MAGIC, sizeof(magic)) != 0
+            || fread(version, 1, sizeof(version), f) != sizeof(version) || get_uint32_le(version) != PSLR_TRACE_VERSION) {
+        DPRINT("%s is not a trace file\n", filename);
+        fclose(f);
+        return -1;
+    }
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        if (record_num == record_max) {
+            record_max = record_max ? 2 * record_max : 256;
+            rec = realloc(rec, record_max * sizeof(pslr_trace_record_t));
+        }
+        pslr_trace_record_t *r = &rec[record_num];
+        r->timestamp = get_uint32_le(&header[0]) | (uint64_t)get_uint32_le(&header[4]) << 32;
+        r->duration = get_uint32_le(&header[8]);
+        r->result = get_uint32_le(&header[12]);
+        r->data_len = get_uint32_le(&header[16]);
+        r->to_device = header[20];
+        r->cmd_len = header[21];
+        r->sense_len = header[22];
+        r->data = NULL;
+        if (r->cmd_len > sizeof(r->cmd) || r->sense_len > sizeof(r->sense)) {
+            break;
+        }
+        if (r->data_len > 0) {
+            r->data = malloc(r->data_len);
+        }
+        if (fread(r->cmd, 1, r->cmd_len, f) != r->cmd_len
+                || (r->data_len > 0 && fread(r->data, 1, r->data_len, f) != r->data_len)
+                || fread(r->sense, 1, r->sense_len, f) != r->sense_len) {
+            // truncated last record
+            free(r->data);
+            break;
+        }
+        ++record_num;
+    }
+    fclose(f);
+    DPRINT("Loaded %d trace records from %s\n", record_num, filename);
+    *records = rec;
+    return record_num;
+}
+
+void pslr_trace_free_records(pslr_trace_record_t *records, int record_num) {
+    int i;
+    for (i = 0; i < record_num; ++i) {
+        free(records[i].data);
+    }
+    free(records);
+}
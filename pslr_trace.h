@@ -0,0 +1,83 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PSLR_TRACE_H
+#define PSLR_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Binary trace of the SCSI traffic.
+ *
+ * File: "PKTTRACE" magic, uint32 format version, then records. Every
+ * record starts with a 24 byte header (all values little-endian):
+ *   uint64 timestamp  start of the call, monotonic time since the start of the trace in ns
+ *   uint32 duration   duration of the call in ns
+ *   int32  result     return value of the transport read / write call
+ *   uint32 data_len   bytes written to / read from the device
+ *   uint8  to_device  1 for writes, 0 for reads
+ *   uint8  cmd_len
+ *   uint8  sense_len
+ *   uint8  reserved
+ * followed by the CDB, the data and the sense data. */
+
+#define PSLR_TRACE_MAGIC "PKTTRACE"
+#define PSLR_TRACE_VERSION 1
+#define PSLR_TRACE_HEADER_SIZE 24
+
+typedef struct {
+    uint64_t timestamp;
+    uint32_t duration;
+    int32_t result;
+    bool to_device;
+    uint8_t cmd[16];
+    uint32_t cmd_len;
+    uint8_t *data;
+    uint32_t data_len;
+    uint8_t sense[32];
+    uint32_t sense_len;
+} pslr_trace_record_t;
+
+typedef struct pslr_trace pslr_trace_t;
+
+/* File name used by pslr_init() to record the traffic of the new handle,
+ * NULL switches recording off */
+void pslr_set_trace_file(const char *filename);
+const char *pslr_get_trace_file(void);
+
+pslr_trace_t *pslr_trace_open(const char *filename);
+/* start is the get_monotonic_sec() time when the call was issued */
+void pslr_trace_record(pslr_trace_t *trace, double start, bool to_device, uint8_t *cmd, uint32_t cmd_len,
+                       uint8_t *data, uint32_t data_len, int result, uint8_t *sense, uint32_t sense_len);
+void pslr_trace_close(pslr_trace_t *trace);
+
+/* Reads the whole trace, returns the number of records or -1 on error.
+ * The records and their data are freed by pslr_trace_free_records(). */
+int pslr_trace_load(const char *filename, pslr_trace_record_t **records);
+void pslr_trace_free_records(pslr_trace_record_t *records, int record_num);
+
+#endif
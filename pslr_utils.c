@@ -35,6 +35,14 @@
 #include <sys/time.h>
 #include <unistd.h>
 #endif
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(RAD10)
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
 
 #include "pslr.h"
 #include "pslr_utils.h"
@@ -44,6 +52,19 @@ double timeval_diff_sec(struct timeval *t2, struct timeval *t1) {
     return (t2->tv_usec - t1->tv_usec) / 1000000.0 + (t2->tv_sec - t1->tv_sec);
 }
 
+// seconds from an unspecified starting point, not affected by system time changes
+double get_monotonic_sec(void) {
+#if defined(CLOCK_MONOTONIC) && !defined(RAD10)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
 void sleep_sec(double sec) {
     int i;
     for (i=0; i<floor(sec); ++i) {
@@ -52,6 +73,87 @@ void sleep_sec(double sec) {
     usleep(1000000*(sec-floor(sec)));
 }
 
+// deadline is a get_monotonic_sec() time, wall clock adjustments do not move it
+void sleep_until_monotonic_sec(double deadline) {
+#if defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME) && !defined(RAD10)
+    struct timespec ts;
+    ts.tv_sec = (time_t) deadline;
+    ts.tv_nsec = (long) ((deadline - ts.tv_sec) * 1000000000.0);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        // interrupted by a signal, the deadline is still the same
+    }
+#else
+    double sec = deadline - get_monotonic_sec();
+    if (sec > 0) {
+        sleep_sec(sec);
+    }
+#endif
+}
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static bool crc32c_hw = false;
+
+static void crc32c_init(void) {
+    uint32_t i, k;
+    for (i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (k = 0; k < 8; ++k) {
+            c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        }
+        crc32c_table[i] = c;
+    }
+#ifdef CRC32C_SSE42
+    __builtin_cpu_init();
+    crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#ifdef CRC32C_SSE42
+// the crc32 instruction of SSE4.2 uses the same (Castagnoli) polynomial
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t len) {
+    while (len > 0 && ((uintptr_t) buf & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *buf++);
+        len--;
+    }
+#ifdef __x86_64__
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+        crc = (uint32_t) _mm_crc32_u64(crc, v);
+        buf += 8;
+        len -= 8;
+    }
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, buf, 4);
+        crc = _mm_crc32_u32(crc, v);
+        buf += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t *buf, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+#ifdef CRC32C_SSE42
+    if (crc32c_hw) {
+        return ~crc32c_sse42(crc, buf, len);
+    }
+#endif
+    while (len--) {
+        crc = crc32c_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 pslr_rational_t parse_aperture(char *aperture_str) {
     char C;
     float F = 0;
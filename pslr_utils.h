@@ -41,7 +41,12 @@
 #include "pslr_model.h"
 
 double timeval_diff_sec(struct timeval *t2, struct timeval *t1);
+double get_monotonic_sec(void);
 void sleep_sec(double sec);
+void sleep_until_monotonic_sec(double deadline);
+/* CRC32C (Castagnoli) of buf, continuing crc, 0 for the first block.
+   Uses the crc32 instruction when the cpu has SSE4.2 */
+uint32_t crc32c_update(uint32_t crc, const uint8_t *buf, size_t len);
 pslr_rational_t parse_shutter_speed(char *shutter_speed_str);
 pslr_rational_t parse_aperture(char *aperture_str);
 
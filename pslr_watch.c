@@ -0,0 +1,386 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pslr_log.h"
+#include "pslr_model.h"
+#include "pslr_utils.h"
+#include "pslr_watch.h"
+
+#define WATCH_MAX_CALLBACKS 8
+#define WATCH_MAX_ERRORS 3          // failed status reads in a row taken as a disconnect
+#define WATCH_QUEUE_SIZE 32         // events kept for pslr_watch_wait, the oldest are dropped
+
+#define WATCH_BUFFER_FIELDS PSLR_STATUS_BIT(PSLR_STATUS_BUFMASK)
+#define WATCH_EXPOSURE_FIELDS (PSLR_STATUS_BIT(PSLR_STATUS_EXPOSURE_MODE) |     \
+                               PSLR_STATUS_BIT(PSLR_STATUS_SET_SHUTTER_SPEED) | \
+                               PSLR_STATUS_BIT(PSLR_STATUS_SET_APERTURE) |      \
+                               PSLR_STATUS_BIT(PSLR_STATUS_CURRENT_SHUTTER_SPEED) | \
+                               PSLR_STATUS_BIT(PSLR_STATUS_CURRENT_APERTURE) |  \
+                               PSLR_STATUS_BIT(PSLR_STATUS_CURRENT_ISO) |       \
+                               PSLR_STATUS_BIT(PSLR_STATUS_FIXED_ISO) |         \
+                               PSLR_STATUS_BIT(PSLR_STATUS_EC))
+#define WATCH_BATTERY_FIELDS (PSLR_STATUS_BIT(PSLR_STATUS_BATTERY_1) | PSLR_STATUS_BIT(PSLR_STATUS_BATTERY_2) | \
+                              PSLR_STATUS_BIT(PSLR_STATUS_BATTERY_3) | PSLR_STATUS_BIT(PSLR_STATUS_BATTERY_4))
+#define WATCH_EVENT_FIELDS (WATCH_BUFFER_FIELDS | WATCH_EXPOSURE_FIELDS | WATCH_BATTERY_FIELDS)
+
+typedef struct {
+    uint32_t events;
+    pslr_event_callback_t cb;
+    uintptr_t user_data;
+} watch_callback_t;
+
+struct pslr_watch {
+    pslr_handle_t h;
+    pthread_mutex_t lock;                   // recursive, held while polling and in the callbacks
+    watch_callback_t callbacks[WATCH_MAX_CALLBACKS];
+    int callback_num;
+    pslr_status status;
+    uint64_t polled_fields;                 // fields of status, 0 before the first poll
+    int errors;
+
+    pthread_mutex_t state;                  // guards the fields below
+    pthread_cond_t wake_cond;               // wakes the thread
+    pthread_cond_t event_cond;              // wakes pslr_watch_wait
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    bool woken;
+    bool disconnected;
+    uint64_t fields;
+    double min_interval;
+    double max_interval;
+    double interval;
+    pslr_event_t queue[WATCH_QUEUE_SIZE];   // events not taken by pslr_watch_wait yet
+    int queue_head;
+    int queue_num;
+};
+
+static void watch_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, double sec) {
+    struct timeval now;
+    struct timespec deadline;
+    gettimeofday(&now, NULL);
+    double t = now.tv_sec + now.tv_usec / 1000000.0 + sec;
+    deadline.tv_sec = (time_t) t;
+    deadline.tv_nsec = (long) ((t - deadline.tv_sec) * 1000000000.0);
+    pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+pslr_watch_t *pslr_watch_new(pslr_handle_t h) {
+    pthread_mutexattr_t attr;
+    pslr_watch_t *w;
+
+    if (!h || !(w = calloc(1, sizeof(pslr_watch_t)))) {
+        return NULL;
+    }
+    w->h = h;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&w->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&w->state, NULL);
+    pthread_cond_init(&w->wake_cond, NULL);
+    pthread_cond_init(&w->event_cond, NULL);
+    w->min_interval = PSLR_WATCH_MIN_INTERVAL;
+    w->max_interval = PSLR_WATCH_MAX_INTERVAL;
+    w->interval = w->min_interval;
+    return w;
+}
+
+void pslr_watch_free(pslr_watch_t *w) {
+    if (!w) {
+        return;
+    }
+    pslr_watch_stop(w);
+    pthread_cond_destroy(&w->event_cond);
+    pthread_cond_destroy(&w->wake_cond);
+    pthread_mutex_destroy(&w->state);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+}
+
+int pslr_watch_add_callback(pslr_watch_t *w, uint32_t events, pslr_event_callback_t cb, uintptr_t user_data) {
+    int ret = PSLR_OK;
+    pslr_watch_lock(w);
+    if (w->callback_num >= WATCH_MAX_CALLBACKS || !cb) {
+        ret = PSLR_PARAM;
+    } else {
+        watch_callback_t *c = &w->callbacks[w->callback_num++];
+        c->events = events;
+        c->cb = cb;
+        c->user_data = user_data;
+    }
+    pslr_watch_unlock(w);
+    return ret;
+}
+
+void pslr_watch_set_fields(pslr_watch_t *w, uint64_t fields) {
+    pthread_mutex_lock(&w->state);
+    w->fields = fields & PSLR_STATUS_ALL;
+    pthread_mutex_unlock(&w->state);
+}
+
+void pslr_watch_set_interval(pslr_watch_t *w, double min_sec, double max_sec) {
+    pthread_mutex_lock(&w->state);
+    if (min_sec > 0) {
+        w->min_interval = min_sec;
+    }
+    w->max_interval = max_sec > w->min_interval ? max_sec : w->min_interval;
+    w->interval = w->min_interval;
+    pthread_mutex_unlock(&w->state);
+}
+
+void pslr_watch_lock(pslr_watch_t *w) {
+    pthread_mutex_lock(&w->lock);
+}
+
+void pslr_watch_unlock(pslr_watch_t *w) {
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Called with the watch lock held */
+static void watch_emit(pslr_watch_t *w, pslr_event_type_t type, int buffer, uint64_t changed) {
+    pslr_event_t event = { type, buffer, changed, &w->status };
+    int i;
+
+    DPRINT("[C]\twatch event %d buffer %d changed 0x%llx\n", type, buffer, (unsigned long long) changed);
+    pthread_mutex_lock(&w->state);
+    if (w->queue_num == WATCH_QUEUE_SIZE) {
+        w->queue_head = (w->queue_head + 1) % WATCH_QUEUE_SIZE;
+        --w->queue_num;
+    }
+    w->queue[(w->queue_head + w->queue_num++) % WATCH_QUEUE_SIZE] = event;
+    pthread_cond_broadcast(&w->event_cond);
+    pthread_mutex_unlock(&w->state);
+    for (i = 0; i < w->callback_num; ++i) {
+        if (w->callbacks[i].events & PSLR_EVENT_BIT(type)) {
+            w->callbacks[i].cb(&event, w->callbacks[i].user_data);
+        }
+    }
+}
+
+int pslr_watch_poll(pslr_watch_t *w, double *delay) {
+    pslr_status prev;
+    uint64_t fields;
+    bool disconnected;
+    int events = 0;
+    int ret;
+
+    pslr_watch_lock(w);
+    pthread_mutex_lock(&w->state);
+    fields = w->fields | WATCH_EVENT_FIELDS;
+    disconnected = w->disconnected;
+    pthread_mutex_unlock(&w->state);
+    if (disconnected) {
+        pslr_watch_unlock(w);
+        *delay = -1;
+        return PSLR_DEVICE_ERROR;
+    }
+
+    memcpy(&prev, &w->status, sizeof(pslr_status));
+    ret = pslr_get_status_fields(w->h, fields, &w->status);
+    if (ret != PSLR_OK) {
+        DPRINT("[C]\twatch status read failed: %d\n", ret);
+        memcpy(&w->status, &prev, sizeof(pslr_status));
+        if (ret == PSLR_DEVICE_ERROR || ++w->errors >= WATCH_MAX_ERRORS) {
+            pthread_mutex_lock(&w->state);
+            w->disconnected = disconnected = true;
+            pthread_mutex_unlock(&w->state);
+            watch_emit(w, PSLR_EVENT_DISCONNECT, -1, 0);
+            ++events;
+        }
+    } else {
+        // the fields not decoded before count as changed
+        uint64_t changed = (ipslr_status_changed_fields(&prev, &w->status) | ~w->polled_fields) & fields;
+        uint16_t old_bufmask = w->polled_fields & WATCH_BUFFER_FIELDS ? prev.bufmask : 0;
+        int i;
+
+        w->errors = 0;
+        w->polled_fields = fields;
+        for (i = 0; i < 16; ++i) {
+            if (w->status.bufmask & ~old_bufmask & 1 << i) {
+                watch_emit(w, PSLR_EVENT_BUFFER_NEW, i, WATCH_BUFFER_FIELDS);
+                ++events;
+            } else if (old_bufmask & ~w->status.bufmask & 1 << i) {
+                watch_emit(w, PSLR_EVENT_BUFFER_DELETED, i, WATCH_BUFFER_FIELDS);
+                ++events;
+            }
+        }
+        if (changed & WATCH_EXPOSURE_FIELDS) {
+            watch_emit(w, PSLR_EVENT_EXPOSURE_CHANGED, -1, changed & WATCH_EXPOSURE_FIELDS);
+            ++events;
+        }
+        if (changed & WATCH_BATTERY_FIELDS) {
+            watch_emit(w, PSLR_EVENT_BATTERY, -1, changed & WATCH_BATTERY_FIELDS);
+            ++events;
+        }
+        if (changed & ~WATCH_EVENT_FIELDS) {
+            watch_emit(w, PSLR_EVENT_STATUS_CHANGED, -1, changed & ~WATCH_EVENT_FIELDS);
+            ++events;
+        }
+    }
+
+    pthread_mutex_lock(&w->state);
+    if (disconnected) {
+        *delay = -1;
+    } else {
+        // fast while things happen, slowing down while the camera is idle
+        w->interval = events > 0 ? w->min_interval : w->interval * 2;
+        if (w->interval > w->max_interval) {
+            w->interval = w->max_interval;
+        }
+        *delay = w->interval;
+    }
+    pthread_mutex_unlock(&w->state);
+    pslr_watch_unlock(w);
+    return ret;
+}
+
+void pslr_watch_wake(pslr_watch_t *w) {
+    pthread_mutex_lock(&w->state);
+    w->interval = w->min_interval;
+    w->woken = true;
+    pthread_cond_signal(&w->wake_cond);
+    pthread_mutex_unlock(&w->state);
+}
+
+static void *watch_thread(void *data) {
+    pslr_watch_t *w = (pslr_watch_t *) data;
+    double delay;
+
+    pthread_mutex_lock(&w->state);
+    while (!w->stopping) {
+        pthread_mutex_unlock(&w->state);
+        pslr_watch_poll(w, &delay);
+        pthread_mutex_lock(&w->state);
+        if (delay < 0) {
+            break;
+        }
+        double next = get_monotonic_sec() + delay;
+        while (!w->stopping && !w->woken && get_monotonic_sec() < next) {
+            watch_timedwait(&w->wake_cond, &w->state, next - get_monotonic_sec());
+        }
+        w->woken = false;
+    }
+    pthread_mutex_unlock(&w->state);
+    DPRINT("[C]\twatch thread finished\n");
+    return NULL;
+}
+
+int pslr_watch_start(pslr_watch_t *w) {
+    int ret = PSLR_OK;
+    pthread_mutex_lock(&w->state);
+    if (!w->running) {
+        w->stopping = false;
+        w->running = pthread_create(&w->thread, NULL, watch_thread, w) == 0;
+        ret = w->running ? PSLR_OK : PSLR_NO_MEMORY;
+    }
+    pthread_mutex_unlock(&w->state);
+    return ret;
+}
+
+void pslr_watch_stop(pslr_watch_t *w) {
+    pthread_mutex_lock(&w->state);
+    if (!w->running) {
+        pthread_mutex_unlock(&w->state);
+        return;
+    }
+    w->stopping = true;
+    pthread_cond_signal(&w->wake_cond);
+    pthread_mutex_unlock(&w->state);
+    pthread_join(w->thread, NULL);
+    pthread_mutex_lock(&w->state);
+    w->running = false;
+    pthread_cond_broadcast(&w->event_cond);
+    pthread_mutex_unlock(&w->state);
+}
+
+/* Takes the oldest queued event of the mask, called with the state mutex held */
+static bool watch_find_event(pslr_watch_t *w, uint32_t events, pslr_event_t *event) {
+    int i;
+    for (i = 0; i < w->queue_num; ++i) {
+        if (events & PSLR_EVENT_BIT(w->queue[(w->queue_head + i) % WATCH_QUEUE_SIZE].type)) {
+            *event = w->queue[(w->queue_head + i) % WATCH_QUEUE_SIZE];
+            // the older events of the other types stay queued
+            for (--w->queue_num; i < w->queue_num; ++i) {
+                w->queue[(w->queue_head + i) % WATCH_QUEUE_SIZE] = w->queue[(w->queue_head + i + 1) % WATCH_QUEUE_SIZE];
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+int pslr_watch_wait(pslr_watch_t *w, uint32_t events, double timeout_sec, pslr_event_t *event) {
+    double end = get_monotonic_sec() + timeout_sec;
+    int ret = PSLR_READ_ERROR;
+
+    pthread_mutex_lock(&w->state);
+    while (true) {
+        double left = timeout_sec > 0 ? end - get_monotonic_sec() : w->max_interval;
+        if (watch_find_event(w, events, event)) {
+            ret = PSLR_OK;
+            break;
+        }
+        if (w->disconnected) {
+            ret = PSLR_DEVICE_ERROR;
+            break;
+        }
+        if (left <= 0) {
+            break;
+        }
+        if (w->running) {
+            watch_timedwait(&w->event_cond, &w->state, left);
+        } else {
+            // no thread, the caller does the polling
+            double delay;
+            pthread_mutex_unlock(&w->state);
+            pslr_watch_poll(w, &delay);
+            pthread_mutex_lock(&w->state);
+            if (watch_find_event(w, events, event)) {
+                ret = PSLR_OK;
+                break;
+            }
+            if (delay > 0) {
+                pthread_mutex_unlock(&w->state);
+                sleep_sec(delay < left ? delay : left);
+                pthread_mutex_lock(&w->state);
+            }
+        }
+    }
+    pthread_mutex_unlock(&w->state);
+    return ret;
+}
+
+void pslr_watch_get_status(pslr_watch_t *w, pslr_status *status) {
+    pslr_watch_lock(w);
+    memcpy(status, &w->status, sizeof(pslr_status));
+    pslr_watch_unlock(w);
+}
@@ -0,0 +1,111 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2019 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    based on:
+
+    PK-Remote
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2008 Pontus Lidman <pontus@lysator.liu.se>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    and GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PSLR_WATCH_H
+#define PSLR_WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pslr.h"
+
+/* Camera event watcher: one status polling stream per handle, the
+ * changes are delivered as typed events to the registered callbacks.
+ *
+ * The polling is adaptive, after an event (or pslr_watch_wake) the status
+ * is read at the minimal interval, then the interval doubles up to the
+ * maximal one while nothing changes. Only the fields needed by the events
+ * and the pslr_watch_set_fields ones are decoded.
+ *
+ * The watcher can run in its own thread (pslr_watch_start) or be driven
+ * by pslr_watch_poll from the main loop of the caller. The thread holds
+ * the watch lock while it talks to the camera and while the callbacks
+ * run, so the callbacks may use the handle. Other threads have to hold
+ * the lock around their calls on the handle. */
+
+typedef enum {
+    PSLR_EVENT_BUFFER_NEW,          // buffer: index of the new picture
+    PSLR_EVENT_BUFFER_DELETED,      // buffer: index of the freed buffer
+    PSLR_EVENT_EXPOSURE_CHANGED,    // exposure mode, shutter speed, aperture, ISO or EC
+    PSLR_EVENT_BATTERY,             // battery levels
+    PSLR_EVENT_STATUS_CHANGED,      // any other field of pslr_watch_set_fields
+    PSLR_EVENT_DISCONNECT,          // the status cannot be read, the watcher stops
+    PSLR_EVENT_MAX
+} pslr_event_type_t;
+
+#define PSLR_EVENT_BIT(type) (1U << (type))
+#define PSLR_EVENT_ALL ((1U << PSLR_EVENT_MAX) - 1)
+
+#define PSLR_WATCH_MIN_INTERVAL 0.05
+#define PSLR_WATCH_MAX_INTERVAL 1.0
+
+typedef struct {
+    pslr_event_type_t type;
+    int buffer;                     // buffer events only, -1 otherwise
+    uint64_t changed;               // PSLR_STATUS_BIT mask of the fields behind the event
+    const pslr_status *status;      // the watched fields of the latest poll
+} pslr_event_t;
+
+typedef void (*pslr_event_callback_t)(const pslr_event_t *event, uintptr_t user_data);
+
+typedef struct pslr_watch pslr_watch_t;
+
+pslr_watch_t *pslr_watch_new(pslr_handle_t h);
+/* Stops the thread, must not be called from a callback */
+void pslr_watch_free(pslr_watch_t *w);
+
+/* events is a PSLR_EVENT_BIT mask, the callbacks are called in the order
+ * of registration */
+int pslr_watch_add_callback(pslr_watch_t *w, uint32_t events, pslr_event_callback_t cb, uintptr_t user_data);
+/* Status fields decoded on top of the ones needed by the events,
+ * a change in them is reported as PSLR_EVENT_STATUS_CHANGED */
+void pslr_watch_set_fields(pslr_watch_t *w, uint64_t fields);
+void pslr_watch_set_interval(pslr_watch_t *w, double min_sec, double max_sec);
+
+/* Reads the status once and dispatches the events. The first poll reports
+ * every field as changed and the buffers already taken as new. delay is
+ * the time until the next poll, negative after a disconnect. */
+int pslr_watch_poll(pslr_watch_t *w, double *delay);
+/* Back to the minimal interval, e.g. after pressing the shutter */
+void pslr_watch_wake(pslr_watch_t *w);
+
+int pslr_watch_start(pslr_watch_t *w);
+void pslr_watch_stop(pslr_watch_t *w);
+void pslr_watch_lock(pslr_watch_t *w);
+void pslr_watch_unlock(pslr_watch_t *w);
+
+/* Takes the oldest queued event of the PSLR_EVENT_BIT mask, or waits for
+ * one, polling in the caller if the thread is not running. The events are
+ * queued from the creation of the watch, so several buffers taken between
+ * two calls are all reported; the queue keeps the latest 32 events.
+ * timeout_sec 0 waits forever. With the thread running the caller must not
+ * hold the watch lock. Returns PSLR_OK with the event, PSLR_READ_ERROR on
+ * timeout, PSLR_DEVICE_ERROR after a disconnect. */
+int pslr_watch_wait(pslr_watch_t *w, uint32_t events, double timeout_sec, pslr_event_t *event);
+/* The watched fields of the last poll */
+void pslr_watch_get_status(pslr_watch_t *w, pslr_status *status);
+
+#endif